@@ -1,15 +1,21 @@
-#ifndef RBBST_H
-#define RBBST_H
+#ifndef AVLBST_H
+#define AVLBST_H
 
 #include "bst.h"
 #include <algorithm>
+#include <cstdint>
 #include <cmath>
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <optional>
+#include <string>
 
 struct KeyError {};
 
+class SnapshotWriter;
+class SnapshotReader;
+
 /**
  * A special kind of node for an AVL tree, which adds the height as a data member, plus
  * other additional helper functions. You do NOT need to implement any functionality or
@@ -20,6 +26,7 @@ class AVLNode : public Node<Key, Value> {
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    AVLNode(AVLNode<Key, Value>&& other);
     virtual ~AVLNode();
 
     // Getter/setter for the node's height.
@@ -51,6 +58,13 @@ template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent)
         : Node<Key, Value>(key, value, parent), height_(1) {}
 
+/**
+ * Moves a node to a new address along with its height, see Node's.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(AVLNode<Key, Value>&& other)
+        : Node<Key, Value>(std::move(other)), height_(other.height_) {}
+
 /**
  * A destructor which does nothing.
  */
@@ -109,154 +123,226 @@ class AVLTree : public BinarySearchTree<Key, Value> {
 public:
     virtual void insert(const std::pair<const Key, Value>& new_item);  // TODO
     virtual void remove(const Key& key);                               // TODO
+    virtual void rebalance() override;
+
+    // Binary snapshots, see snapshot_avlbst.h
+    void save(std::ostream& out) const;
+    void save(int fd) const;
+    void load(std::istream& in);
+    void load(int fd);
+
+    // Packing the nodes into contiguous slabs, see relayout_avlbst.h
+    void relayout();
+    bool relayoutStep(size_t maxNodes);
+
 protected:
     virtual void nodeSwap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>* n2);
 
     // Add helper functions here
+    AVLNode<Key, Value>* findOrCreate(const Key& key, const Value& value, bool& created);
     void leftRotate(AVLNode<Key, Value>* node);
     void rightRotate(AVLNode<Key, Value>* node);
-    void balance(AVLNode<Key, Value>* node);
-    void removeUpdHeights(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* balance(AVLNode<Key, Value>* node);
+    void retrace(AVLNode<Key, Value>* node);
+    virtual void updateHeight(AVLNode<Key, Value>* node);
+    void saveSnapshot(SnapshotWriter& writer) const;
+    void loadSnapshot(SnapshotReader& reader);
+    void completeSubtree(AVLNode<Key, Value>* node);
+    virtual bool validateNode(const Node<Key, Value>* node, int left_height, int right_height, std::string* violation)
+            const override;
+    virtual AVLNode<Key, Value>* createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    virtual AVLNode<Key, Value>* relocateNode(AVLNode<Key, Value>* node, void* place);
+    void relayoutSubtree(AVLNode<Key, Value>* root, size_t count);
+    AVLNode<Key, Value>* firstAfter(const Key& key) const;
+    virtual size_t nodeSize() const override;
+    virtual size_t objectSize() const override;
+
+    std::optional<Key> relayoutCursor_;  // where relayoutStep() resumes, empty at the start of a sweep
 };
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item) {
     // TODO
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
 
-    Node<Key, Value>* temp
-            = BinarySearchTree<Key, Value>::internalFind(new_item.first);  // check if the node in the tree
-    if (temp != nullptr) {
-        temp->getItem().second = new_item.second;  // replace the value
-        return;
-    }
+    bool created;
+    AVLNode<Key, Value>* node = findOrCreate(new_item.first, new_item.second, created);
+    if (!created)
+        node->setValue(new_item.second);  // the key is already in the tree: replace the value
+}
 
+/**
+ * Returns the node for key, creating it with value and rebalancing if the
+ * key is not in the tree yet; created tells which happened. One descent
+ * either way, so callers that update the value in place need no second.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::findOrCreate(const Key& key, const Value& value, bool& created) {
+    created = true;
     if (this->root_ == nullptr) {
-        this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-        return;
+        AVLNode<Key, Value>* node = createNode(key, value, nullptr);
+        this->root_ = node;
+        return node;
     }
 
     AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);  // start from the root
+    AVLNode<Key, Value>* node;
+    const typename KeyPrefix<Key>::Type prefix = KeyPrefix<Key>::of(key);
 
     while (1) {
-        // if the item's key > the current node's key, move to the right
-        if (new_item.first > curr->getItem().first) {
+        this->stats_.visit();
+        int order = this->compareKey(key, prefix, curr);
+        // if the key < the current node's key, move to the left
+        if (order < 0) {
+            if (curr->getLeft() == nullptr) {
+                node = createNode(key, value, curr);
+                curr->setLeft(node);
+                break;
+            }
+            curr = curr->getLeft();  // advance to the left child
+        }
+        // if the key > the current node's key, move to the right
+        else if (order > 0) {
             if (curr->getRight() == nullptr) {
-                curr->setRight(new AVLNode<Key, Value>(new_item.first, new_item.second, curr));
-                curr = curr->getRight();
+                node = createNode(key, value, curr);
+                curr->setRight(node);
                 break;
             }
             curr = curr->getRight();  // advance to the right child
         }
-        // if the item's key < the current node's key, move to the left
+        // the key is already in the tree
         else {
-            if (curr->getLeft() == nullptr) {
-                curr->setLeft(new AVLNode<Key, Value>(new_item.first, new_item.second, curr));
-                curr = curr->getLeft();
-                break;
-            }
-            curr = curr->getLeft();  // advance to the left child
+            created = false;
+            return curr;
         }
     }
 
-    curr->setHeight(1);
-    curr = curr->getParent();
-    AVLNode<Key, Value>* tempr = curr;
+    retrace(curr);  // update heights and balance from the new node's parent up
+    return node;
+}
 
-    while (tempr != nullptr) {
-        if (tempr->getHeight() < tempr->getHeight() + 1) {
-            tempr->setHeight(tempr->getHeight() + 1);  // update all parents
-        }
-        tempr = tempr->getParent();
-    }
+/**
+ * Recomputes a node's height from the stored heights of its children.
+ * Subclasses that keep more per-subtree data override it to update that
+ * too; rotations, retracing and load() all go through here.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::updateHeight(AVLNode<Key, Value>* node) {
+    int right_child_height, left_child_height;
+
+    if (node->getRight() == nullptr)
+        right_child_height = 0;
+    else
+        right_child_height = node->getRight()->getHeight();
+
+    if (node->getLeft() == nullptr)
+        left_child_height = 0;
+    else
+        left_child_height = node->getLeft()->getHeight();
 
-    // this->print();
-    balance(curr);  // balance the updated tree
+    node->setHeight(std::max(right_child_height, left_child_height) + 1);
 }
 
+/**
+ * Walks up from node after an insert or remove below it, updating heights and
+ * rebalancing. Stops at the first subtree whose height did not change, since
+ * nothing above it can have been affected.
+ */
 template<class Key, class Value>
-void AVLTree<Key, Value>::balance(AVLNode<Key, Value>* node) {
-    AVLNode<Key, Value>* z = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key, Value>::doComparison(node));
+void AVLTree<Key, Value>::retrace(AVLNode<Key, Value>* node) {
+    uint64_t steps = 0;
+    while (node != nullptr) {
+        steps++;
+        int old_height = node->getHeight();
+        updateHeight(node);
+        node = balance(node);
+        if (node->getHeight() == old_height)
+            break;
+        node = node->getParent();
+    }
+    this->stats_.retrace(steps);
+}
 
-    if (z != nullptr) {
-        int right_child_height, left_child_height, right_right_child_height, right_left_child_height,
-                left_left_child_height, left_right_child_height;
+/**
+ * Rebalances the subtree rooted at z if its children's heights differ by more
+ * than one, using the stored heights. Returns the root of the subtree, which is
+ * z's replacement if a rotation took place.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::balance(AVLNode<Key, Value>* z) {
+    int right_child_height, left_child_height, right_right_child_height, right_left_child_height,
+            left_left_child_height, left_right_child_height;
 
-        if (z->getRight() == nullptr) {
-            right_child_height = 0;
+    if (z->getRight() == nullptr) {
+        right_child_height = 0;
+        right_right_child_height = 0;
+        right_left_child_height = 0;
+    } else {
+        right_child_height = z->getRight()->getHeight();
+
+        if (z->getRight()->getRight() == nullptr)
             right_right_child_height = 0;
-            right_left_child_height = 0;
-        } else {
-            right_child_height = z->getRight()->getHeight();
+        else
+            right_right_child_height = z->getRight()->getRight()->getHeight();
 
-            if (z->getRight()->getRight() == nullptr)
-                right_right_child_height = 0;
-            else
-                right_right_child_height = z->getRight()->getRight()->getHeight();
+        if (z->getRight()->getLeft() == nullptr)
+            right_left_child_height = 0;
+        else
+            right_left_child_height = z->getRight()->getLeft()->getHeight();
+    }
 
-            if (z->getRight()->getLeft() == nullptr)
-                right_left_child_height = 0;
-            else
-                right_left_child_height = z->getRight()->getLeft()->getHeight();
-        }
+    if (z->getLeft() == nullptr) {
+        left_child_height = 0;
+        left_left_child_height = 0;
+        left_right_child_height = 0;
+    } else {
+        left_child_height = z->getLeft()->getHeight();
 
-        if (z->getLeft() == nullptr) {
-            left_child_height = 0;
+        if (z->getLeft()->getLeft() == nullptr)
             left_left_child_height = 0;
-            left_right_child_height = 0;
-        } else {
-            left_child_height = z->getLeft()->getHeight();
+        else
+            left_left_child_height = z->getLeft()->getLeft()->getHeight();
 
-            if (z->getLeft()->getLeft() == nullptr)
-                left_left_child_height = 0;
-            else
-                left_left_child_height = z->getLeft()->getLeft()->getHeight();
+        if (z->getLeft()->getRight() == nullptr)
+            left_right_child_height = 0;
+        else
+            left_right_child_height = z->getLeft()->getRight()->getHeight();
+    }
 
-            if (z->getLeft()->getRight() == nullptr)
-                left_right_child_height = 0;
-            else
-                left_right_child_height = z->getLeft()->getRight()->getHeight();
-        }
+    if (std::abs(right_child_height - left_child_height) <= 1)
+        return z;
 
-        /* case 1: left rotate on z */
-        if (right_child_height > left_child_height && right_right_child_height >= right_left_child_height) {
-            leftRotate(z);
-        }
-        /* case 2: right rotate on z */
-        else if (left_child_height > right_child_height && left_left_child_height >= left_right_child_height) {
-            rightRotate(z);
-        }
-        /* case 3: right rotate on y, then left rotate on z */
-        else if (right_child_height > left_child_height && right_left_child_height > right_right_child_height) {
-            rightRotate(z->getRight());
-            leftRotate(z);
-        }
-        /* case 4: left rotate on y, then right rotate on z */
-        else if (left_child_height > right_child_height && left_right_child_height > left_left_child_height) {
-            leftRotate(z->getLeft());
-            rightRotate(z);
-        }
+    /* case 1: left rotate on z */
+    if (right_child_height > left_child_height && right_right_child_height >= right_left_child_height) {
+        leftRotate(z);
     }
+    /* case 2: right rotate on z */
+    else if (left_child_height > right_child_height && left_left_child_height >= left_right_child_height) {
+        rightRotate(z);
+    }
+    /* case 3: right rotate on y, then left rotate on z */
+    else if (right_child_height > left_child_height && right_left_child_height > right_right_child_height) {
+        rightRotate(z->getRight());
+        leftRotate(z);
+    }
+    /* case 4: left rotate on y, then right rotate on z */
+    else if (left_child_height > right_child_height && left_right_child_height > left_left_child_height) {
+        leftRotate(z->getLeft());
+        rightRotate(z);
+    }
+
+    return z->getParent();
 }
 
 template<typename Key, typename Value>
 // template<class Key, class Value>
 void AVLTree<Key, Value>::rightRotate(AVLNode<Key, Value>* z) {
+    this->stats_.rightRotation();
     AVLNode<Key, Value>* orphaned_child = z->getLeft()->getRight();
     AVLNode<Key, Value>* y = z->getLeft();
 
-    int z_right_child_height, orphaned_height;
-
-    if (z->getRight() == nullptr)
-        z_right_child_height = 0;
-    else
-        z_right_child_height = z->getRight()->getHeight();
-
-    if (orphaned_child == nullptr)
-        orphaned_height = 0;
-    else {
-        orphaned_height = orphaned_child->getHeight();
+    if (orphaned_child != nullptr)
         orphaned_child->setParent(z);
-    }
 
     // set the new parent for y
     y->setParent(z->getParent());
@@ -279,8 +365,9 @@ void AVLTree<Key, Value>::rightRotate(AVLNode<Key, Value>* z) {
     // set the new left child for z
     z->setLeft(orphaned_child);
 
-    // update z's height
-    z->setHeight(std::max(orphaned_height, z_right_child_height) + 1);
+    // update z's height, then y's which now sits on top of it
+    updateHeight(z);
+    updateHeight(y);
 
     if (z == this->root_)
         this->root_ = y;
@@ -289,22 +376,12 @@ void AVLTree<Key, Value>::rightRotate(AVLNode<Key, Value>* z) {
 template<typename Key, typename Value>
 // template<class Key, class Value>
 void AVLTree<Key, Value>::leftRotate(AVLNode<Key, Value>* z) {
+    this->stats_.leftRotation();
     AVLNode<Key, Value>* orphaned_child = z->getRight()->getLeft();
     AVLNode<Key, Value>* y = z->getRight();
 
-    int z_left_child_height, orphaned_height;
-
-    if (z->getLeft() == nullptr)
-        z_left_child_height = 0;
-    else
-        z_left_child_height = z->getLeft()->getHeight();
-
-    if (orphaned_child == nullptr)
-        orphaned_height = 0;
-    else {
-        orphaned_height = orphaned_child->getHeight();
+    if (orphaned_child != nullptr)
         orphaned_child->setParent(z);
-    }
 
     // set the new parent for y
     y->setParent(z->getParent());
@@ -327,145 +404,95 @@ void AVLTree<Key, Value>::leftRotate(AVLNode<Key, Value>* z) {
     // set the new right child for z
     z->setRight(orphaned_child);
 
-    // update z's height
-    z->setHeight(std::max(orphaned_height, z_left_child_height) + 1);
+    // update z's height, then y's which now sits on top of it
+    updateHeight(z);
+    updateHeight(y);
 
     if (z == this->root_)
         this->root_ = y;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeUpdHeights(AVLNode<Key, Value>* node) {
-    if (node == nullptr)
-        return;
-
-    int right_child_height, left_child_height;
-
-    if (node->getRight() == nullptr)
-        right_child_height = 0;
-    else
-        right_child_height = node->getRight()->getHeight();
-
-    if (node->getLeft() == nullptr)
-        left_child_height = 0;
-    else
-        left_child_height = node->getLeft()->getHeight();
-
-    node->setHeight(std::max(right_child_height, left_child_height) + 1);
-    removeUpdHeights(node->getParent());
-}
-
 template<class Key, class Value>
 void AVLTree<Key, Value>::remove(const Key& key) {
     // TODO
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_REMOVE);
     AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(
             BinarySearchTree<Key, Value>::internalFind(key));  // check if the node in the tree
     // if not in the tree
     if (temp == nullptr)
         return;
 
+    // if 2 children, swap with the predecessor so that temp has at most one child
+    if (temp->getRight() != nullptr && temp->getLeft() != nullptr) {
+        AVLNode<Key, Value>* pred = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key, Value>::predecessor(temp));
+        nodeSwap(temp, pred);
+    }
+
     AVLNode<Key, Value>* parent = temp->getParent();
     // if root without any children
     if (temp->getRight() == nullptr && temp->getLeft() == nullptr && parent == nullptr) {
         this->root_ = nullptr;
-        delete temp;
+        this->destroyNode(temp);
         return;
     }
     // if root with only right child
     else if (temp->getRight() != nullptr && temp->getLeft() == nullptr && parent == nullptr) {
         this->root_ = temp->getRight();
-        delete temp;
+        temp->getRight()->setParent(nullptr);
+        this->destroyNode(temp);
         return;
     }
     // if root with only left child
     else if (temp->getRight() == nullptr && temp->getLeft() != nullptr && parent == nullptr) {
         this->root_ = temp->getLeft();
-        delete temp;
+        temp->getLeft()->setParent(nullptr);
+        this->destroyNode(temp);
         return;
     }
     // if leaf node
     else if (temp->getRight() == nullptr && temp->getLeft() == nullptr) {
         if (parent->getRight() == temp) {
             parent->setRight(nullptr);
-            if (parent->getLeft() == nullptr)
-                parent->setHeight(1);
-            else
-                parent->setHeight(parent->getLeft()->getHeight() + 1);
-            removeUpdHeights(parent->getParent());
         } else {
             parent->setLeft(nullptr);
-            if (parent->getRight() == nullptr)
-                parent->setHeight(1);
-            else
-                parent->setHeight(parent->getRight()->getHeight() + 1);
-            removeUpdHeights(parent->getParent());
         }
-        delete temp;
-        balance(parent);
+        this->destroyNode(temp);
+        retrace(parent);
         return;
     }
     // if has 1 left child
     else if (temp->getRight() == nullptr && temp->getLeft() != nullptr) {
-        int right_child_height, left_child_height;
-
         if (parent->getRight() == temp) {
             parent->setRight(temp->getLeft());
         } else {
             parent->setLeft(temp->getLeft());
         }
-
-        if (parent->getRight() == nullptr)
-            right_child_height = 0;
-        else
-            right_child_height = parent->getRight()->getHeight();
-
-        if (parent->getLeft() == nullptr)
-            left_child_height = 0;
-        else
-            left_child_height = parent->getLeft()->getHeight();
-
-        temp->getLeft()->setParent(temp->getParent());
-        parent->setHeight(std::max(right_child_height, left_child_height) + 1);
-        removeUpdHeights(parent->getParent());
-        delete temp;
-        balance(parent);
+        temp->getLeft()->setParent(parent);
+        this->destroyNode(temp);
+        retrace(parent);
         return;
     }
     // if has 1 right child
-    else if (temp->getRight() != nullptr && temp->getLeft() == nullptr) {
-        int right_child_height, left_child_height;
-
+    else {
         if (parent->getRight() == temp) {
             parent->setRight(temp->getRight());
         } else {
             parent->setLeft(temp->getRight());
         }
-
-        if (parent->getRight() == nullptr)
-            right_child_height = 0;
-        else
-            right_child_height = parent->getRight()->getHeight();
-
-        if (parent->getLeft() == nullptr)
-            left_child_height = 0;
-        else
-            left_child_height = parent->getLeft()->getHeight();
-
         temp->getRight()->setParent(parent);
-        parent->setHeight(std::max(right_child_height, left_child_height) + 1);
-        removeUpdHeights(parent->getParent());
-        delete temp;
-        balance(parent);
+        this->destroyNode(temp);
+        retrace(parent);
         return;
     }
-    // if 2 children
-    else {
-        AVLNode<Key, Value>* pred = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key, Value>::predecessor(temp));
-        nodeSwap(temp, pred);
-    }
-    remove(temp->getKey());  // recursive call
 }
 
+/**
+ * An AVL tree is always within 1.44 log2(size) of optimal, and its heights
+ * would not survive a rebuild, so there is nothing to do.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebalance() {}
+
 template<class Key, class Value>
 void AVLTree<Key, Value>::nodeSwap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>* n2) {
     BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
@@ -474,4 +501,50 @@ void AVLTree<Key, Value>::nodeSwap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>*
     n2->setHeight(tempH);
 }
 
+/**
+ * Adds the AVL checks to BinarySearchTree::validate(): the stored height must
+ * match the measured one and the subtrees may differ in height by at most one.
+ */
+template<class Key, class Value>
+bool AVLTree<Key, Value>::validateNode(
+        const Node<Key, Value>* node, int left_height, int right_height, std::string* violation) const {
+    const AVLNode<Key, Value>* avl_node = static_cast<const AVLNode<Key, Value>*>(node);
+    if (avl_node->getHeight() != std::max(left_height, right_height) + 1) {
+        this->reportViolation(node, "stored height does not match the subtree", violation);
+        return false;
+    }
+    if (std::abs(left_height - right_height) > 1) {
+        this->reportViolation(node, "subtree heights differ by more than one", violation);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Allocates an AVL node, counting it like BinarySearchTree::createNode().
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>*
+AVLTree<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) {
+    AVLNode<Key, Value>* node = new AVLNode<Key, Value>(key, value, parent);
+    this->adoptNode(node);
+    return node;
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::nodeSize() const {
+    return sizeof(AVLNode<Key, Value>);
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::objectSize() const {
+    return sizeof(*this);
+}
+
+// include save/load (in their own file because the snapshot format needs some room)
+#include "snapshot_avlbst.h"
+
+// include relayout() and relayoutStep(), which pack the nodes into slabs
+#include "relayout_avlbst.h"
+
 #endif
@@ -0,0 +1,570 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef BALANCE_POLICIES_H
+#define BALANCE_POLICIES_H
+
+// Balancing policies for BalancedTree
+// Version 1
+//
+//   AVLBalance       subtree heights differ by at most one; stores the height
+//   RedBlackBalance  no red node has a red child and every path down to a
+//                    missing child passes the same number of black nodes
+//   WAVLBalance      weak AVL: rank differences are 1 or 2 and leaves have
+//                    rank 0; rebalances an insert like AVL and a remove with
+//                    at most two rotations, like red-black
+//   TreapBalance     a random priority per node, heap ordered; nothing to do
+//                    on remove
+//   SplayBalance     no invariant; every insert, find and remove moves the
+//                    node it touched to the root. The tree can degenerate
+//                    into a path, which everything in BinarySearchTree
+//                    handles without recursion, but amortized cost is
+//                    O(log n) and recently used keys are near the root
+//
+// Each policy is a class with static member templates taking the tree, so
+// that it can call the tree's rotations; see BalancedTree for the hooks.
+
+/**
+ * Height balancing, as in AVLTree. A missing child has height 0 and a leaf 1.
+ */
+struct AVLBalance {
+    typedef int Meta;
+    static const bool splaysOnAccess = false;
+
+    static const char* name() {
+        return "avl";
+    }
+
+    template<typename Node>
+    static int height(const Node* node) {
+        return node == nullptr ? 0 : node->getMeta();
+    }
+
+    template<typename Node>
+    static void update(Node* node) {
+        node->setMeta(std::max(height(node->getLeft()), height(node->getRight())) + 1);
+    }
+
+    template<typename Tree>
+    static void initNode(Tree& /* tree */, typename Tree::NodeType* node) {
+        node->setMeta(1);
+    }
+
+    template<typename Tree>
+    static void afterInsert(Tree& tree, typename Tree::NodeType* node) {
+        retrace(tree, node->getParent());
+    }
+
+    template<typename Tree>
+    static void afterRemove(
+            Tree& tree,
+            typename Tree::NodeType* parent,
+            typename Tree::NodeType* /* child */,
+            bool /* childIsLeft */,
+            int /* meta */) {
+        retrace(tree, parent);
+    }
+
+    template<typename Tree>
+    static void afterAccess(Tree& /* tree */, typename Tree::NodeType* /* node */) {}
+
+    // Walks up from node, rotating where the heights differ by two, until a
+    // subtree comes out as high as it was before.
+    template<typename Tree>
+    static void retrace(Tree& tree, typename Tree::NodeType* node) {
+        typedef typename Tree::NodeType N;
+        uint64_t steps = 0;
+        while (node != nullptr) {
+            steps++;
+            int before = node->getMeta();
+            int balance = height(node->getLeft()) - height(node->getRight());
+            if (balance > 1) {
+                N* left = node->getLeft();
+                if (height(left->getLeft()) < height(left->getRight())) {
+                    tree.rotateLeft(left);
+                    update(left);
+                }
+                tree.rotateRight(node);
+            } else if (balance < -1) {
+                N* right = node->getRight();
+                if (height(right->getRight()) < height(right->getLeft())) {
+                    tree.rotateRight(right);
+                    update(right);
+                }
+                tree.rotateLeft(node);
+            }
+            update(node);
+            if (balance > 1 || balance < -1) {
+                node = node->getParent();  // the new root of the subtree
+                update(node);
+            }
+            if (node->getMeta() == before)
+                break;
+            node = node->getParent();
+        }
+        tree.stats_.retrace(steps);
+    }
+
+    template<typename Node>
+    static const char* check(const Node* node, int left_height, int right_height) {
+        if (node->getMeta() != std::max(left_height, right_height) + 1)
+            return "stored height is wrong";
+        if (std::abs(left_height - right_height) > 1)
+            return "subtree heights differ by more than one";
+        return nullptr;
+    }
+};
+
+/**
+ * Red-black balancing, following CLRS. A missing child counts as black.
+ */
+struct RedBlackBalance {
+    typedef bool Meta;  // true for red
+    static const bool splaysOnAccess = false;
+
+    static const char* name() {
+        return "red-black";
+    }
+
+    template<typename Node>
+    static bool isRed(const Node* node) {
+        return node != nullptr && node->getMeta();
+    }
+
+    template<typename Tree>
+    static void initNode(Tree& /* tree */, typename Tree::NodeType* node) {
+        node->setMeta(true);
+    }
+
+    template<typename Tree>
+    static void afterInsert(Tree& tree, typename Tree::NodeType* node) {
+        typedef typename Tree::NodeType N;
+        N* parent;
+        while ((parent = node->getParent()) != nullptr && isRed(parent)) {
+            N* grandparent = parent->getParent();  // a red parent is never the root
+            if (parent == grandparent->getLeft()) {
+                N* uncle = grandparent->getRight();
+                if (isRed(uncle)) {
+                    parent->setMeta(false);
+                    uncle->setMeta(false);
+                    grandparent->setMeta(true);
+                    node = grandparent;
+                    continue;
+                }
+                if (node == parent->getRight()) {
+                    tree.rotateLeft(parent);
+                    node = parent;
+                    parent = node->getParent();
+                }
+                parent->setMeta(false);
+                grandparent->setMeta(true);
+                tree.rotateRight(grandparent);
+            } else {
+                N* uncle = grandparent->getLeft();
+                if (isRed(uncle)) {
+                    parent->setMeta(false);
+                    uncle->setMeta(false);
+                    grandparent->setMeta(true);
+                    node = grandparent;
+                    continue;
+                }
+                if (node == parent->getLeft()) {
+                    tree.rotateRight(parent);
+                    node = parent;
+                    parent = node->getParent();
+                }
+                parent->setMeta(false);
+                grandparent->setMeta(true);
+                tree.rotateLeft(grandparent);
+            }
+        }
+        tree.getRoot()->setMeta(false);
+    }
+
+    // Removing a black node leaves child's side one black short. child may
+    // be null, so the loop tracks its parent and side separately.
+    template<typename Tree>
+    static void afterRemove(
+            Tree& tree,
+            typename Tree::NodeType* parent,
+            typename Tree::NodeType* child,
+            bool childIsLeft,
+            bool removedRed) {
+        typedef typename Tree::NodeType N;
+        if (removedRed)
+            return;
+
+        N* node = child;
+        bool isLeft = childIsLeft;
+        while (parent != nullptr && !isRed(node)) {
+            if (isLeft) {
+                N* sibling = parent->getRight();  // never null: that side has a black node more
+                if (isRed(sibling)) {
+                    sibling->setMeta(false);
+                    parent->setMeta(true);
+                    tree.rotateLeft(parent);
+                    sibling = parent->getRight();
+                }
+                if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())) {
+                    sibling->setMeta(true);
+                    node = parent;
+                } else {
+                    if (!isRed(sibling->getRight())) {
+                        sibling->getLeft()->setMeta(false);
+                        sibling->setMeta(true);
+                        tree.rotateRight(sibling);
+                        sibling = parent->getRight();
+                    }
+                    sibling->setMeta(parent->getMeta());
+                    parent->setMeta(false);
+                    sibling->getRight()->setMeta(false);
+                    tree.rotateLeft(parent);
+                    node = tree.getRoot();
+                }
+            } else {
+                N* sibling = parent->getLeft();
+                if (isRed(sibling)) {
+                    sibling->setMeta(false);
+                    parent->setMeta(true);
+                    tree.rotateRight(parent);
+                    sibling = parent->getLeft();
+                }
+                if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())) {
+                    sibling->setMeta(true);
+                    node = parent;
+                } else {
+                    if (!isRed(sibling->getLeft())) {
+                        sibling->getRight()->setMeta(false);
+                        sibling->setMeta(true);
+                        tree.rotateLeft(sibling);
+                        sibling = parent->getLeft();
+                    }
+                    sibling->setMeta(parent->getMeta());
+                    parent->setMeta(false);
+                    sibling->getLeft()->setMeta(false);
+                    tree.rotateRight(parent);
+                    node = tree.getRoot();
+                }
+            }
+            parent = node->getParent();
+            isLeft = parent != nullptr && parent->getLeft() == node;
+        }
+        if (node != nullptr)
+            node->setMeta(false);
+    }
+
+    template<typename Tree>
+    static void afterAccess(Tree& /* tree */, typename Tree::NodeType* /* node */) {}
+
+    // The number of black nodes on the leftmost path down from node.
+    template<typename Node>
+    static int blackHeight(const Node* node) {
+        int height = 0;
+        for (; node != nullptr; node = node->getLeft()) {
+            if (!node->getMeta())
+                height++;
+        }
+        return height;
+    }
+
+    // Each subtree having equal black heights on both sides (by the leftmost
+    // path, checked bottom up) makes them equal on all paths. That costs a
+    // walk down at every node, so validate() is O(n log n) here.
+    template<typename Node>
+    static const char* check(const Node* node, int /* left_height */, int /* right_height */) {
+        if (node->getParent() == nullptr && node->getMeta())
+            return "root is red";
+        if (node->getMeta() && (isRed(node->getLeft()) || isRed(node->getRight())))
+            return "red node has a red child";
+        if (blackHeight(node->getLeft()) != blackHeight(node->getRight()))
+            return "black heights differ";
+        return nullptr;
+    }
+};
+
+/**
+ * Weak AVL balancing (Haeupler, Sen and Tarjan, "Rank-balanced trees"). A
+ * missing child has rank -1 and a leaf rank 0; every rank difference between
+ * a node and its child is 1 or 2.
+ */
+struct WAVLBalance {
+    typedef int Meta;
+    static const bool splaysOnAccess = false;
+
+    static const char* name() {
+        return "wavl";
+    }
+
+    template<typename Node>
+    static int rank(const Node* node) {
+        return node == nullptr ? -1 : node->getMeta();
+    }
+
+    template<typename Node>
+    static void promote(Node* node) {
+        node->setMeta(node->getMeta() + 1);
+    }
+
+    template<typename Node>
+    static void demote(Node* node) {
+        node->setMeta(node->getMeta() - 1);
+    }
+
+    template<typename Tree>
+    static void initNode(Tree& /* tree */, typename Tree::NodeType* node) {
+        node->setMeta(0);
+    }
+
+    // Promotes up the tree while node is a 0-child with a 1-sibling, then
+    // fixes a 0-child with a 2-sibling with one or two rotations.
+    template<typename Tree>
+    static void afterInsert(Tree& tree, typename Tree::NodeType* node) {
+        typedef typename Tree::NodeType N;
+        N* parent = node->getParent();
+        while (parent != nullptr && rank(parent) == rank(node)) {
+            bool isLeft = parent->getLeft() == node;
+            N* sibling = isLeft ? parent->getRight() : parent->getLeft();
+            if (rank(parent) - rank(sibling) == 1) {
+                promote(parent);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+
+            N* inner = isLeft ? node->getRight() : node->getLeft();
+            if (rank(node) - rank(inner) == 2) {
+                if (isLeft)
+                    tree.rotateRight(parent);
+                else
+                    tree.rotateLeft(parent);
+                demote(parent);
+            } else {
+                if (isLeft) {
+                    tree.rotateLeft(node);
+                    tree.rotateRight(parent);
+                } else {
+                    tree.rotateRight(node);
+                    tree.rotateLeft(parent);
+                }
+                promote(inner);
+                demote(node);
+                demote(parent);
+            }
+            break;
+        }
+    }
+
+    // Demotes a parent left as a 2,2 leaf, then walks up while node is a
+    // 3-child, demoting, until one or two rotations end it.
+    template<typename Tree>
+    static void afterRemove(
+            Tree& tree,
+            typename Tree::NodeType* parent,
+            typename Tree::NodeType* child,
+            bool childIsLeft,
+            int /* rank */) {
+        typedef typename Tree::NodeType N;
+        if (parent == nullptr)
+            return;
+
+        N* node = child;
+        bool isLeft = childIsLeft;
+        if (parent->getLeft() == nullptr && parent->getRight() == nullptr && rank(parent) == 1) {
+            demote(parent);
+            node = parent;
+            parent = node->getParent();
+            isLeft = parent != nullptr && parent->getLeft() == node;
+        }
+
+        while (parent != nullptr && rank(parent) - rank(node) == 3) {
+            N* sibling = isLeft ? parent->getRight() : parent->getLeft();
+            if (rank(parent) - rank(sibling) == 2) {
+                demote(parent);
+            } else if (rank(sibling) - rank(sibling->getLeft()) == 2
+                       && rank(sibling) - rank(sibling->getRight()) == 2) {
+                demote(parent);
+                demote(sibling);
+            } else {
+                N* outer = isLeft ? sibling->getRight() : sibling->getLeft();
+                N* inner = isLeft ? sibling->getLeft() : sibling->getRight();
+                if (rank(sibling) - rank(outer) == 1) {
+                    if (isLeft)
+                        tree.rotateLeft(parent);
+                    else
+                        tree.rotateRight(parent);
+                    promote(sibling);
+                    demote(parent);
+                    if (parent->getLeft() == nullptr && parent->getRight() == nullptr)
+                        demote(parent);
+                } else {
+                    if (isLeft) {
+                        tree.rotateRight(sibling);
+                        tree.rotateLeft(parent);
+                    } else {
+                        tree.rotateLeft(sibling);
+                        tree.rotateRight(parent);
+                    }
+                    promote(inner);
+                    promote(inner);
+                    demote(sibling);
+                    demote(parent);
+                    demote(parent);
+                }
+                break;
+            }
+            node = parent;
+            parent = node->getParent();
+            isLeft = parent != nullptr && parent->getLeft() == node;
+        }
+    }
+
+    template<typename Tree>
+    static void afterAccess(Tree& /* tree */, typename Tree::NodeType* /* node */) {}
+
+    template<typename Node>
+    static const char* check(const Node* node, int /* left_height */, int /* right_height */) {
+        int left = rank(node) - rank(node->getLeft());
+        int right = rank(node) - rank(node->getRight());
+        if (left < 1 || left > 2 || right < 1 || right > 2)
+            return "rank difference is not 1 or 2";
+        if (node->getLeft() == nullptr && node->getRight() == nullptr && rank(node) != 0)
+            return "leaf rank is not 0";
+        return nullptr;
+    }
+};
+
+/**
+ * Treap balancing: each node draws a random priority, and parents have
+ * higher priorities than their children. A node with at most one child can
+ * be unlinked without breaking that, so remove needs no fixing up.
+ */
+struct TreapBalance {
+    typedef uint64_t Meta;
+    static const bool splaysOnAccess = false;
+
+    static const char* name() {
+        return "treap";
+    }
+
+    template<typename Tree>
+    static void initNode(Tree& tree, typename Tree::NodeType* node) {
+        node->setMeta(tree.nextRandom());
+    }
+
+    template<typename Tree>
+    static void afterInsert(Tree& tree, typename Tree::NodeType* node) {
+        while (node->getParent() != nullptr && node->getParent()->getMeta() < node->getMeta()) {
+            if (node->getParent()->getLeft() == node)
+                tree.rotateRight(node->getParent());
+            else
+                tree.rotateLeft(node->getParent());
+        }
+    }
+
+    template<typename Tree>
+    static void afterRemove(
+            Tree& /* tree */,
+            typename Tree::NodeType* /* parent */,
+            typename Tree::NodeType* /* child */,
+            bool /* childIsLeft */,
+            uint64_t /* priority */) {}
+
+    template<typename Tree>
+    static void afterAccess(Tree& /* tree */, typename Tree::NodeType* /* node */) {}
+
+    template<typename Node>
+    static const char* check(const Node* node, int /* left_height */, int /* right_height */) {
+        if ((node->getLeft() != nullptr && node->getMeta() < node->getLeft()->getMeta())
+            || (node->getRight() != nullptr && node->getMeta() < node->getRight()->getMeta()))
+            return "priority is lower than a child's";
+        return nullptr;
+    }
+};
+
+/**
+ * Splay balancing (Sleator and Tarjan): the node an operation touched is
+ * rotated to the root by zig, zig-zig and zig-zag steps. Its Meta is unused.
+ */
+struct SplayBalance {
+    struct Meta {};
+    static const bool splaysOnAccess = true;
+
+    static const char* name() {
+        return "splay";
+    }
+
+    template<typename Tree>
+    static void splay(Tree& tree, typename Tree::NodeType* node) {
+        typedef typename Tree::NodeType N;
+        N* parent;
+        while ((parent = node->getParent()) != nullptr) {
+            N* grandparent = parent->getParent();
+            bool isLeft = parent->getLeft() == node;
+            if (grandparent == nullptr) {
+                if (isLeft)
+                    tree.rotateRight(parent);
+                else
+                    tree.rotateLeft(parent);
+            } else if (isLeft && grandparent->getLeft() == parent) {
+                tree.rotateRight(grandparent);
+                tree.rotateRight(parent);
+            } else if (!isLeft && grandparent->getRight() == parent) {
+                tree.rotateLeft(grandparent);
+                tree.rotateLeft(parent);
+            } else if (isLeft) {
+                tree.rotateRight(parent);
+                tree.rotateLeft(grandparent);
+            } else {
+                tree.rotateLeft(parent);
+                tree.rotateRight(grandparent);
+            }
+        }
+    }
+
+    template<typename Tree>
+    static void initNode(Tree& /* tree */, typename Tree::NodeType* /* node */) {}
+
+    template<typename Tree>
+    static void afterInsert(Tree& tree, typename Tree::NodeType* node) {
+        splay(tree, node);
+    }
+
+    template<typename Tree>
+    static void afterRemove(
+            Tree& tree,
+            typename Tree::NodeType* parent,
+            typename Tree::NodeType* /* child */,
+            bool /* childIsLeft */,
+            Meta /* meta */) {
+        if (parent != nullptr)
+            splay(tree, parent);
+    }
+
+    template<typename Tree>
+    static void afterAccess(Tree& tree, typename Tree::NodeType* node) {
+        splay(tree, node);
+    }
+
+    template<typename Node>
+    static const char* check(const Node* /* node */, int /* left_height */, int /* right_height */) {
+        return nullptr;
+    }
+};
+
+template<typename Key, typename Value>
+using AVLBalancedTree = BalancedTree<Key, Value, AVLBalance>;
+
+template<typename Key, typename Value>
+using RedBlackTree = BalancedTree<Key, Value, RedBlackBalance>;
+
+template<typename Key, typename Value>
+using WAVLTree = BalancedTree<Key, Value, WAVLBalance>;
+
+template<typename Key, typename Value>
+using Treap = BalancedTree<Key, Value, TreapBalance>;
+
+template<typename Key, typename Value>
+using SplayTree = BalancedTree<Key, Value, SplayBalance>;
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef BALANCED_BST_H
+#define BALANCED_BST_H
+
+#include "bst.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+/**
+ * A node for a BalancedTree, which adds whatever per-node state the balancing
+ * policy needs (a height, a rank, a color or a priority) to the plain Node.
+ */
+template<typename Key, typename Value, typename Meta>
+class BalancedNode : public Node<Key, Value> {
+public:
+    BalancedNode(const Key& key, const Value& value, BalancedNode<Key, Value, Meta>* parent);
+    virtual ~BalancedNode();
+
+    const Meta& getMeta() const;
+    void setMeta(const Meta& meta);
+
+    // Redefined to return BalancedNodes, like AVLNode does.
+    virtual BalancedNode<Key, Value, Meta>* getParent() const override;
+    virtual BalancedNode<Key, Value, Meta>* getLeft() const override;
+    virtual BalancedNode<Key, Value, Meta>* getRight() const override;
+
+protected:
+    Meta meta_;
+};
+
+/**
+ * A binary search tree whose balancing is left to a policy class. The tree
+ * does the searching, linking and unlinking, and the policy restores its
+ * invariant through a few hooks:
+ *
+ *   typedef ... Meta;                                  per-node state
+ *   static const bool splaysOnAccess;                  whether find() calls afterAccess()
+ *   static const char* name();
+ *   initNode(tree, node)                               before a new node is linked in
+ *   afterInsert(tree, node)                            after a new node is linked in
+ *   afterRemove(tree, parent, child, childIsLeft, meta)
+ *                                                      after a node with at most one child
+ *                                                      was replaced by child (maybe null)
+ *                                                      under parent; meta is what it held
+ *   afterAccess(tree, node)                            after a find, or an insert of an existing key
+ *   check(node, left_height, right_height)             for validate(): a violation or nullptr
+ *
+ * The policies below are AVLBalance, RedBlackBalance, WAVLBalance,
+ * TreapBalance and SplayBalance. Removing a node with two children swaps it
+ * with its predecessor first, and the policies' state travels with the
+ * position, not the key, so each policy only ever deals with removing a
+ * node that has at most one child.
+ */
+template<typename Key, typename Value, typename Policy>
+class BalancedTree : public BinarySearchTree<Key, Value> {
+public:
+    typedef BalancedNode<Key, Value, typename Policy::Meta> NodeType;
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+
+    BalancedTree();
+
+    virtual void insert(const std::pair<const Key, Value>& new_item) override;
+    virtual void remove(const Key& key) override;
+    virtual void rebalance() override;
+
+    // A splay tree restructures itself on lookups, so find() is not const for
+    // it; a const tree still gets the plain const find().
+    using BinarySearchTree<Key, Value>::find;
+    iterator find(const Key& key);
+
+    static const char* policyName();
+
+protected:
+    friend Policy;
+
+    NodeType* getRoot() const;
+    void rotateLeft(NodeType* node);
+    void rotateRight(NodeType* node);
+    uint64_t nextRandom();
+
+    NodeType* descend(const Key& key, NodeType*& last);
+    NodeType* createNode(const Key& key, const Value& value, NodeType* parent);
+    virtual void nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2) override;
+    virtual bool validateNode(const Node<Key, Value>* node, int left_height, int right_height, std::string* violation)
+            const override;
+    virtual size_t nodeSize() const override;
+    virtual size_t objectSize() const override;
+
+    uint64_t random_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the BalancedNode class.
+  -------------------------------------------------
+*/
+
+/**
+ * An explicit constructor which value-initializes the policy's state; the
+ * policy sets it properly in initNode().
+ */
+template<typename Key, typename Value, typename Meta>
+BalancedNode<Key, Value, Meta>::BalancedNode(
+        const Key& key, const Value& value, BalancedNode<Key, Value, Meta>* parent)
+        : Node<Key, Value>(key, value, parent), meta_() {}
+
+/**
+ * A destructor which does nothing.
+ */
+template<typename Key, typename Value, typename Meta>
+BalancedNode<Key, Value, Meta>::~BalancedNode() {}
+
+/**
+ * A getter for the policy's state.
+ */
+template<typename Key, typename Value, typename Meta>
+const Meta& BalancedNode<Key, Value, Meta>::getMeta() const {
+    return meta_;
+}
+
+/**
+ * A setter for the policy's state.
+ */
+template<typename Key, typename Value, typename Meta>
+void BalancedNode<Key, Value, Meta>::setMeta(const Meta& meta) {
+    meta_ = meta;
+}
+
+/**
+ * Overridden so that callers get a BalancedNode back, see AVLNode::getParent().
+ */
+template<typename Key, typename Value, typename Meta>
+BalancedNode<Key, Value, Meta>* BalancedNode<Key, Value, Meta>::getParent() const {
+    return static_cast<BalancedNode<Key, Value, Meta>*>(this->parent_);
+}
+
+/**
+ * Overridden for the same reasons as above.
+ */
+template<typename Key, typename Value, typename Meta>
+BalancedNode<Key, Value, Meta>* BalancedNode<Key, Value, Meta>::getLeft() const {
+    return static_cast<BalancedNode<Key, Value, Meta>*>(this->left_);
+}
+
+/**
+ * Overridden for the same reasons as above.
+ */
+template<typename Key, typename Value, typename Meta>
+BalancedNode<Key, Value, Meta>* BalancedNode<Key, Value, Meta>::getRight() const {
+    return static_cast<BalancedNode<Key, Value, Meta>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the BalancedNode class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the BalancedTree class.
+  -------------------------------------------------
+*/
+
+/**
+ * Default constructor. The random state only matters to TreapBalance; it
+ * starts from a fixed seed so that runs are reproducible.
+ */
+template<typename Key, typename Value, typename Policy>
+BalancedTree<Key, Value, Policy>::BalancedTree() : random_(0x853c49e6748fea9bull) {}
+
+/**
+ * Inserts a key/value pair, replacing the value if the key is present, and
+ * lets the policy rebalance.
+ */
+template<typename Key, typename Value, typename Policy>
+void BalancedTree<Key, Value, Policy>::insert(const std::pair<const Key, Value>& new_item) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
+
+    NodeType* parent = nullptr;
+    NodeType* node = descend(new_item.first, parent);
+    if (node != nullptr) {
+        node->setValue(new_item.second);  // replace the value
+        Policy::afterAccess(*this, node);
+        return;
+    }
+
+    node = createNode(new_item.first, new_item.second, parent);
+    Policy::initNode(*this, node);
+    if (parent == nullptr)
+        this->root_ = node;
+    else if (this->keyLess(new_item.first, parent->getKey()))
+        parent->setLeft(node);
+    else
+        parent->setRight(node);
+    Policy::afterInsert(*this, node);
+}
+
+/**
+ * Removes a key if present. A node with two children first trades places
+ * with its predecessor, so the node unlinked always has at most one child.
+ */
+template<typename Key, typename Value, typename Policy>
+void BalancedTree<Key, Value, Policy>::remove(const Key& key) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_REMOVE);
+
+    NodeType* last = nullptr;
+    NodeType* node = descend(key, last);
+    if (node == nullptr) {
+        if (last != nullptr)
+            Policy::afterAccess(*this, last);
+        return;
+    }
+
+    if (node->getLeft() != nullptr && node->getRight() != nullptr)
+        nodeSwap(node, BinarySearchTree<Key, Value>::predecessor(node));
+
+    NodeType* parent = node->getParent();
+    NodeType* child = node->getLeft() != nullptr ? node->getLeft() : node->getRight();
+    bool childIsLeft = parent != nullptr && parent->getLeft() == node;
+    if (child != nullptr)
+        child->setParent(parent);
+    if (parent == nullptr)
+        this->root_ = child;
+    else if (childIsLeft)
+        parent->setLeft(child);
+    else
+        parent->setRight(child);
+
+    typename Policy::Meta meta = node->getMeta();
+    this->destroyNode(node);
+    Policy::afterRemove(*this, parent, child, childIsLeft, meta);
+}
+
+/**
+ * The policy owns the shape and the per-node state that goes with it, so a
+ * rebuild is left to it.
+ */
+template<typename Key, typename Value, typename Policy>
+void BalancedTree<Key, Value, Policy>::rebalance() {}
+
+/**
+ * Looks a key up. Only a splaying policy needs this overload: it moves the
+ * node found (or the last node visited on a miss) to the root.
+ */
+template<typename Key, typename Value, typename Policy>
+typename BalancedTree<Key, Value, Policy>::iterator BalancedTree<Key, Value, Policy>::find(const Key& key) {
+    if (!Policy::splaysOnAccess)
+        return BinarySearchTree<Key, Value>::find(key);
+
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    NodeType* last = nullptr;
+    NodeType* node = descend(key, last);
+    if (node != nullptr)
+        Policy::afterAccess(*this, node);
+    else if (last != nullptr)
+        Policy::afterAccess(*this, last);
+    return this->iteratorAt(node);
+}
+
+/**
+ * The name of the balancing policy, for reports.
+ */
+template<typename Key, typename Value, typename Policy>
+const char* BalancedTree<Key, Value, Policy>::policyName() {
+    return Policy::name();
+}
+
+template<typename Key, typename Value, typename Policy>
+typename BalancedTree<Key, Value, Policy>::NodeType* BalancedTree<Key, Value, Policy>::getRoot() const {
+    return static_cast<NodeType*>(this->root_);
+}
+
+/**
+ * Rotates node's right child up into its place. Only the links change; the
+ * policy updates its own state around the call.
+ */
+template<typename Key, typename Value, typename Policy>
+void BalancedTree<Key, Value, Policy>::rotateLeft(NodeType* node) {
+    this->stats_.leftRotation();
+    NodeType* y = node->getRight();
+    NodeType* parent = node->getParent();
+
+    node->setRight(y->getLeft());
+    if (y->getLeft() != nullptr)
+        y->getLeft()->setParent(node);
+
+    y->setParent(parent);
+    if (parent == nullptr)
+        this->root_ = y;
+    else if (parent->getLeft() == node)
+        parent->setLeft(y);
+    else
+        parent->setRight(y);
+
+    y->setLeft(node);
+    node->setParent(y);
+}
+
+/**
+ * Rotates node's left child up into its place.
+ */
+template<typename Key, typename Value, typename Policy>
+void BalancedTree<Key, Value, Policy>::rotateRight(NodeType* node) {
+    this->stats_.rightRotation();
+    NodeType* y = node->getLeft();
+    NodeType* parent = node->getParent();
+
+    node->setLeft(y->getRight());
+    if (y->getRight() != nullptr)
+        y->getRight()->setParent(node);
+
+    y->setParent(parent);
+    if (parent == nullptr)
+        this->root_ = y;
+    else if (parent->getLeft() == node)
+        parent->setLeft(y);
+    else
+        parent->setRight(y);
+
+    y->setRight(node);
+    node->setParent(y);
+}
+
+/**
+ * splitmix64 over the tree's own state.
+ */
+template<typename Key, typename Value, typename Policy>
+uint64_t BalancedTree<Key, Value, Policy>::nextRandom() {
+    uint64_t z = (random_ += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Walks down to key. Returns its node, or nullptr with last set to the node
+ * the key would hang from.
+ */
+template<typename Key, typename Value, typename Policy>
+typename BalancedTree<Key, Value, Policy>::NodeType*
+BalancedTree<Key, Value, Policy>::descend(const Key& key, NodeType*& last) {
+    NodeType* curr = getRoot();
+    const typename KeyPrefix<Key>::Type prefix = KeyPrefix<Key>::of(key);
+    last = nullptr;
+    while (curr != nullptr) {
+        this->stats_.visit();
+        int order = this->compareKey(key, prefix, curr);
+        if (order < 0) {
+            last = curr;
+            curr = curr->getLeft();
+        } else if (order > 0) {
+            last = curr;
+            curr = curr->getRight();
+        } else {
+            return curr;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Allocates a node, counting it like BinarySearchTree::createNode().
+ */
+template<typename Key, typename Value, typename Policy>
+typename BalancedTree<Key, Value, Policy>::NodeType*
+BalancedTree<Key, Value, Policy>::createNode(const Key& key, const Value& value, NodeType* parent) {
+    NodeType* node = new NodeType(key, value, parent);
+    this->adoptNode(node);
+    return node;
+}
+
+/**
+ * Swaps two nodes' positions along with the policy state, which belongs to
+ * the position.
+ */
+template<typename Key, typename Value, typename Policy>
+void BalancedTree<Key, Value, Policy>::nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2) {
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    NodeType* b1 = static_cast<NodeType*>(n1);
+    NodeType* b2 = static_cast<NodeType*>(n2);
+    typename Policy::Meta temp = b1->getMeta();
+    b1->setMeta(b2->getMeta());
+    b2->setMeta(temp);
+}
+
+/**
+ * Lets the policy check its invariant at every node during validate().
+ */
+template<typename Key, typename Value, typename Policy>
+bool BalancedTree<Key, Value, Policy>::validateNode(
+        const Node<Key, Value>* node, int left_height, int right_height, std::string* violation) const {
+    const char* problem = Policy::check(static_cast<const NodeType*>(node), left_height, right_height);
+    if (problem != nullptr) {
+        this->reportViolation(node, problem, violation);
+        return false;
+    }
+    return true;
+}
+
+template<typename Key, typename Value, typename Policy>
+size_t BalancedTree<Key, Value, Policy>::nodeSize() const {
+    return sizeof(NodeType);
+}
+
+template<typename Key, typename Value, typename Policy>
+size_t BalancedTree<Key, Value, Policy>::objectSize() const {
+    return sizeof(*this);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the BalancedTree class.
+  -----------------------------------------------
+*/
+
+// include the balancing policies (in their own file because there are five of them)
+#include "balance_policies.h"
+
+#endif
@@ -0,0 +1,96 @@
+#include <cstddef>
+
+#ifndef BATCH_BST_H
+#define BATCH_BST_H
+
+// BST batched lookups
+// Version 1
+//
+// A single find() is a chain of dependent loads: the next node's address is
+// only known once the current one has arrived, so on a tree much larger
+// than the cache each level waits out a full memory latency and the CPU
+// sits idle. findBatch() runs up to FIND_BATCH_GROUP descents at once,
+// round robin: each step moves one descent down one level and prefetches
+// the child it lands on, then moves to the next descent, by which time the
+// next descent's node has had a whole round to arrive. A descent that
+// finishes is replaced by the next key right away, so the group stays full
+// (asynchronous memory access chaining).
+//
+// Keys ruled out by the membership filter, if there is one, never take a
+// slot. The lookup cache is not used, and neither is any subclass's own
+// find(): a splay tree is not splayed and HybridAVLMap's hash index is
+// bypassed. Batched lookups count node visits and comparisons but not
+// finds.
+
+#define FIND_BATCH_GROUP 16
+
+#if defined(__GNUC__)
+#define AVLBST_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define AVLBST_PREFETCH(address) ((void)(address))
+#endif
+
+/**
+ * Looks up count keys, storing an iterator to each key's item, or end(),
+ * in out[0..count). Returns how many were found. Faster than calling find()
+ * in a loop once the tree no longer fits in the cache.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::findBatch(const Key* keys, size_t count, iterator* out) const {
+    struct Lane {
+        Node<Key, Value>* node;
+        size_t index;
+        typename KeyPrefix<Key>::Type prefix;
+    };
+
+    Lane lanes[FIND_BATCH_GROUP];
+    int lanesUsed = 0;  // lanes[0..lanesUsed) are descending
+    size_t next = 0;    // the next key to start on
+    size_t found = 0;
+
+    while (true) {
+        // start descents until the group is full or the keys run out
+        while (lanesUsed < FIND_BATCH_GROUP && next < count) {
+            size_t i = next++;
+            if (root_ == nullptr || (filter_.enabled() && !filter_.mayContain(keys[i]))) {
+                out[i] = end();
+                continue;
+            }
+            lanes[lanesUsed++] = Lane{root_, i, KeyPrefix<Key>::of(keys[i])};
+        }
+        if (lanesUsed == 0)
+            break;
+
+        // move every descent down one level
+        for (int l = 0; l < lanesUsed;) {
+            Lane& lane = lanes[l];
+            stats_.visit();
+            int order = compareKey(keys[lane.index], lane.prefix, lane.node);
+            Node<Key, Value>* child = nullptr;
+            if (order < 0)
+                child = lane.node->getLeft();
+            else if (order > 0)
+                child = lane.node->getRight();
+
+            if (child != nullptr) {
+                AVLBST_PREFETCH(child);
+                AVLBST_PREFETCH(reinterpret_cast<const char*>(child) + sizeof(Node<Key, Value>) - 1);
+                lane.node = child;
+                ++l;
+                continue;
+            }
+
+            // done: found, or fell off the tree; the last lane fills the gap
+            if (order == 0) {
+                out[lane.index] = iterator(lane.node);
+                found++;
+            } else {
+                out[lane.index] = end();
+            }
+            lane = lanes[--lanesUsed];
+        }
+    }
+    return found;
+}
+
+#endif
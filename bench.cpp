@@ -0,0 +1,851 @@
+// Benchmark for AVLTree, with std::map as the baseline.
+//
+// Usage: avl_bench [--min-keys=N] [--max-keys=N] [--ops=N] [--seed=N] [--no-map] [--perf] [--policies]
+//                  [--cache=N] [--filter] [--hybrid]
+//
+// For every tree size from --min-keys to --max-keys (powers of ten, default
+// 1K to 1M; the full range goes up to 100M) it times
+//
+//   insert-seq    inserting keys 0..n-1 in order
+//   insert-rand   inserting n distinct keys in random order
+//   find-hit      looking up random keys that are present
+//   find-miss     looking up random keys that are absent
+//   find-batch    the find-hit keys again, through findBatch() 1024 at a time
+//   find-zipf     looking up keys drawn from a Zipf(0.99) distribution
+//   mixed-90/10   90% Zipfian finds, 10% writes (half inserts, half removes)
+//   mixed-50/50   50% Zipfian finds, 50% writes
+//   clear         tearing the whole tree down
+//
+// and reports the heap bytes per entry. With --perf it also reads the Linux
+// hardware counters (instructions, cache misses, branch mispredicts) around
+// each workload and reports them per operation. Built with -DAVLBST_STATS
+// (make avl_bench_stats) it prints AVLTree's operation counters for the
+// random-insert tree, and built with -DAVLBST_LATENCY (make
+// avl_bench_latency) also its find/insert/remove latency percentiles; see
+// stats_bst.h. With --policies it runs the same workloads on BalancedTree
+// under each balancing policy (balanced_bst.h) instead of std::map and
+// prints one column per policy. --cache=N turns on the trees' lookup cache
+// with N entries (lookup_cache_bst.h) and --filter their membership filter,
+// sized for n keys at 1% false positives (filter_bst.h). --hybrid puts
+// HybridAVLMap (hybrid_avlbst.h) in AVLTree's place. Everything is self-contained: the
+// key generators are below and the memory accounting replaces the global
+// operator new/delete.
+
+#include "avlbst.h"
+#include "balanced_bst.h"
+#include "hybrid_avlbst.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+typedef uint64_t BenchKey;
+typedef uint64_t BenchValue;
+
+/*
+  -------------------
+  Heap accounting.
+  -------------------
+*/
+
+// GCC sees the free() below pair up with operator new once both are inlined
+// and takes it for a mismatch; these replacements are the allocator.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static size_t liveBytes = 0;
+static size_t liveBlocks = 0;
+
+// glibc keeps one size word in front of every chunk
+#define MALLOC_CHUNK_OVERHEAD sizeof(size_t)
+
+static size_t blockSize(void* p, size_t requested) {
+#ifdef __GLIBC__
+    (void)requested;
+    return malloc_usable_size(p) + MALLOC_CHUNK_OVERHEAD;
+#else
+    (void)p;
+    return requested;
+#endif
+}
+
+void* operator new(size_t size) {
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    liveBytes += blockSize(p, size);
+    liveBlocks++;
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if (p == nullptr)
+        return;
+    liveBytes -= blockSize(p, 0);
+    liveBlocks--;
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+/*
+  -------------------
+  Key generators.
+  -------------------
+*/
+
+// splitmix64: a fast generator for the operation mix
+struct Rng {
+    uint64_t state;
+
+    explicit Rng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t below(uint64_t n) {
+        return next() % n;
+    }
+
+    double unit() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// A bijection on 64-bit integers, so scrambled(0..n-1) are n distinct
+// keys in random order and scrambled(n..) are guaranteed misses.
+static BenchKey scrambled(uint64_t i) {
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdull;
+    i ^= i >> 33;
+    i *= 0xc4ceb9fe1a85ec53ull;
+    i ^= i >> 33;
+    return i;
+}
+
+// Zipfian ranks in [0, n), as in YCSB (Gray et al., "Quickly generating
+// billion-record synthetic databases"). The rank is scrambled before use so
+// the hot keys are spread over the whole key space.
+struct Zipf {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+
+    Zipf(uint64_t n, double theta) : n(n), theta(theta) {
+        double zeta2 = zeta(2);
+        zetan = zeta(n);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        half_pow_theta = 1.0 + std::pow(0.5, theta);
+    }
+
+    // exact up to a million terms, Euler-Maclaurin beyond that
+    double zeta(uint64_t count) const {
+        const uint64_t exact = count < 1000000 ? count : 1000000;
+        double sum = 0;
+        for (uint64_t i = 1; i <= exact; ++i) {
+            sum += 1.0 / std::pow((double)i, theta);
+        }
+        if (count > exact) {
+            double a = (double)exact, b = (double)count;
+            sum += (std::pow(b, 1.0 - theta) - std::pow(a, 1.0 - theta)) / (1.0 - theta);
+            sum += (std::pow(b, -theta) - std::pow(a, -theta)) / 2.0;
+        }
+        return sum;
+    }
+
+    uint64_t next(Rng& rng) const {
+        double u = rng.unit();
+        double uz = u * zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < half_pow_theta)
+            return 1;
+        uint64_t rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+        return rank < n ? rank : n - 1;
+    }
+};
+
+/*
+  -------------------
+  Tree adapters.
+  -------------------
+*/
+
+#define FIND_BATCH_CHUNK 1024
+
+// All containers are driven through the same few calls so that every
+// workload below is written once. The trees in this repo share one adapter.
+template<typename Tree>
+struct TreeAdapter {
+    Tree tree;
+    void insert(BenchKey k, BenchValue v) {
+        tree.insert(std::make_pair(k, v));
+    }
+    void remove(BenchKey k) {
+        tree.remove(k);
+    }
+    bool find(BenchKey k, BenchValue& v) {
+        typename Tree::iterator it = tree.find(k);
+        if (it == tree.end())
+            return false;
+        v = it->second;
+        return true;
+    }
+    // the sum of the values found, count <= FIND_BATCH_CHUNK
+    uint64_t findBatch(const BenchKey* keys, size_t count) {
+        typename Tree::iterator out[FIND_BATCH_CHUNK];
+        tree.findBatch(keys, count, out);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (out[i] != tree.end())
+                sum += out[i]->second;
+        }
+        return sum;
+    }
+    void clear() {
+        tree.clear();
+    }
+    TreeStatsSnapshot stats() const {
+        return tree.stats();
+    }
+    LatencyHistogram latency(TreeOp op) const {
+        return tree.latency(op);
+    }
+    void setCache(size_t entries) {
+        tree.setLookupCacheSize(entries);
+    }
+    LookupCacheStats cacheStats() const {
+        return tree.lookupCacheStats();
+    }
+    void setFilter(size_t keys) {
+        tree.setMembershipFilter(keys);
+    }
+    MembershipFilterStats filterStats() const {
+        return tree.membershipFilterStats();
+    }
+};
+
+struct AVLAdapter : TreeAdapter<AVLTree<BenchKey, BenchValue>> {
+    static const char* name() {
+        return "AVLTree";
+    }
+};
+
+struct HybridAdapter : TreeAdapter<HybridAVLMap<BenchKey, BenchValue>> {
+    static const char* name() {
+        return "HybridAVLMap";
+    }
+};
+
+template<typename Policy>
+struct BalancedAdapter : TreeAdapter<BalancedTree<BenchKey, BenchValue, Policy>> {
+    static const char* name() {
+        return Policy::name();
+    }
+};
+
+struct MapAdapter {
+    static const char* name() {
+        return "std::map";
+    }
+    std::map<BenchKey, BenchValue> tree;
+    void insert(BenchKey k, BenchValue v) {
+        tree[k] = v;
+    }
+    void remove(BenchKey k) {
+        tree.erase(k);
+    }
+    bool find(BenchKey k, BenchValue& v) {
+        std::map<BenchKey, BenchValue>::iterator it = tree.find(k);
+        if (it == tree.end())
+            return false;
+        v = it->second;
+        return true;
+    }
+    uint64_t findBatch(const BenchKey* keys, size_t count) {
+        uint64_t sum = 0;
+        BenchValue v;
+        for (size_t i = 0; i < count; ++i) {
+            if (find(keys[i], v))
+                sum += v;
+        }
+        return sum;
+    }
+    void clear() {
+        tree.clear();
+    }
+    TreeStatsSnapshot stats() const {
+        return TreeStatsSnapshot();
+    }
+    LatencyHistogram latency(TreeOp) const {
+        return LatencyHistogram();
+    }
+    void setCache(size_t) {}
+    LookupCacheStats cacheStats() const {
+        return LookupCacheStats();
+    }
+    void setFilter(size_t) {}
+    MembershipFilterStats filterStats() const {
+        return MembershipFilterStats();
+    }
+};
+
+/*
+  -------------------
+  Hardware counters.
+  -------------------
+*/
+
+// instructions, cache misses and branch mispredicts per operation
+struct PerfSample {
+    double instructions;
+    double cacheMisses;
+    double branchMisses;
+};
+
+#define PERF_EVENT_COUNT 3
+
+// A perf_event_open group counting the events in PerfSample for this
+// thread, in user space only. Opening it fails on kernels without a PMU
+// (most VMs and containers) or when perf_event_paranoid forbids it, in
+// which case the benchmark runs without it.
+class PerfCounters {
+public:
+    PerfCounters() {
+        for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+            fds_[i] = -1;
+        }
+    }
+
+    ~PerfCounters() {
+        for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+            if (fds_[i] >= 0)
+                close(fds_[i]);
+        }
+    }
+
+#ifdef __linux__
+    bool open(std::string& error) {
+        static const uint64_t configs[PERF_EVENT_COUNT]
+                = {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            fds_[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0);
+            if (fds_[i] < 0) {
+                error = std::string("perf_event_open: ") + std::strerror(errno);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void start() {
+        ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    PerfSample stop(uint64_t ops) {
+        ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t values[1 + PERF_EVENT_COUNT] = {0};
+        if (read(fds_[0], values, sizeof(values)) != (ssize_t)sizeof(values))
+            std::memset(values, 0, sizeof(values));
+        double per = ops == 0 ? 1.0 : (double)ops;
+        PerfSample sample = {values[1] / per, values[2] / per, values[3] / per};
+        return sample;
+    }
+#else
+    bool open(std::string& error) {
+        error = "hardware counters need Linux perf_event_open";
+        return false;
+    }
+
+    void start() {}
+
+    PerfSample stop(uint64_t) {
+        PerfSample sample = {0, 0, 0};
+        return sample;
+    }
+#endif
+
+private:
+    int fds_[PERF_EVENT_COUNT];
+};
+
+/*
+  -------------------
+  Workloads.
+  -------------------
+*/
+
+struct Options {
+    uint64_t minKeys = 1000;
+    uint64_t maxKeys = 1000000;
+    uint64_t ops = 1000000;
+    uint64_t seed = 42;
+    bool withMap = true;
+    bool perf = false;
+    bool policies = false;
+    uint64_t cache = 0;
+    bool filter = false;
+    bool hybrid = false;
+};
+
+enum Workload {
+    INSERT_SEQ,
+    INSERT_RAND,
+    FIND_HIT,
+    FIND_MISS,
+    FIND_BATCH,
+    FIND_ZIPF,
+    MIXED_90,
+    MIXED_50,
+    CLEAR,
+    WORKLOAD_COUNT
+};
+
+static const char* const workloadNames[WORKLOAD_COUNT]
+        = {"insert-seq",
+           "insert-rand",
+           "find-hit",
+           "find-miss",
+           "find-batch",
+           "find-zipf",
+           "mixed-90/10",
+           "mixed-50/50",
+           "clear"};
+
+struct Result {
+    double ns[WORKLOAD_COUNT];
+    PerfSample perf[WORKLOAD_COUNT];
+    double bytesPerEntry;
+    TreeStatsSnapshot stats;
+    LatencyHistogram latency[TREE_OP_COUNT];
+    LookupCacheStats cache;
+    MembershipFilterStats filter;
+};
+
+// keeps lookups from being optimized away
+static volatile uint64_t benchSink;
+
+// the tree compared against std::map, for the report
+static const char* treeName = AVLAdapter::name();
+
+typedef std::chrono::steady_clock Clock;
+
+// Times one workload, and reads the hardware counters around it if they
+// are open, storing both per operation in a Result.
+class Meter {
+public:
+    explicit Meter(PerfCounters* perf) : perf_(perf) {}
+
+    void start() {
+        if (perf_ != nullptr)
+            perf_->start();
+        start_ = Clock::now();
+    }
+
+    void stop(Result& r, Workload w, uint64_t ops) {
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start_).count();
+        r.ns[w] = ns / (ops == 0 ? 1 : ops);
+        if (perf_ != nullptr)
+            r.perf[w] = perf_->stop(ops);
+    }
+
+private:
+    PerfCounters* perf_;
+    Clock::time_point start_;
+};
+
+template<typename Tree>
+void runFinds(Tree& t, const std::vector<BenchKey>& keys, Meter& meter, Result& r, Workload w) {
+    uint64_t found = 0;
+    BenchValue v;
+    meter.start();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (t.find(keys[i], v))
+            found += v;
+    }
+    meter.stop(r, w, keys.size());
+    benchSink = found;
+}
+
+template<typename Tree>
+void runBatchFinds(Tree& t, const std::vector<BenchKey>& keys, Meter& meter, Result& r, Workload w) {
+    uint64_t found = 0;
+    meter.start();
+    for (size_t i = 0; i < keys.size(); i += FIND_BATCH_CHUNK) {
+        size_t count = keys.size() - i < FIND_BATCH_CHUNK ? keys.size() - i : FIND_BATCH_CHUNK;
+        found += t.findBatch(&keys[i], count);
+    }
+    meter.stop(r, w, keys.size());
+    benchSink = found;
+}
+
+// Zipfian reads mixed with writes: every write either inserts a fresh key or
+// removes one of the original keys, alternating, so the size stays about n.
+template<typename Tree>
+void runMixed(Tree& t,
+              uint64_t n,
+              uint64_t ops,
+              unsigned writePercent,
+              const Zipf& zipf,
+              uint64_t seed,
+              Meter& meter,
+              Result& r,
+              Workload w) {
+    Rng rng(seed);
+    std::vector<uint32_t> kinds(ops);
+    std::vector<BenchKey> keys(ops);
+    uint64_t fresh = n;
+    bool insertNext = true;
+    for (uint64_t i = 0; i < ops; ++i) {
+        if (rng.below(100) < writePercent) {
+            kinds[i] = insertNext ? 1 : 2;
+            keys[i] = insertNext ? scrambled(fresh++) : scrambled(rng.below(n));
+            insertNext = !insertNext;
+        } else {
+            kinds[i] = 0;
+            keys[i] = scrambled(zipf.next(rng));
+        }
+    }
+
+    uint64_t found = 0;
+    BenchValue v;
+    meter.start();
+    for (uint64_t i = 0; i < ops; ++i) {
+        if (kinds[i] == 0) {
+            if (t.find(keys[i], v))
+                found += v;
+        } else if (kinds[i] == 1) {
+            t.insert(keys[i], i);
+        } else {
+            t.remove(keys[i]);
+        }
+    }
+    meter.stop(r, w, ops);
+    benchSink = found;
+}
+
+template<typename Tree>
+Result runAll(uint64_t n, const Options& opt, PerfCounters* perf) {
+    Result r = Result();
+    Meter meter(perf);
+    Rng rng(opt.seed);
+    Zipf zipf(n, 0.99);
+
+    {
+        Tree t;
+        t.setCache(opt.cache);
+        t.setFilter(opt.filter ? n : 0);
+        meter.start();
+        for (uint64_t i = 0; i < n; ++i) {
+            t.insert(i, i);
+        }
+        meter.stop(r, INSERT_SEQ, n);
+    }
+
+    Tree t;
+    t.setCache(opt.cache);
+    t.setFilter(opt.filter ? n : 0);
+    size_t bytesBefore = liveBytes;
+    meter.start();
+    for (uint64_t i = 0; i < n; ++i) {
+        t.insert(scrambled(i), i);
+    }
+    meter.stop(r, INSERT_RAND, n);
+    r.bytesPerEntry = (double)(liveBytes - bytesBefore) / n;
+
+    std::vector<BenchKey> keys(opt.ops);
+    for (uint64_t i = 0; i < opt.ops; ++i) {
+        keys[i] = scrambled(rng.below(n));
+    }
+    runFinds(t, keys, meter, r, FIND_HIT);
+    runBatchFinds(t, keys, meter, r, FIND_BATCH);
+
+    for (uint64_t i = 0; i < opt.ops; ++i) {
+        keys[i] = scrambled(n + rng.below(n));
+    }
+    runFinds(t, keys, meter, r, FIND_MISS);
+
+    for (uint64_t i = 0; i < opt.ops; ++i) {
+        keys[i] = scrambled(zipf.next(rng));
+    }
+    runFinds(t, keys, meter, r, FIND_ZIPF);
+    std::vector<BenchKey>().swap(keys);
+
+    runMixed(t, n, opt.ops, 10, zipf, opt.seed + 1, meter, r, MIXED_90);
+    runMixed(t, n, opt.ops, 50, zipf, opt.seed + 2, meter, r, MIXED_50);
+
+    meter.start();
+    t.clear();
+    meter.stop(r, CLEAR, n);
+    r.stats = t.stats();
+    r.cache = t.cacheStats();
+    r.filter = t.filterStats();
+    for (int op = 0; op < TREE_OP_COUNT; ++op) {
+        r.latency[op] = t.latency((TreeOp)op);
+    }
+    return r;
+}
+
+static void printRow(const char* workload, double avl, double map, bool withMap, const char* unit) {
+    if (withMap)
+        std::printf("  %-14s %12.1f %12.1f %9.2fx  %s\n", workload, avl, map, avl / map, unit);
+    else
+        std::printf("  %-14s %12.1f %12s %10s  %s\n", workload, avl, "-", "-", unit);
+}
+
+static void printPerf(const Result& avl, const Result& map, bool withMap) {
+    std::printf("  %-14s %30s", "per op", treeName);
+    if (withMap)
+        std::printf(" %30s", MapAdapter::name());
+    std::printf("\n  %-14s %10s %9s %9s", "", "instr", "cache-mis", "br-mis");
+    if (withMap)
+        std::printf(" %10s %9s %9s", "instr", "cache-mis", "br-mis");
+    std::printf("\n");
+    for (int w = 0; w < WORKLOAD_COUNT; ++w) {
+        std::printf("  %-14s %10.1f %9.2f %9.2f",
+                    workloadNames[w],
+                    avl.perf[w].instructions,
+                    avl.perf[w].cacheMisses,
+                    avl.perf[w].branchMisses);
+        if (withMap)
+            std::printf(" %10.1f %9.2f %9.2f",
+                        map.perf[w].instructions,
+                        map.perf[w].cacheMisses,
+                        map.perf[w].branchMisses);
+        std::printf("\n");
+    }
+}
+
+#ifdef AVLBST_STATS
+static double ratio(uint64_t a, uint64_t b) {
+    return b == 0 ? 0.0 : (double)a / b;
+}
+
+static void printStats(const TreeStatsSnapshot& s) {
+    std::printf("  %s counters (random-insert tree, all workloads):\n", treeName);
+    std::printf("    finds/inserts/removes  %llu/%llu/%llu\n",
+                (unsigned long long)s.finds,
+                (unsigned long long)s.inserts,
+                (unsigned long long)s.removes);
+    std::printf("    comparisons/op         %.2f\n", ratio(s.comparisons, s.operations()));
+    std::printf("    nodes visited/op       %.2f\n", ratio(s.nodesVisited, s.operations()));
+    std::printf("    rotations/write        %.3f (%llu left, %llu right)\n",
+                ratio(s.leftRotations + s.rightRotations, s.inserts + s.removes),
+                (unsigned long long)s.leftRotations,
+                (unsigned long long)s.rightRotations);
+    std::printf("    allocations/frees      %llu/%llu\n",
+                (unsigned long long)s.allocations,
+                (unsigned long long)s.frees);
+    std::printf("    retrace length         %.2f mean, %llu max\n",
+                ratio(s.retraceSteps, s.retraces),
+                (unsigned long long)s.maxRetrace);
+}
+#endif
+
+static void printCache(const LookupCacheStats& c) {
+    std::printf("  %s lookup cache (random-insert tree, all workloads): %zu entries, %.1f%% hit rate, "
+                "%llu invalidations\n",
+                treeName,
+                c.entries,
+                100.0 * c.hitRate(),
+                (unsigned long long)c.invalidations);
+}
+
+static void printFilter(const MembershipFilterStats& f) {
+    std::printf("  %s membership filter (random-insert tree, all workloads): %zu counters, %d hashes, "
+                "%.1f%% of finds ruled out, %.2f%% false positives\n",
+                treeName,
+                f.counters,
+                f.hashes,
+                f.queries == 0 ? 0.0 : 100.0 * f.negatives / f.queries,
+                100.0 * f.falsePositiveRate());
+}
+
+#define POLICY_COLUMNS 6
+
+// One column per tree: AVLTree itself, then BalancedTree under each policy.
+static void printPolicies(const Result results[POLICY_COLUMNS], const char* const names[POLICY_COLUMNS]) {
+    std::printf("  %-14s", "workload");
+    for (int c = 0; c < POLICY_COLUMNS; ++c) {
+        std::printf(" %10s", names[c]);
+    }
+    std::printf("\n");
+    for (int w = 0; w <= WORKLOAD_COUNT; ++w) {
+        std::printf("  %-14s", w == WORKLOAD_COUNT ? "memory" : workloadNames[w]);
+        for (int c = 0; c < POLICY_COLUMNS; ++c) {
+            std::printf(" %10.1f", w == WORKLOAD_COUNT ? results[c].bytesPerEntry : results[c].ns[w]);
+        }
+        std::printf("  %s\n", w == WORKLOAD_COUNT ? "bytes/entry" : w == CLEAR ? "ns/entry" : "ns/op");
+    }
+#ifdef AVLBST_STATS
+    std::printf("  %-14s", "rotations");
+    for (int c = 0; c < POLICY_COLUMNS; ++c) {
+        const TreeStatsSnapshot& s = results[c].stats;
+        std::printf(" %10.3f", ratio(s.leftRotations + s.rightRotations, s.inserts + s.removes));
+    }
+    std::printf("  per write\n  %-14s", "nodes visited");
+    for (int c = 0; c < POLICY_COLUMNS; ++c) {
+        const TreeStatsSnapshot& s = results[c].stats;
+        std::printf(" %10.2f", ratio(s.nodesVisited, s.operations()));
+    }
+    std::printf("  per op\n");
+#endif
+}
+
+#ifdef AVLBST_LATENCY
+static void printLatency(const LatencyHistogram latency[TREE_OP_COUNT]) {
+    static const char* const opNames[TREE_OP_COUNT] = {"find", "insert", "remove"};
+    std::printf("  %s latency, ns (random-insert tree, all workloads):\n", treeName);
+    std::printf("    %-8s %10s %8s %8s %8s %8s %8s %10s\n", "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int op = 0; op < TREE_OP_COUNT; ++op) {
+        const LatencyHistogram& h = latency[op];
+        std::printf("    %-8s %10llu %8.1f %8llu %8llu %8llu %8llu %10llu\n",
+                    opNames[op],
+                    (unsigned long long)h.count(),
+                    h.mean(),
+                    (unsigned long long)h.percentile(50),
+                    (unsigned long long)h.percentile(90),
+                    (unsigned long long)h.percentile(99),
+                    (unsigned long long)h.percentile(99.9),
+                    (unsigned long long)h.max());
+    }
+}
+#endif
+
+static bool parseFlag(const char* arg, const char* name, uint64_t& out) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    out = std::strtoull(arg + len + 1, nullptr, 10);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--no-map") == 0) {
+            opt.withMap = false;
+        } else if (std::strcmp(argv[i], "--perf") == 0) {
+            opt.perf = true;
+        } else if (std::strcmp(argv[i], "--policies") == 0) {
+            opt.policies = true;
+        } else if (std::strcmp(argv[i], "--filter") == 0) {
+            opt.filter = true;
+        } else if (std::strcmp(argv[i], "--hybrid") == 0) {
+            opt.hybrid = true;
+            treeName = HybridAdapter::name();
+        } else if (!parseFlag(argv[i], "--min-keys", opt.minKeys) && !parseFlag(argv[i], "--max-keys", opt.maxKeys)
+                   && !parseFlag(argv[i], "--ops", opt.ops) && !parseFlag(argv[i], "--seed", opt.seed)
+                   && !parseFlag(argv[i], "--cache", opt.cache)) {
+            std::fprintf(stderr,
+                         "usage: %s [--min-keys=N] [--max-keys=N] [--ops=N] [--seed=N] [--no-map] [--perf] "
+                         "[--policies] [--cache=N] [--filter] [--hybrid]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    PerfCounters counters;
+    PerfCounters* perf = nullptr;
+    if (opt.perf) {
+        std::string error;
+        if (counters.open(error))
+            perf = &counters;
+        else
+            std::fprintf(stderr, "hardware counters unavailable (%s), continuing without them\n", error.c_str());
+    }
+
+    std::printf("key/value: %zu/%zu bytes, %llu ops per lookup/mixed workload, seed %llu\n",
+                sizeof(BenchKey),
+                sizeof(BenchValue),
+                (unsigned long long)opt.ops,
+                (unsigned long long)opt.seed);
+
+    for (uint64_t n = opt.minKeys; n <= opt.maxKeys && opt.policies; n *= 10) {
+        static const char* const names[POLICY_COLUMNS] = {AVLAdapter::name(),
+                                                          BalancedAdapter<AVLBalance>::name(),
+                                                          BalancedAdapter<RedBlackBalance>::name(),
+                                                          BalancedAdapter<WAVLBalance>::name(),
+                                                          BalancedAdapter<TreapBalance>::name(),
+                                                          BalancedAdapter<SplayBalance>::name()};
+        Result results[POLICY_COLUMNS];
+        results[0] = runAll<AVLAdapter>(n, opt, nullptr);
+        results[1] = runAll<BalancedAdapter<AVLBalance>>(n, opt, nullptr);
+        results[2] = runAll<BalancedAdapter<RedBlackBalance>>(n, opt, nullptr);
+        results[3] = runAll<BalancedAdapter<WAVLBalance>>(n, opt, nullptr);
+        results[4] = runAll<BalancedAdapter<TreapBalance>>(n, opt, nullptr);
+        results[5] = runAll<BalancedAdapter<SplayBalance>>(n, opt, nullptr);
+
+        std::printf("\nn = %llu\n", (unsigned long long)n);
+        printPolicies(results, names);
+        std::fflush(stdout);
+    }
+
+    for (uint64_t n = opt.minKeys; n <= opt.maxKeys && !opt.policies; n *= 10) {
+        Result avl = opt.hybrid ? runAll<HybridAdapter>(n, opt, perf) : runAll<AVLAdapter>(n, opt, perf);
+        Result map = avl;
+        if (opt.withMap)
+            map = runAll<MapAdapter>(n, opt, perf);
+
+        std::printf("\nn = %llu\n", (unsigned long long)n);
+        std::printf("  %-14s %12s %12s %10s\n", "workload", treeName, MapAdapter::name(), "ratio");
+        for (int w = 0; w < WORKLOAD_COUNT; ++w) {
+            printRow(workloadNames[w], avl.ns[w], map.ns[w], opt.withMap, w == CLEAR ? "ns/entry" : "ns/op");
+        }
+        printRow("memory", avl.bytesPerEntry, map.bytesPerEntry, opt.withMap, "bytes/entry");
+        if (opt.cache != 0)
+            printCache(avl.cache);
+        if (opt.filter)
+            printFilter(avl.filter);
+        if (perf != nullptr)
+            printPerf(avl, map, opt.withMap);
+#ifdef AVLBST_STATS
+        printStats(avl.stats);
+#endif
+#ifdef AVLBST_LATENCY
+        printLatency(avl.latency);
+#endif
+        std::fflush(stdout);
+    }
+    return 0;
+}
@@ -1,26 +1,61 @@
 #ifndef BST_H
 #define BST_H
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <sstream>
+#include <string>
 #include <utility>
+#include <vector>
+
+/**
+ * Runs a std::hash value through the splitmix64 finalizer, so that every
+ * bit of the result depends on every bit of the key's hash. std::hash is
+ * the identity for integers, and the hash index (hybrid_avlbst.h) and the
+ * membership filter (filter_bst.h) take their slots from separate bits.
+ * Defined ahead of the satellite headers, which use it.
+ */
+inline uint64_t mixHash(uint64_t h) {
+    uint64_t z = h + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+#include "filter_bst.h"
+#include "key_prefix_bst.h"
+#include "lookup_cache_bst.h"
+#include "node_item_bst.h"
+#include "slab_bst.h"
+#include "stats_bst.h"
+
+struct TreeSummary;
+struct MemoryUsage;
+class WorkStealingPool;
 
 /**
  * A templated class for a Node in a search tree.
  * The getters for parent/left/right are virtual so
  * that they can be overridden for future kinds of
  * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * and AVL trees. String keys also keep an inline
+ * prefix of the key, see key_prefix_bst.h, and sets
+ * store the key alone, see node_item_bst.h.
  */
 template<typename Key, typename Value>
-class Node {
+class Node : public KeyPrefixHolder<Key> {
 public:
+    typedef typename NodeItem<Key, Value>::Type Item;
+
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
+    Node(Node<Key, Value>&& other);
     virtual ~Node();
 
-    const std::pair<const Key, Value>& getItem() const;
-    std::pair<const Key, Value>& getItem();
+    const Item& getItem() const;
+    Item& getItem();
     const Key& getKey() const;
     const Value& getValue() const;
     Value& getValue();
@@ -35,10 +70,10 @@ public:
     void setValue(const Value& value);
 
 protected:
-    std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+    Item item_;  // last, so that subclass fields can share its tail padding
 };
 
 /*
@@ -52,7 +87,19 @@ protected:
  */
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent)
-        : item_(key, value), parent_(parent), left_(NULL), right_(NULL) {}
+        : KeyPrefixHolder<Key>(key), parent_(parent), left_(NULL), right_(NULL), item_(key, value) {}
+
+/**
+ * Moves a node to a new address, links and all; the key is copied, since
+ * it is const, and the value moved. Used by relayout().
+ */
+template<typename Key, typename Value>
+Node<Key, Value>::Node(Node<Key, Value>&& other)
+        : KeyPrefixHolder<Key>(other),
+          parent_(other.parent_),
+          left_(other.left_),
+          right_(other.right_),
+          item_(std::move(other.item_)) {}
 
 /**
  * Destructor, which does not need to do anything since the pointers inside of a node
@@ -66,7 +113,7 @@ Node<Key, Value>::~Node() {}
  * A const getter for the item.
  */
 template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const {
+const typename Node<Key, Value>::Item& Node<Key, Value>::getItem() const {
     return item_;
 }
 
@@ -74,7 +121,7 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const {
  * A non-const getter for the item.
  */
 template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem() {
+typename Node<Key, Value>::Item& Node<Key, Value>::getItem() {
     return item_;
 }
 
@@ -175,9 +222,50 @@ public:
     virtual void insert(const std::pair<const Key, Value>& keyValuePair);  // TODO
     virtual void remove(const Key& key);                                   // TODO
     void clear();                                                          // TODO
+    void clearInBackground();
+    void setBackgroundTeardown(bool enabled);
     bool isBalanced() const;                                               // TODO
+    bool validate() const;
+    bool validate(std::string& violation) const;
     void print() const;
     bool empty() const;
+    size_t size() const;
+    MemoryUsage memoryUsage() const;
+
+    // Streaming exports and shape summary, see export_bst.h
+    void exportDot(std::ostream& out, int maxDepth = -1) const;
+    void exportDot(std::ostream& out, const Key& low, const Key& high, int maxDepth = -1) const;
+    void exportJson(std::ostream& out, int maxDepth = -1) const;
+    void exportJson(std::ostream& out, const Key& low, const Key& high, int maxDepth = -1) const;
+    TreeSummary summarize() const;
+
+    // Operation counters and latencies; empty unless built with AVLBST_STATS
+    // or AVLBST_LATENCY, see stats_bst.h
+    TreeStatsSnapshot stats() const;
+    LatencyHistogram latency(TreeOp op) const;
+    void resetStats();
+
+    // Optional hot-key cache in front of find(), see lookup_cache_bst.h
+    void setLookupCacheSize(size_t entries);
+    LookupCacheStats lookupCacheStats() const;
+
+    // Optional counting Bloom filter in front of find(), see filter_bst.h
+    void setMembershipFilter(size_t expectedKeys, double falsePositiveRate = 0.01);
+    MembershipFilterStats membershipFilterStats() const;
+
+    // Multithreaded traversal on a work-stealing pool, see parallel_bst.h
+    template<typename Function>
+    void parallelForEach(Function fn) const;
+    template<typename Function>
+    void parallelForEach(Function fn, WorkStealingPool& pool) const;
+    template<typename T, typename Map, typename Combine>
+    T parallelReduce(T init, Map map, Combine combine) const;
+    template<typename T, typename Map, typename Combine>
+    T parallelReduce(T init, Map map, Combine combine, WorkStealingPool& pool) const;
+
+    // In-place Day-Stout-Warren rebalancing, see rebalance_bst.h
+    virtual void rebalance();
+    void setAutoRebalance(double factor);
 
 public:
     /**
@@ -188,8 +276,8 @@ public:
     public:
         iterator();
 
-        std::pair<const Key, Value>& operator*() const;
-        std::pair<const Key, Value>* operator->() const;
+        typename Node<Key, Value>::Item& operator*() const;
+        typename Node<Key, Value>::Item* operator->() const;
 
         bool operator==(const iterator& rhs) const;
         bool operator!=(const iterator& rhs) const;
@@ -206,6 +294,7 @@ public:
     iterator begin() const;
     iterator end() const;
     iterator find(const Key& key) const;
+    size_t findBatch(const Key* keys, size_t count, iterator* out) const;
 
 protected:
     // Mandatory helper functions
@@ -222,13 +311,42 @@ protected:
     // Add helper functions here
     Node<Key, Value>* addKeyValue(const std::pair<const Key, Value>* item);
     Node<Key, Value>* deleteNode(Node<Key, Value>* item);
-    bool compareHeights(Node<Key, Value>* n1, Node<Key, Value>* n2) const;
-    int getHeight(Node<Key, Value>* n) const;
-    void postOrderRemove(Node<Key, Value>* node);
-    Node<Key, Value>* doComparison(Node<Key, Value>* node);
+    void destroySubtree(Node<Key, Value>* node);
+    static void freeSubtree(void* detached);
+    bool walkTree(bool structure, bool balance, std::string* violation) const;
+    void reportViolation(const Node<Key, Value>* node, const char* problem, std::string* violation) const;
+    virtual bool validateNode(const Node<Key, Value>* node, int left_height, int right_height, std::string* violation)
+            const;
+    void exportTree(std::ostream& out, bool json, const Key* low, const Key* high, int maxDepth) const;
+    virtual size_t nodeSize() const;
+    virtual size_t objectSize() const;
+    bool keyLess(const Key& a, const Key& b) const;
+    int compareKey(const Key& key, const typename KeyPrefix<Key>::Type& prefix, const Node<Key, Value>* node) const;
+    Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    void adoptNode(Node<Key, Value>* node);
+    void destroyNode(Node<Key, Value>* node);
+    virtual void nodeCreated(Node<Key, Value>* node);
+    virtual void nodeDestroyed(Node<Key, Value>* node);
+    virtual void nodesReleased();
+    iterator iteratorAt(Node<Key, Value>* node) const;
+    void splitWork(const WorkStealingPool& pool, std::vector<std::pair<Node<Key, Value>*, bool>>& parts) const;
+    template<typename Function>
+    static void forEachInSubtree(Node<Key, Value>* node, Function& fn);
+    void rebuildSubtree(Node<Key, Value>* node);
+    void rebalanceAfterInsert(Node<Key, Value>* node);
+    size_t treeToVine(Node<Key, Value>*& top);
+    void compressVine(Node<Key, Value>*& top, size_t count);
+    static size_t subtreeSize(const Node<Key, Value>* node);
 
 protected:
     Node<Key, Value>* root_;
+    size_t size_;  // maintained by createNode()/destroyNode()
+    mutable TreeStats stats_;
+    mutable LookupCache<Key, Value> cache_;
+    mutable MembershipFilter<Key> filter_;
+    bool backgroundTeardown_;
+    double autoRebalance_;  // 0 when off
+    NodeSlabs slabs_;       // blocks of nodes placed by relayout()
     // You should not need other data members
 };
 
@@ -260,7 +378,7 @@ BinarySearchTree<Key, Value>::iterator::iterator() {
  * Provides access to the item.
  */
 template<class Key, class Value>
-std::pair<const Key, Value>& BinarySearchTree<Key, Value>::iterator::operator*() const {
+typename Node<Key, Value>::Item& BinarySearchTree<Key, Value>::iterator::operator*() const {
     return current_->getItem();
 }
 
@@ -268,7 +386,7 @@ std::pair<const Key, Value>& BinarySearchTree<Key, Value>::iterator::operator*()
  * Provides access to the address of the item.
  */
 template<class Key, class Value>
-std::pair<const Key, Value>* BinarySearchTree<Key, Value>::iterator::operator->() const {
+typename Node<Key, Value>::Item* BinarySearchTree<Key, Value>::iterator::operator->() const {
     return &(current_->getItem());
 }
 
@@ -354,6 +472,9 @@ template<class Key, class Value>
 BinarySearchTree<Key, Value>::BinarySearchTree() {
     // TODO
     root_ = nullptr;
+    size_ = 0;
+    backgroundTeardown_ = false;
+    autoRebalance_ = 0;
 }
 
 template<typename Key, typename Value>
@@ -376,6 +497,73 @@ void BinarySearchTree<Key, Value>::print() const {
     std::cout << "\n";
 }
 
+/**
+ * Returns a copy of the operation counters collected so far.
+ */
+template<typename Key, typename Value>
+TreeStatsSnapshot BinarySearchTree<Key, Value>::stats() const {
+    return stats_.snapshot();
+}
+
+/**
+ * Returns a copy of the latency histogram for one kind of operation.
+ */
+template<typename Key, typename Value>
+LatencyHistogram BinarySearchTree<Key, Value>::latency(TreeOp op) const {
+    return stats_.latency(op);
+}
+
+/**
+ * Zeroes the operation counters and latency histograms.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::resetStats() {
+    stats_.reset();
+    cache_.resetStats();
+    filter_.resetStats();
+}
+
+/**
+ * Sizes the lookup cache to hold about entries nodes, emptying it; 0 turns
+ * it off. Throws std::invalid_argument if Key has no std::hash.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setLookupCacheSize(size_t entries) {
+    cache_.resize(entries);
+}
+
+/**
+ * Returns the lookup cache's capacity and hit/miss counters.
+ */
+template<typename Key, typename Value>
+LookupCacheStats BinarySearchTree<Key, Value>::lookupCacheStats() const {
+    return cache_.stats();
+}
+
+/**
+ * Sizes the membership filter for expectedKeys keys at the given false
+ * positive rate and adds the keys already in the tree, in O(n); 0 keys
+ * turns it off. Throws std::invalid_argument if Key has no std::hash or the
+ * rate is not between 0 and 1.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setMembershipFilter(size_t expectedKeys, double falsePositiveRate) {
+    filter_.resize(expectedKeys, falsePositiveRate);
+    if (!filter_.enabled())
+        return;
+    for (iterator it = begin(); it != end(); ++it) {
+        filter_.add(it->first);
+    }
+}
+
+/**
+ * Returns the membership filter's size and how often it answered alone.
+ */
+template<typename Key, typename Value>
+MembershipFilterStats BinarySearchTree<Key, Value>::membershipFilterStats() const {
+    return filter_.stats();
+}
+
 /**
  * Returns an iterator to the "smallest" item in the tree
  */
@@ -400,7 +588,22 @@ typename BinarySearchTree<Key, Value>::iterator BinarySearchTree<Key, Value>::en
  */
 template<class Key, class Value>
 typename BinarySearchTree<Key, Value>::iterator BinarySearchTree<Key, Value>::find(const Key& k) const {
-    Node<Key, Value>* curr = internalFind(k);
+    TreeOpScope<TreeStats> scope(stats_, TREE_OP_FIND);
+    if (filter_.enabled() && !filter_.mayContain(k))
+        return end();
+    Node<Key, Value>* curr;
+    if (cache_.enabled()) {
+        curr = cache_.lookup(k);
+        if (curr == nullptr) {
+            curr = internalFind(k);
+            if (curr != nullptr)
+                cache_.fill(curr);
+        }
+    } else {
+        curr = internalFind(k);
+    }
+    if (curr == nullptr && filter_.enabled())
+        filter_.falsePositive();
     BinarySearchTree<Key, Value>::iterator it(curr);
     return it;
 }
@@ -412,13 +615,16 @@ typename BinarySearchTree<Key, Value>::iterator BinarySearchTree<Key, Value>::fi
 template<class Key, class Value>
 void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair) {
     // TODO
+    TreeOpScope<TreeStats> scope(stats_, TREE_OP_INSERT);
     Node<Key, Value>* temp = internalFind(keyValuePair.first);  // check if the node in the tree
     if (temp != nullptr) {
         temp->getItem().second = keyValuePair.second;  // replace the value
         return;
     }
 
-    Node<Key, Value>* new_node = addKeyValue(&keyValuePair);
+    Node<Key, Value>* node = addKeyValue(&keyValuePair);
+    if (autoRebalance_ > 0)
+        rebalanceAfterInsert(node);
 }
 
 template<class Key, class Value>
@@ -428,17 +634,18 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::addKeyValue(const std::pair<cons
         return nullptr;
     }
     if (empty()) {
-        root_ = new Node<Key, Value>(item->first, item->second, nullptr);
+        root_ = createNode(item->first, item->second, nullptr);
         return root_;
     }
 
     Node<Key, Value>* curr = root_;  // start from the root
 
     while (1) {
+        stats_.visit();
         // if the item's key > the current node's key, move to the right
-        if (item->first > curr->getItem().first) {
+        if (keyLess(curr->getKey(), item->first)) {
             if (curr->getRight() == nullptr) {
-                curr->setRight(new Node<Key, Value>(item->first, item->second, curr));
+                curr->setRight(createNode(item->first, item->second, curr));
                 return curr->getRight();
             }
             curr = curr->getRight();  // advance to the right child
@@ -446,7 +653,7 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::addKeyValue(const std::pair<cons
         // if the item's key < the current node's key, move to the left
         else {
             if (curr->getLeft() == nullptr) {
-                curr->setLeft(new Node<Key, Value>(item->first, item->second, curr));
+                curr->setLeft(createNode(item->first, item->second, curr));
                 return curr->getLeft();
             }
             curr = curr->getLeft();  // advance to the left child
@@ -461,25 +668,35 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::addKeyValue(const std::pair<cons
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::remove(const Key& key) {
     // TODO
+    TreeOpScope<TreeStats> scope(stats_, TREE_OP_REMOVE);
     Node<Key, Value>* temp = internalFind(key);  // check if the node in the tree
     // if not in the tree
     if (temp == nullptr)
         return;
-    else if (temp->getRight() == nullptr && temp->getLeft() == nullptr && temp->getParent() == nullptr) {
+
+    // if 2 children, swap with the predecessor so that temp has at most one child
+    if (temp->getRight() != nullptr && temp->getLeft() != nullptr) {
+        Node<Key, Value>* pred = predecessor(temp);
+        nodeSwap(temp, pred);
+    }
+
+    if (temp->getRight() == nullptr && temp->getLeft() == nullptr && temp->getParent() == nullptr) {
         root_ = nullptr;
-        delete temp;
+        destroyNode(temp);
         return;
     }
     // if root with only right child
     else if (temp->getRight() != nullptr && temp->getLeft() == nullptr && temp->getParent() == nullptr) {
         root_ = temp->getRight();
-        delete temp;
+        root_->setParent(nullptr);
+        destroyNode(temp);
         return;
     }
     // if root with only left child
     else if (temp->getRight() == nullptr && temp->getLeft() != nullptr && temp->getParent() == nullptr) {
         root_ = temp->getLeft();
-        delete temp;
+        root_->setParent(nullptr);
+        destroyNode(temp);
         return;
     }
     // if leaf node
@@ -489,7 +706,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
         } else {
             temp->getParent()->setLeft(nullptr);
         }
-        delete temp;
+        destroyNode(temp);
         return;
     }
     // if has 1 left child
@@ -500,7 +717,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
             temp->getParent()->setLeft(temp->getLeft());
         }
         temp->getLeft()->setParent(temp->getParent());
-        delete temp;
+        destroyNode(temp);
         return;
     }
     // if has 1 right child
@@ -511,24 +728,16 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
             temp->getParent()->setLeft(temp->getRight());
         }
         temp->getRight()->setParent(temp->getParent());
-        delete temp;
+        destroyNode(temp);
         // this->print();
         return;
     }
-    // if 2 children
-    else {
-        Node<Key, Value>* pred = predecessor(temp);
-        // this->print();
-        nodeSwap(temp, pred);
-    }
-    // this->print();
-    remove(temp->getKey());  // recursive call
 }
 
 template<typename Key, typename Value>
 Node<Key, Value>* BinarySearchTree<Key, Value>::deleteNode(Node<Key, Value>* item) {
     Node<Key, Value>* parent = item->getParent();
-    delete item;
+    destroyNode(item);
     return parent;
 }
 
@@ -549,19 +758,44 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* cu
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clear() {
     // TODO
-    // post order traversal
-    postOrderRemove(root_);
+    if (backgroundTeardown_) {
+        clearInBackground();
+        return;
+    }
+    // with the membership filter set aside and then zeroed rather than
+    // decremented once per node
+    MembershipFilter<Key> filter;
+    std::swap(filter, filter_);
+    destroySubtree(root_);
+    std::swap(filter, filter_);
+    filter_.clear();
 }
 
+/**
+ * Frees every node below and including node in O(1) extra space, however
+ * deep the tree: while the current node has a left child it is rotated
+ * right, so the left child comes up, and a node without one is freed and
+ * replaced by its right child. Parent links would point at freed nodes, so
+ * each node is unlinked from its parent before the hooks see it.
+ */
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::postOrderRemove(Node<Key, Value>* node) {
-    if (node == nullptr)
-        return;
-    postOrderRemove(node->getLeft());
-    postOrderRemove(node->getRight());
-    if(node == root_)
+void BinarySearchTree<Key, Value>::destroySubtree(Node<Key, Value>* node) {
+    if (node == root_)
         root_ = nullptr;
-    delete node;
+
+    while (node != nullptr) {
+        Node<Key, Value>* left = node->getLeft();
+        if (left != nullptr) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        } else {
+            Node<Key, Value>* right = node->getRight();
+            node->setParent(nullptr);
+            destroyNode(node);
+            node = right;
+        }
+    }
 }
 
 /**
@@ -591,66 +825,253 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::getSmallestNode() const {
 template<typename Key, typename Value>
 Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const {
     // TODO
-    for (typename BinarySearchTree<Key, Value>::iterator it = this->begin(); it != this->end(); ++it) {
-        if (it->first == key)
-            return it.current_;
+    Node<Key, Value>* curr = root_;  // start from the root
+    const typename KeyPrefix<Key>::Type prefix = KeyPrefix<Key>::of(key);
+
+    while (curr != nullptr) {
+        stats_.visit();
+        int order = compareKey(key, prefix, curr);
+        if (order < 0) {
+            curr = curr->getLeft();  // advance to the left
+        } else if (order > 0) {
+            curr = curr->getRight();  // advance to the right
+        } else {
+            return curr;
+        }
     }
 
     return nullptr;
 }
 
 /**
- * Return true iff the BST is balanced.
+ * Compares two keys with operator<, counting the comparison.
+ */
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::keyLess(const Key& a, const Key& b) const {
+    stats_.comparison();
+    return a < b;
+}
+
+/**
+ * Compares key, whose packed prefix is prefix, with node's key: negative,
+ * zero or positive like strcmp. Keys with an inline prefix are decided by
+ * the prefixes when they differ, without reading node's key; otherwise this
+ * is the usual one or two keyLess() calls.
+ */
+template<typename Key, typename Value>
+int BinarySearchTree<Key, Value>::compareKey(
+        const Key& key, const typename KeyPrefix<Key>::Type& prefix, const Node<Key, Value>* node) const {
+    if constexpr (KeyPrefix<Key>::enabled) {
+        typename KeyPrefix<Key>::Type other = node->getKeyPrefix();
+        stats_.comparison();
+        if (prefix != other)
+            return prefix < other ? -1 : 1;
+        int order = key.compare(node->getKey());
+        return order < 0 ? -1 : order > 0 ? 1 : 0;
+    } else {
+        if (keyLess(key, node->getKey()))
+            return -1;
+        if (keyLess(node->getKey(), key))
+            return 1;
+        return 0;
+    }
+}
+
+/**
+ * Allocates a node. All nodes are created and destroyed through these two
+ * helpers so that allocator traffic can be counted and size() kept current.
+ */
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent) {
+    Node<Key, Value>* node = new Node<Key, Value>(key, value, parent);
+    adoptNode(node);
+    return node;
+}
+
+/**
+ * Accounts for a node just allocated by createNode() or a subclass's
+ * equivalent: counts it and adds its key to the membership filter.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::adoptNode(Node<Key, Value>* node) {
+    stats_.allocation();
+    size_++;
+    if (filter_.enabled())
+        filter_.add(node->getKey());
+    nodeCreated(node);
+}
+
+/**
+ * Returns an iterator positioned at node, for subclasses that find nodes
+ * their own way.
+ */
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator BinarySearchTree<Key, Value>::iteratorAt(Node<Key, Value>* node) const {
+    return iterator(node);
+}
+
+/**
+ * Frees a node allocated by createNode() or a subclass's equivalent.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::destroyNode(Node<Key, Value>* node) {
+    if (cache_.enabled())
+        cache_.erase(node);
+    if (filter_.enabled())
+        filter_.remove(node->getKey());
+    nodeDestroyed(node);
+    stats_.free();
+    size_--;
+    slabs_.destroy(node);
+}
+
+/**
+ * Called for every node right after it is allocated and right before it is
+ * freed, for subclasses that index nodes outside the tree. Nodes keep their
+ * items for life, nodeSwap() included, so these are the only two events
+ * such an index has to follow.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::nodeCreated(Node<Key, Value>* /* node */) {}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::nodeDestroyed(Node<Key, Value>* /* node */) {}
+
+/**
+ * Return true iff the BST is balanced, i.e. the heights of the two subtrees
+ * of every node differ by at most one. Runs in O(n).
  */
 template<typename Key, typename Value>
 bool BinarySearchTree<Key, Value>::isBalanced() const {
     // TODO
+    return walkTree(false, true, nullptr);
+}
 
-    if (doComparison(getSmallestNode()) == nullptr)
-        return true;
+/**
+ * Checks the whole tree in one O(n) pass: keys strictly increasing in order,
+ * every child's parent link pointing back at its parent, the root having no
+ * parent, plus whatever validateNode() checks for each node. On failure the
+ * first violation found is described in violation.
+ */
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::validate(std::string& violation) const {
+    violation.clear();
+    return walkTree(true, false, &violation);
+}
 
-    return false;
+/**
+ * The same as validate(std::string&), for when the reason does not matter.
+ */
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::validate() const {
+    std::string violation;
+    return validate(violation);
 }
 
+/**
+ * Describes a violation found at node, for validate().
+ */
 template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::doComparison(Node<Key, Value>* node) {
-    while (node != nullptr) {
-        if (!compareHeights(node->getRight(), node->getLeft()))
-            return node;
-        node = node->getParent();
-    }
+void BinarySearchTree<Key, Value>::reportViolation(
+        const Node<Key, Value>* node, const char* problem, std::string* violation) const {
+    if (violation == nullptr)
+        return;
+    std::ostringstream out;
+    out << "key " << node->getKey() << ": " << problem;
+    *violation = out.str();
+}
 
-    return nullptr;
+/**
+ * Per-node hook for validate(), called once both subtrees of node have been
+ * checked and measured. A plain BST has nothing more to check.
+ */
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::validateNode(
+        const Node<Key, Value>* /* node */, int /* left_height */, int /* right_height */, std::string* /* violation */)
+        const {
+    return true;
 }
 
+/**
+ * Post-order walk shared by validate() and isBalanced(). It keeps its own
+ * stack, since an unbalanced tree can be as deep as it is large, and computes
+ * every subtree's height from its children's so each node is visited once.
+ * With structure set it checks order, parent links and validateNode(); with
+ * balance set it checks the height difference at every node.
+ */
 template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::compareHeights(Node<Key, Value>* n1, Node<Key, Value>* n2) const {
-    int diff = getHeight(n1) - getHeight(n2);
-    if (diff < 0)
-        diff *= -1;
+bool BinarySearchTree<Key, Value>::walkTree(bool structure, bool balance, std::string* violation) const {
+    struct Frame {
+        const Node<Key, Value>* node;
+        int state;  // 0: left subtree next, 1: right subtree next, 2: both done
+        int left_height;
+    };
 
-    if (diff > 1) {
+    if (root_ == nullptr)
+        return true;
+    if (structure && root_->getParent() != nullptr) {
+        reportViolation(root_, "root has a parent", violation);
         return false;
     }
 
-    return true;
-}
+    std::vector<Frame> stack;
+    stack.push_back(Frame{root_, 0, 0});
+    const Node<Key, Value>* prev = nullptr;  // the previous node in order
+    int height = 0;                          // the height of the subtree finished last
+
+    while (!stack.empty()) {
+        Frame& f = stack.back();
+        const Node<Key, Value>* node = f.node;
+
+        if (f.state == 0) {
+            f.state = 1;
+            const Node<Key, Value>* left = node->getLeft();
+            if (left != nullptr) {
+                if (structure && left->getParent() != node) {
+                    reportViolation(node, "left child's parent link points elsewhere", violation);
+                    return false;
+                }
+                stack.push_back(Frame{left, 0, 0});
+                continue;
+            }
+            height = 0;
+        }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* n) const {
-    if (n == nullptr)
-        return 0;
-    else if (n->getRight() == nullptr && n->getLeft() == nullptr)
-        return 1;
+        if (f.state == 1) {
+            f.state = 2;
+            f.left_height = height;
+            if (structure && prev != nullptr && !(prev->getKey() < node->getKey())) {
+                reportViolation(node, "out of order with its in-order predecessor", violation);
+                return false;
+            }
+            prev = node;
+
+            const Node<Key, Value>* right = node->getRight();
+            if (right != nullptr) {
+                if (structure && right->getParent() != node) {
+                    reportViolation(node, "right child's parent link points elsewhere", violation);
+                    return false;
+                }
+                stack.push_back(Frame{right, 0, 0});
+                continue;
+            }
+            height = 0;
+        }
 
-    int h_r = 0, h_l = 0;
-    h_r = 1 + getHeight(n->getRight());
-    h_l = 1 + getHeight(n->getLeft());
+        int left_height = f.left_height;
+        int right_height = height;
+        if (balance && std::abs(left_height - right_height) > 1) {
+            reportViolation(node, "subtree heights differ by more than one", violation);
+            return false;
+        }
+        if (structure && !validateNode(node, left_height, right_height, violation))
+            return false;
+        height = std::max(left_height, right_height) + 1;
+        stack.pop_back();
+    }
 
-    if (h_r > h_l)
-        return h_r;
-    else
-        return h_l;
+    return true;
 }
 
 template<typename Key, typename Value>
@@ -658,6 +1079,11 @@ void BinarySearchTree<Key, Value>::nodeSwap(Node<Key, Value>* n1, Node<Key, Valu
     if ((n1 == n2) || (n1 == NULL) || (n2 == NULL)) {
         return;
     }
+    // the nodes keep their items here, but an override may move them
+    if (cache_.enabled()) {
+        cache_.erase(n1);
+        cache_.erase(n2);
+    }
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
@@ -747,6 +1173,24 @@ void BinarySearchTree<Key, Value>::nodeSwap(Node<Key, Value>* n1, Node<Key, Valu
 // include print function (in its own file because it's fairly long)
 #include "print_bst.h"
 
+// include the DOT/JSON exporters and summarize(), which scale to large trees
+#include "export_bst.h"
+
+// include size() and memoryUsage()
+#include "memory_bst.h"
+
+// include findBatch()
+#include "batch_bst.h"
+
+// include parallelForEach() and parallelReduce() with their thread pool
+#include "parallel_bst.h"
+
+// include clearInBackground() and the thread that frees detached nodes
+#include "teardown_bst.h"
+
+// include rebalance() and the depth-triggered rebuilds of setAutoRebalance()
+#include "rebalance_bst.h"
+
 /*
 ---------------------------------------------------
 End implementations for the BinarySearchTree class.
@@ -0,0 +1,399 @@
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#ifndef EXPIRING_AVLBST_H
+#define EXPIRING_AVLBST_H
+
+#include "avlbst.h"
+#include "set_avlbst.h"
+
+// Expiring AVL map
+// Version 1
+//
+// ExpiringAVLMap is an AVLTree whose entries can carry an expiry time and
+// which can be held to a memory budget. Times are plain uint64_t ticks in
+// whatever unit the caller uses; the map never reads a clock.
+//
+// Entries with an expiry are also kept in an expiry index, an AVLSet of
+// (expiry, node), so purgeExpired(now) finds the k expired entries from the
+// front of the index and removes them in O(k log n) without looking at the
+// rest. Entries also sit on an intrusive LRU list, refreshed by insert() and
+// by the non-const find(); with a budget set, every insert evicts from the
+// cold end until the charged bytes fit again.
+//
+// An entry is charged its node, its index node if it has one, and the heap
+// memory its key and value own (see HeapFootprint), as of its last insert.
+// Expired entries stay visible until purgeExpired() removes them, and
+// entries restored by load() never expire, since snapshots do not store
+// expiry times. They join the LRU list in the snapshot's node order, which
+// is a pre-order of the saved tree, not key order.
+
+#define EXPIRY_NEVER UINT64_MAX
+
+template<typename Key, typename Value>
+class ExpiringNode;
+
+/**
+ * An entry of the expiry index: ordered by expiry, ties broken by node.
+ */
+template<typename Key, typename Value>
+struct ExpiryEntry {
+    uint64_t expiresAt;
+    ExpiringNode<Key, Value>* node;
+
+    bool operator<(const ExpiryEntry& other) const {
+        return expiresAt < other.expiresAt
+               || (expiresAt == other.expiresAt && (uintptr_t)node < (uintptr_t)other.node);
+    }
+};
+
+template<typename Key, typename Value>
+std::ostream& operator<<(std::ostream& out, const ExpiryEntry<Key, Value>& entry) {
+    return out << entry.expiresAt;
+}
+
+/**
+ * An AVLNode with an expiry time, LRU links and the bytes it is charged.
+ */
+template<typename Key, typename Value>
+class ExpiringNode : public AVLNode<Key, Value> {
+public:
+    ExpiringNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent, uint64_t expiresAt)
+            : AVLNode<Key, Value>(key, value, parent),
+              expiresAt_(expiresAt),
+              charge_(0),
+              newer_(nullptr),
+              older_(nullptr) {}
+
+    uint64_t expiresAt_;
+    size_t charge_;
+    ExpiringNode<Key, Value>* newer_;
+    ExpiringNode<Key, Value>* older_;
+};
+
+/**
+ * An AVLTree with per-entry expiry and an optional LRU memory budget.
+ */
+template<typename Key, typename Value>
+class ExpiringAVLMap : public AVLTree<Key, Value> {
+public:
+    typedef typename AVLTree<Key, Value>::iterator iterator;
+
+    ExpiringAVLMap();
+
+    virtual void insert(const std::pair<const Key, Value>& new_item) override;
+    void insert(const std::pair<const Key, Value>& new_item, uint64_t expiresAt);
+    using AVLTree<Key, Value>::find;
+    iterator find(const Key& key);
+
+    size_t purgeExpired(uint64_t now);
+    uint64_t nextExpiry() const;
+
+    void setMemoryBudget(size_t bytes);
+    size_t memoryCharged() const;
+
+protected:
+    typedef ExpiringNode<Key, Value> EntryNode;
+
+    virtual void nodeCreated(Node<Key, Value>* node) override;
+    virtual void nodeDestroyed(Node<Key, Value>* node) override;
+    virtual void nodesReleased() override;
+    virtual AVLNode<Key, Value>* createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) override;
+    virtual AVLNode<Key, Value>* relocateNode(AVLNode<Key, Value>* node, void* place) override;
+    virtual bool validateNode(const Node<Key, Value>* node, int left_height, int right_height, std::string* violation)
+            const override;
+    virtual size_t nodeSize() const override;
+    virtual size_t objectSize() const override;
+
+    void charge(EntryNode* node);
+    void touch(EntryNode* node);
+    void unlink(EntryNode* node);
+    void evict();
+
+    AVLSet<ExpiryEntry<Key, Value>> index_;
+    EntryNode* newest_;
+    EntryNode* oldest_;
+    size_t budget_;   // 0 for none
+    size_t charged_;  // the sum of charge_ over all entries
+    uint64_t nextExpiresAt_;  // the expiry createNode() gives the next node
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ExpiringAVLMap class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ExpiringAVLMap<Key, Value>::ExpiringAVLMap()
+        : newest_(nullptr), oldest_(nullptr), budget_(0), charged_(0), nextExpiresAt_(EXPIRY_NEVER) {}
+
+/**
+ * Inserts an entry that never expires, or clears an existing entry's expiry.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& new_item) {
+    insert(new_item, EXPIRY_NEVER);
+}
+
+/**
+ * Inserts or replaces an entry that expires at expiresAt, or never for
+ * EXPIRY_NEVER, and makes it the most recently used. Then evicts the least
+ * recently used entries while the budget is exceeded, never this one.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& new_item, uint64_t expiresAt) {
+    {
+        TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
+        nextExpiresAt_ = expiresAt;
+        bool created;
+        EntryNode* node = static_cast<EntryNode*>(this->findOrCreate(new_item.first, new_item.second, created));
+        nextExpiresAt_ = EXPIRY_NEVER;
+
+        if (!created) {
+            if (node->expiresAt_ != EXPIRY_NEVER)
+                index_.remove(ExpiryEntry<Key, Value>{node->expiresAt_, node});
+            node->expiresAt_ = expiresAt;
+            if (expiresAt != EXPIRY_NEVER)
+                index_.insert(ExpiryEntry<Key, Value>{expiresAt, node});
+            node->setValue(new_item.second);
+            charge(node);
+            touch(node);
+        }
+    }
+    evict();
+}
+
+/**
+ * Looks key up and marks the entry as recently used. Like HybridAVLMap's,
+ * it walks the tree directly, without the lookup cache or filter.
+ */
+template<typename Key, typename Value>
+typename ExpiringAVLMap<Key, Value>::iterator ExpiringAVLMap<Key, Value>::find(const Key& key) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    Node<Key, Value>* node = this->internalFind(key);
+    if (node != nullptr)
+        touch(static_cast<EntryNode*>(node));
+    return this->iteratorAt(node);
+}
+
+/**
+ * Removes every entry that expires at or before now, earliest first, and
+ * returns how many there were.
+ */
+template<typename Key, typename Value>
+size_t ExpiringAVLMap<Key, Value>::purgeExpired(uint64_t now) {
+    size_t purged = 0;
+    while (!index_.empty()) {
+        const ExpiryEntry<Key, Value>& first = index_.begin()->first;
+        if (first.expiresAt > now)
+            break;
+        Key key = first.node->getKey();  // the node goes away during remove()
+        this->remove(key);
+        purged++;
+    }
+    return purged;
+}
+
+/**
+ * The earliest expiry of any entry, EXPIRY_NEVER if none expires.
+ */
+template<typename Key, typename Value>
+uint64_t ExpiringAVLMap<Key, Value>::nextExpiry() const {
+    return index_.empty() ? EXPIRY_NEVER : index_.begin()->first.expiresAt;
+}
+
+/**
+ * Caps the bytes charged to entries, evicting right away if they exceed
+ * it; 0 removes the cap.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::setMemoryBudget(size_t bytes) {
+    budget_ = bytes;
+    evict();
+}
+
+/**
+ * The bytes charged to all entries, as compared against the budget.
+ */
+template<typename Key, typename Value>
+size_t ExpiringAVLMap<Key, Value>::memoryCharged() const {
+    return charged_;
+}
+
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::nodeCreated(Node<Key, Value>* node) {
+    EntryNode* entry = static_cast<EntryNode*>(node);
+    if (entry->expiresAt_ != EXPIRY_NEVER)
+        index_.insert(ExpiryEntry<Key, Value>{entry->expiresAt_, entry});
+    charge(entry);
+    touch(entry);
+}
+
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::nodeDestroyed(Node<Key, Value>* node) {
+    EntryNode* entry = static_cast<EntryNode*>(node);
+    if (entry->expiresAt_ != EXPIRY_NEVER)
+        index_.remove(ExpiryEntry<Key, Value>{entry->expiresAt_, entry});
+    charged_ -= entry->charge_;
+    unlink(entry);
+}
+
+/**
+ * The expiry index goes to the reaper thread along with the entries.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::nodesReleased() {
+    index_.clearInBackground();
+    newest_ = oldest_ = nullptr;
+    charged_ = 0;
+}
+
+/**
+ * Allocates an entry node with the expiry insert() is adding.
+ */
+template<typename Key, typename Value>
+AVLNode<Key, Value>*
+ExpiringAVLMap<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) {
+    EntryNode* node = new EntryNode(key, value, parent, nextExpiresAt_);
+    this->adoptNode(node);
+    return node;
+}
+
+/**
+ * Moves an entry for relayout(), repointing its expiry index entry and its
+ * LRU neighbours at the new address.
+ */
+template<typename Key, typename Value>
+AVLNode<Key, Value>* ExpiringAVLMap<Key, Value>::relocateNode(AVLNode<Key, Value>* node, void* place) {
+    EntryNode* from = static_cast<EntryNode*>(node);
+    EntryNode* to = new (place) EntryNode(std::move(*from));
+    if (to->expiresAt_ != EXPIRY_NEVER) {
+        index_.remove(ExpiryEntry<Key, Value>{to->expiresAt_, from});
+        index_.insert(ExpiryEntry<Key, Value>{to->expiresAt_, to});
+    }
+    if (to->newer_ != nullptr)
+        to->newer_->older_ = to;
+    else
+        newest_ = to;
+    if (to->older_ != nullptr)
+        to->older_->newer_ = to;
+    else
+        oldest_ = to;
+    return to;
+}
+
+/**
+ * On top of AVLTree's checks, an entry with an expiry must be in the index,
+ * and at the root the index, the LRU list and the charges must account for
+ * exactly the entries in the tree.
+ */
+template<typename Key, typename Value>
+bool ExpiringAVLMap<Key, Value>::validateNode(
+        const Node<Key, Value>* node, int left_height, int right_height, std::string* violation) const {
+    if (!AVLTree<Key, Value>::validateNode(node, left_height, right_height, violation))
+        return false;
+    const EntryNode* entry = static_cast<const EntryNode*>(node);
+    if (entry->expiresAt_ != EXPIRY_NEVER
+        && index_.find(ExpiryEntry<Key, Value>{entry->expiresAt_, const_cast<EntryNode*>(entry)}) == index_.end()) {
+        this->reportViolation(node, "missing from the expiry index", violation);
+        return false;
+    }
+    if (node->getParent() != nullptr)
+        return true;
+
+    size_t listed = 0;
+    size_t expiring = 0;
+    size_t charged = 0;
+    for (const EntryNode* e = newest_; e != nullptr; e = e->older_) {
+        listed++;
+        expiring += e->expiresAt_ != EXPIRY_NEVER ? 1 : 0;
+        charged += e->charge_;
+    }
+    if (listed != this->size_ || expiring != index_.size() || charged != charged_) {
+        this->reportViolation(node, "LRU list, expiry index or charges do not match the tree", violation);
+        return false;
+    }
+    return true;
+}
+
+template<typename Key, typename Value>
+size_t ExpiringAVLMap<Key, Value>::nodeSize() const {
+    return sizeof(EntryNode);
+}
+
+/**
+ * The map object plus the expiry index's nodes.
+ */
+template<typename Key, typename Value>
+size_t ExpiringAVLMap<Key, Value>::objectSize() const {
+    MemoryUsage index = index_.memoryUsage();
+    return sizeof(*this) - sizeof(index_) + index.total();
+}
+
+/**
+ * Recomputes what node is charged: its chunk, its index node's chunk if it
+ * expires, and the heap its key and value own.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::charge(EntryNode* node) {
+    size_t bytes = mallocChunkSize(sizeof(EntryNode));
+    if (node->expiresAt_ != EXPIRY_NEVER)
+        bytes += mallocChunkSize(sizeof(AVLNode<ExpiryEntry<Key, Value>, NoValue>));
+    bytes += HeapFootprint<Key>::bytes(node->getKey()) + HeapFootprint<Value>::bytes(node->getValue());
+    charged_ = charged_ - node->charge_ + bytes;
+    node->charge_ = bytes;
+}
+
+/**
+ * Moves node to the recently used end of the LRU list.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::touch(EntryNode* node) {
+    if (newest_ == node)
+        return;
+    unlink(node);
+    node->older_ = newest_;
+    if (newest_ != nullptr)
+        newest_->newer_ = node;
+    newest_ = node;
+    if (oldest_ == nullptr)
+        oldest_ = node;
+}
+
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::unlink(EntryNode* node) {
+    if (node->newer_ != nullptr)
+        node->newer_->older_ = node->older_;
+    else if (newest_ == node)
+        newest_ = node->older_;
+    if (node->older_ != nullptr)
+        node->older_->newer_ = node->newer_;
+    else if (oldest_ == node)
+        oldest_ = node->newer_;
+    node->newer_ = node->older_ = nullptr;
+}
+
+/**
+ * Removes least recently used entries while the budget is exceeded, but
+ * never the most recently used one.
+ */
+template<typename Key, typename Value>
+void ExpiringAVLMap<Key, Value>::evict() {
+    while (budget_ != 0 && charged_ > budget_ && oldest_ != newest_) {
+        Key key = oldest_->getKey();  // the node goes away during remove()
+        this->remove(key);
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ExpiringAVLMap class.
+  -------------------------------------------------
+*/
+
+#endif
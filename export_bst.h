@@ -0,0 +1,284 @@
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifndef EXPORT_BST_H
+#define EXPORT_BST_H
+
+// BST export functions
+// Version 1
+//
+// exportDot() and exportJson() stream the tree out in one pre-order pass,
+// holding nothing but a stack as deep as the tree, so they work on trees of
+// any size. Both can be limited to the nodes at most maxDepth levels below
+// the root (the root is depth 0) and to keys within [low, high]; subtrees
+// that lie entirely outside the key range are never visited. A node whose
+// parent is outside the range hangs off its nearest exported ancestor, with
+// a DOT edge and as JSON parent/left/right, so what comes out is always one
+// connected tree. Where the depth limit cuts off children, DOT shows an
+// ellipsis node and JSON sets "truncated".
+//
+// summarize() is a single pass over the whole tree and reports the shape:
+// how many nodes sit at each depth, the mean search path length and the
+// height against the minimum possible ceil(log2(n + 1)).
+//
+// Keys are written with operator<<; only the keys are exported.
+
+/**
+ * The shape of a tree, as computed by BinarySearchTree::summarize().
+ */
+struct TreeSummary {
+    uint64_t size;
+    int height;                          // number of levels; 0 for an empty tree
+    int optimalHeight;                   // ceil(log2(size + 1))
+    double averagePathLength;            // mean number of nodes visited by a successful find
+    std::vector<uint64_t> depthHistogram;  // depthHistogram[d]: nodes at depth d
+};
+
+/**
+ * Writes a summary in a human-readable form, one item per line.
+ */
+inline std::ostream& operator<<(std::ostream& out, const TreeSummary& s) {
+    out << "size " << s.size << "\n"
+        << "height " << s.height << " (optimal " << s.optimalHeight << ", ratio "
+        << (s.optimalHeight == 0 ? 1.0 : (double)s.height / s.optimalHeight) << ")\n"
+        << "average path length " << s.averagePathLength << "\n"
+        << "depth histogram\n";
+    for (size_t d = 0; d < s.depthHistogram.size(); ++d) {
+        out << "  " << d << " " << s.depthHistogram[d] << "\n";
+    }
+    return out;
+}
+
+// Writes text as the body of a double-quoted DOT or JSON string.
+inline void writeEscaped(std::ostream& out, const std::string& text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else if (c < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        } else {
+            out << c;
+        }
+    }
+}
+
+// Writes a key as a JSON value: a number for arithmetic keys, a string otherwise.
+template<typename Key>
+void writeJsonKey(std::ostream& out, const Key& key) {
+    if constexpr (std::is_arithmetic<Key>::value && !std::is_same<Key, char>::value
+                  && !std::is_same<Key, bool>::value) {
+        out << +key;
+    } else {
+        std::ostringstream text;
+        text << key;
+        out << '"';
+        writeEscaped(out, text.str());
+        out << '"';
+    }
+}
+
+/**
+ * Writes the tree as a Graphviz digraph, e.g. for dot -Tsvg. Pass a negative
+ * maxDepth for no depth limit.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportDot(std::ostream& out, int maxDepth) const {
+    exportTree(out, false, nullptr, nullptr, maxDepth);
+}
+
+/**
+ * Writes the part of the tree with keys in [low, high] as a Graphviz digraph.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportDot(std::ostream& out, const Key& low, const Key& high, int maxDepth) const {
+    exportTree(out, false, &low, &high, maxDepth);
+}
+
+/**
+ * Writes the tree as a JSON object {"nodes": [...]} with one entry per node in
+ * pre-order: {"key", "depth", "parent", "left", "right"}, the last three
+ * being keys of exported nodes or null. Pass a negative maxDepth for no
+ * depth limit.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportJson(std::ostream& out, int maxDepth) const {
+    exportTree(out, true, nullptr, nullptr, maxDepth);
+}
+
+/**
+ * Writes the part of the tree with keys in [low, high] as JSON.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportJson(std::ostream& out, const Key& low, const Key& high, int maxDepth) const {
+    exportTree(out, true, &low, &high, maxDepth);
+}
+
+/**
+ * The pre-order walk behind exportDot() and exportJson(). A null low or high
+ * leaves that end of the key range open.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportTree(
+        std::ostream& out, bool json, const Key* low, const Key* high, int maxDepth) const {
+    struct Frame {
+        const Node<Key, Value>* node;
+        const Node<Key, Value>* parent;  // nearest exported ancestor
+        int depth;
+        long id;  // DOT id, assigned by the parent when it drew the edge
+    };
+
+    // A node outside the range leads on to at most one side that may hold
+    // nodes inside it, so the nearest exported node below a link is found
+    // by walking a single path. depth follows the walk.
+    auto exported = [&](const Node<Key, Value>* node, int& depth) -> const Node<Key, Value>* {
+        while (node != nullptr) {
+            bool below = low != nullptr && node->getKey() < *low;
+            if (!below && !(high != nullptr && *high < node->getKey()))
+                return node;
+            if (maxDepth >= 0 && depth >= maxDepth)
+                return nullptr;
+            node = below ? node->getRight() : node->getLeft();
+            depth++;
+        }
+        return nullptr;
+    };
+
+    if (json)
+        out << "{\"nodes\": [";
+    else
+        out << "digraph BST {\n  ordering=out;\n  node [shape=circle];\n";
+
+    std::vector<Frame> stack;
+    long nextId = 0;
+    int topDepth = 0;
+    const Node<Key, Value>* top = exported(root_, topDepth);
+    if (top != nullptr)
+        stack.push_back(Frame{top, nullptr, topDepth, nextId++});
+    bool first = true;
+
+    while (!stack.empty()) {
+        Frame f = stack.back();
+        stack.pop_back();
+        const Node<Key, Value>* node = f.node;
+        long id = f.id;
+
+        bool hasChildren = node->getLeft() != nullptr || node->getRight() != nullptr;
+        bool truncated = hasChildren && maxDepth >= 0 && f.depth >= maxDepth;
+        const Node<Key, Value>* children[2] = {nullptr, nullptr};
+        int depths[2] = {f.depth + 1, f.depth + 1};
+        if (!truncated) {
+            children[0] = exported(node->getLeft(), depths[0]);
+            children[1] = exported(node->getRight(), depths[1]);
+        }
+
+        if (json) {
+            out << (first ? "\n  " : ",\n  ") << "{\"key\": ";
+            writeJsonKey(out, node->getKey());
+            out << ", \"depth\": " << f.depth << ", \"parent\": ";
+            if (f.parent != nullptr)
+                writeJsonKey(out, f.parent->getKey());
+            else
+                out << "null";
+            for (int side = 0; side < 2; ++side) {
+                out << (side == 0 ? ", \"left\": " : ", \"right\": ");
+                if (children[side] != nullptr)
+                    writeJsonKey(out, children[side]->getKey());
+                else
+                    out << "null";
+            }
+            if (truncated)
+                out << ", \"truncated\": true";
+            out << "}";
+        } else {
+            std::ostringstream label;
+            label << node->getKey();
+            out << "  n" << id << " [label=\"";
+            writeEscaped(out, label.str());
+            out << "\"];\n";
+            if (truncated) {
+                out << "  n" << id << "_more [shape=plaintext, label=\"...\"];\n";
+                out << "  n" << id << " -> n" << id << "_more [style=dashed];\n";
+            }
+        }
+        first = false;
+
+        if (truncated)
+            continue;
+
+        // Exported children get their id now so the edges can be drawn left
+        // to right; a missing child becomes an invisible node that keeps a
+        // lone sibling on its own side.
+        long childIds[2] = {-1, -1};
+        for (int side = 0; side < 2; ++side) {
+            if (children[side] != nullptr)
+                childIds[side] = nextId++;
+            if (json)
+                continue;
+            if (children[side] != nullptr) {
+                out << "  n" << id << " -> n" << childIds[side] << ";\n";
+            } else if (children[1 - side] != nullptr) {
+                out << "  n" << id << "_" << side << " [style=invis];\n";
+                out << "  n" << id << " -> n" << id << "_" << side << " [style=invis];\n";
+            }
+        }
+
+        // right first so that the left subtree comes out first
+        for (int side = 1; side >= 0; --side) {
+            if (children[side] != nullptr)
+                stack.push_back(Frame{children[side], node, depths[side], childIds[side]});
+        }
+    }
+
+    if (json)
+        out << (first ? "]}\n" : "\n]}\n");
+    else
+        out << "}\n";
+}
+
+/**
+ * Measures the shape of the whole tree in one O(n) pass.
+ */
+template<typename Key, typename Value>
+TreeSummary BinarySearchTree<Key, Value>::summarize() const {
+    TreeSummary summary;
+    summary.size = 0;
+    summary.height = 0;
+
+    uint64_t depthSum = 0;
+    std::vector<std::pair<const Node<Key, Value>*, int>> stack;
+    if (root_ != nullptr)
+        stack.push_back(std::make_pair(root_, 0));
+
+    while (!stack.empty()) {
+        const Node<Key, Value>* node = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        summary.size++;
+        depthSum += depth;
+        if ((size_t)depth >= summary.depthHistogram.size())
+            summary.depthHistogram.resize(depth + 1, 0);
+        summary.depthHistogram[depth]++;
+
+        if (node->getRight() != nullptr)
+            stack.push_back(std::make_pair(node->getRight(), depth + 1));
+        if (node->getLeft() != nullptr)
+            stack.push_back(std::make_pair(node->getLeft(), depth + 1));
+    }
+
+    summary.height = (int)summary.depthHistogram.size();
+    summary.optimalHeight = (int)std::ceil(std::log2((double)summary.size + 1));
+    summary.averagePathLength = summary.size == 0 ? 0.0 : 1.0 + (double)depthSum / summary.size;
+    return summary;
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#ifndef FILTER_BST_H
+#define FILTER_BST_H
+
+// BST membership filter
+// Version 1
+//
+// An optional counting Bloom filter over the keys in the tree. find() asks
+// it first, and a key it has never seen is reported absent without touching
+// the tree. It is off until setMembershipFilter() sizes it for an expected
+// number of keys and a target false positive rate, and is then kept up to
+// date as nodes are created and destroyed, removals included.
+//
+// The filter is blocked: all of a key's counters are in one 64-byte block
+// of FILTER_BLOCK_COUNTERS, chosen by the key's hash, so a query costs one
+// cache miss whatever the number of hash functions. Keys spread unevenly
+// over blocks, so a blocked filter needs more counters for the same false
+// positive rate: FILTER_BLOCK_PENALTY times the textbook number, which
+// measures at or under the target from 10% down to 1%. Below that the
+// unevenness wins and rates bottom out around 0.5%. Counters are four bits;
+// one that more than 15 keys share at once sticks at 15 and is never
+// decremented again, which can cost false positives but never hides a key
+// that is present. Beyond the expected
+// number of keys the false positive rate climbs, which the stats show;
+// size it again to fix that.
+//
+// The query and false positive counts behind those stats are updated by
+// const find(), so with the filter on, find() is not thread safe either,
+// just like with the lookup cache.
+//
+// Keys need a std::hash specialization to enable it.
+
+#define FILTER_BLOCK_COUNTERS 128
+#define FILTER_MAX_HASHES 12
+#define FILTER_COUNTER_MAX 15
+#define FILTER_BLOCK_PENALTY 1.5
+
+/**
+ * Filter counters, as returned by BinarySearchTree::membershipFilterStats().
+ * Of the queries, negatives were answered "absent" by the filter alone and
+ * falsePositives passed the filter only for the tree to miss.
+ */
+struct MembershipFilterStats {
+    size_t counters;  // 0 when disabled
+    int hashes;
+    uint64_t queries;
+    uint64_t negatives;
+    uint64_t falsePositives;
+
+    // The share of lookups for absent keys that the filter let through.
+    double falsePositiveRate() const {
+        return negatives + falsePositives == 0 ? 0.0 : (double)falsePositives / (negatives + falsePositives);
+    }
+};
+
+/**
+ * Writes the counters one per line as "avlbst_<name> <value>", like the
+ * operation counters in stats_bst.h.
+ */
+inline std::ostream& operator<<(std::ostream& out, const MembershipFilterStats& s) {
+    out << "avlbst_filter_counters " << s.counters << "\n"
+        << "avlbst_filter_hashes " << s.hashes << "\n"
+        << "avlbst_filter_queries " << s.queries << "\n"
+        << "avlbst_filter_negatives " << s.negatives << "\n"
+        << "avlbst_filter_false_positives " << s.falsePositives << "\n"
+        << "avlbst_filter_false_positive_rate " << s.falsePositiveRate() << "\n";
+    return out;
+}
+
+/**
+ * The filter itself, a member of every BinarySearchTree.
+ */
+template<typename Key>
+class MembershipFilter {
+public:
+    static const bool hashable = std::is_default_constructible<std::hash<Key>>::value;
+
+    MembershipFilter() : hashes_(0), queries_(0), negatives_(0), falsePositives_(0) {}
+
+    bool enabled() const {
+        return !blocks_.empty();
+    }
+
+    // Sizes the filter for expectedKeys keys at falsePositiveRate, using the
+    // usual m = -n ln(p) / ln(2)^2 counters and k = m / n ln(2) hashes, and
+    // empties it; 0 keys turns it off and frees it.
+    void resize(size_t expectedKeys, double falsePositiveRate) {
+        if (expectedKeys != 0 && !hashable)
+            throw std::invalid_argument("membership filter needs a std::hash for the key type");
+        if (expectedKeys != 0 && !(falsePositiveRate > 0.0 && falsePositiveRate < 1.0))
+            throw std::invalid_argument("false positive rate must be between 0 and 1");
+        std::vector<Block>().swap(blocks_);
+        hashes_ = 0;
+        if (expectedKeys == 0)
+            return;
+
+        double perKey = -std::log(falsePositiveRate) / (std::log(2.0) * std::log(2.0));
+        double counters = std::ceil(perKey * expectedKeys * FILTER_BLOCK_PENALTY);
+        blocks_.assign((size_t)std::ceil(counters / FILTER_BLOCK_COUNTERS), Block());
+        hashes_ = (int)std::lround(perKey * FILTER_BLOCK_PENALTY * std::log(2.0));
+        if (hashes_ < 1)
+            hashes_ = 1;
+        if (hashes_ > FILTER_MAX_HASHES)
+            hashes_ = FILTER_MAX_HASHES;
+    }
+
+    void add(const Key& key) {
+        uint64_t h = hash(key);
+        Block& block = blocks_[blockIndex(h)];
+        for (int i = 0; i < hashes_; ++i) {
+            unsigned s = slot(h, i);
+            if (block.get(s) < FILTER_COUNTER_MAX)
+                block.add(s, 1);
+        }
+    }
+
+    void remove(const Key& key) {
+        uint64_t h = hash(key);
+        Block& block = blocks_[blockIndex(h)];
+        for (int i = 0; i < hashes_; ++i) {
+            unsigned s = slot(h, i);
+            if (block.get(s) < FILTER_COUNTER_MAX)
+                block.add(s, -1);
+        }
+    }
+
+    // Zeroes every counter, for when the whole tree is cleared.
+    void clear() {
+        std::fill(blocks_.begin(), blocks_.end(), Block());
+    }
+
+    // false means key is definitely not in the tree. Counts the query, so
+    // concurrent callers race on the counters.
+    bool mayContain(const Key& key) {
+        queries_++;
+        uint64_t h = hash(key);
+        const Block& block = blocks_[blockIndex(h)];
+        for (int i = 0; i < hashes_; ++i) {
+            if (block.get(slot(h, i)) == 0) {
+                negatives_++;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Called when a key that passed mayContain() was not in the tree.
+    void falsePositive() {
+        falsePositives_++;
+    }
+
+    MembershipFilterStats stats() const {
+        MembershipFilterStats s;
+        s.counters = blocks_.size() * FILTER_BLOCK_COUNTERS;
+        s.hashes = hashes_;
+        s.queries = queries_;
+        s.negatives = negatives_;
+        s.falsePositives = falsePositives_;
+        return s;
+    }
+
+    // The size of the one heap block holding the counters, 0 when disabled.
+    size_t heapBytes() const {
+        return blocks_.capacity() * sizeof(Block);
+    }
+
+    void resetStats() {
+        queries_ = negatives_ = falsePositives_ = 0;
+    }
+
+private:
+    // Two counters per byte.
+    struct alignas(64) Block {
+        uint8_t counters[FILTER_BLOCK_COUNTERS / 2] = {};
+
+        unsigned get(unsigned s) const {
+            return (counters[s >> 1] >> ((s & 1) * 4)) & 0xf;
+        }
+        void add(unsigned s, int delta) {
+            counters[s >> 1] = (uint8_t)(counters[s >> 1] + delta * (1 << ((s & 1) * 4)));
+        }
+    };
+
+    // std::hash through mixHash() (bst.h): the low half picks the block and
+    // the high half the counters within it.
+    static uint64_t hash(const Key& key) {
+        if constexpr (hashable) {
+            return mixHash((uint64_t)std::hash<Key>()(key));
+        } else {
+            return 0;
+        }
+    }
+
+    size_t blockIndex(uint64_t h) const {
+        return (size_t)(((h & 0xffffffffull) * blocks_.size()) >> 32);
+    }
+
+    // Double hashing within the block; an odd step keeps the slots distinct.
+    static unsigned slot(uint64_t h, int i) {
+        unsigned first = (unsigned)(h >> 32);
+        unsigned step = (unsigned)(h >> 38) | 1;
+        return (first + i * step) & (FILTER_BLOCK_COUNTERS - 1);
+    }
+
+    std::vector<Block> blocks_;
+    int hashes_;
+    uint64_t queries_;
+    uint64_t negatives_;
+    uint64_t falsePositives_;
+};
+
+#endif
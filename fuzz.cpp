@@ -0,0 +1,1599 @@
+// Differential stress test for the trees and the containers built on them,
+// with std::map as the reference.
+//
+// Usage: avl_fuzz [--target=NAME] [--seed=N] [--runs=N] [--steps=N] [--keys=N] [--check-every=N]
+//                 [--replay=FILE]
+//
+// Every run generates a random trace of inserts, removes, finds, clears,
+// snapshot round trips and configuration changes from (seed, run number),
+// then applies it to one target and a std::map in lockstep. After each step
+// it checks the result of the step itself, and every --check-every steps it
+// also compares the whole contents in iteration order and runs the target's
+// validate() for the BST order, parent links and balance invariants.
+//
+// The targets are AVLTree with int keys ("avl") and with string keys that
+// share long prefixes ("string"), the plain BinarySearchTree ("bst"), every
+// BalancedTree policy ("avl-policy", "red-black", "wavl", "treap", "splay")
+// and HybridAVLMap ("hybrid"), and the containers built on AVLTree: AVLSet
+// ("set"), AVLMultiMap ("multimap"), AVLIntervalTree ("interval") and
+// ExpiringAVLMap ("expiring") and SplitAVLMap ("split"), and the file-backed
+// MappedAVLTree ("mapped") and PagedAVLTree ("paged"). Without --target the
+// runs take turns through all of them. File-backed trees live in temporary files that are removed when
+// the run ends.
+//
+// Each run executes in a child process so that crashes are caught like any
+// other failure. A failing trace is shrunk by deleting chunks of it for as
+// long as it keeps failing, and the result is printed in the same text format
+// --replay reads:
+//
+//   target <name>
+//   insert <key> <value>
+//   remove <key>
+//   find <key>
+//   clear
+//   reload
+//   cache <entries>          setLookupCacheSize()
+//   filter <keys>            setMembershipFilter()
+//   background-clear         clearInBackground()
+//   rebalance <n>            rebalance(), then setAutoRebalance(1 + n / 4), or off for 0
+//   relayout <n>             relayoutStep(n), or relayout() for 0
+//
+// A target ignores the configuration steps it has no use for.
+//
+// Built with -DAVLBST_LIBFUZZER (make avl_libfuzzer, needs clang) the file is
+// a libFuzzer target instead, taking the target from the first byte of its
+// input and decoding the rest into a trace three bytes per step.
+
+#include "avlbst.h"
+#include "balanced_bst.h"
+#include "expiring_avlbst.h"
+#include "hybrid_avlbst.h"
+#include "interval_avlbst.h"
+#include "mmap_avlbst.h"
+#include "paged_avlbst.h"
+#include "multimap_avlbst.h"
+#include "set_avlbst.h"
+#include "split_avlbst.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#ifndef AVLBST_LIBFUZZER
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#endif
+
+enum FuzzOpKind {
+    FUZZ_INSERT,
+    FUZZ_REMOVE,
+    FUZZ_FIND,
+    FUZZ_CLEAR,
+    FUZZ_RELOAD,
+    FUZZ_CACHE,
+    FUZZ_FILTER,
+    FUZZ_BACKGROUND_CLEAR,
+    FUZZ_REBALANCE,
+    FUZZ_RELAYOUT
+};
+
+struct FuzzOp {
+    FuzzOpKind kind;
+    int key;
+    int value;  // the argument of a configuration step
+};
+
+typedef std::vector<FuzzOp> Trace;
+
+// Where file-backed targets create their files. The harness points it at a
+// directory of its own, which it empties after every child, since a child
+// that crashes leaves its files behind.
+static std::string scratchDir = "/tmp";
+
+/*
+  -------------------
+  Traces.
+  -------------------
+*/
+
+static std::string formatOp(const FuzzOp& op) {
+    std::ostringstream out;
+    switch (op.kind) {
+    case FUZZ_INSERT:
+        out << "insert " << op.key << " " << op.value;
+        break;
+    case FUZZ_REMOVE:
+        out << "remove " << op.key;
+        break;
+    case FUZZ_FIND:
+        out << "find " << op.key;
+        break;
+    case FUZZ_CLEAR:
+        out << "clear";
+        break;
+    case FUZZ_RELOAD:
+        out << "reload";
+        break;
+    case FUZZ_CACHE:
+        out << "cache " << op.value;
+        break;
+    case FUZZ_FILTER:
+        out << "filter " << op.value;
+        break;
+    case FUZZ_BACKGROUND_CLEAR:
+        out << "background-clear";
+        break;
+    case FUZZ_REBALANCE:
+        out << "rebalance " << op.value;
+        break;
+    case FUZZ_RELAYOUT:
+        out << "relayout " << op.value;
+        break;
+    }
+    return out.str();
+}
+
+#ifndef AVLBST_LIBFUZZER
+
+// Reads a trace in the format formatOp() writes, one step per line, and the
+// target line, if any, into target. Returns false on the first line it does
+// not understand.
+static bool parseTrace(std::istream& in, Trace& trace, std::string& target) {
+    static const struct {
+        const char* name;
+        FuzzOpKind kind;
+        bool key;
+        bool value;
+    } kinds[] = {
+        {"insert", FUZZ_INSERT, true, true},
+        {"remove", FUZZ_REMOVE, true, false},
+        {"find", FUZZ_FIND, true, false},
+        {"clear", FUZZ_CLEAR, false, false},
+        {"reload", FUZZ_RELOAD, false, false},
+        {"cache", FUZZ_CACHE, false, true},
+        {"filter", FUZZ_FILTER, false, true},
+        {"background-clear", FUZZ_BACKGROUND_CLEAR, false, false},
+        {"rebalance", FUZZ_REBALANCE, false, true},
+        {"relayout", FUZZ_RELAYOUT, false, true},
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        std::string kind;
+        if (!(words >> kind))
+            continue;
+        if (kind == "target") {
+            if (!(words >> target))
+                return false;
+            continue;
+        }
+        size_t k = 0;
+        while (k < sizeof(kinds) / sizeof(kinds[0]) && kind != kinds[k].name)
+            k++;
+        if (k == sizeof(kinds) / sizeof(kinds[0]))
+            return false;
+        FuzzOp op = {kinds[k].kind, 0, 0};
+        if (kinds[k].key && !(words >> op.key))
+            return false;
+        if (kinds[k].value && !(words >> op.value))
+            return false;
+        trace.push_back(op);
+    }
+    return true;
+}
+
+// splitmix64, so a (seed, run) pair always produces the same trace
+struct FuzzRng {
+    uint64_t state;
+
+    explicit FuzzRng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t below(uint64_t n) {
+        return next() % n;
+    }
+};
+
+// Mostly inserts and removes over a small key range, so the tree keeps
+// growing and shrinking through every rebalancing case. Each run leans
+// towards inserts or removes by a different amount so that both large and
+// nearly empty trees get covered. About one step in a hundred changes the
+// configuration, so the cache, the filter, the rebuilds and the relayout
+// all see the tree at many sizes, and are switched off again now and then.
+static Trace generateTrace(uint64_t seed, uint64_t run, uint64_t steps, uint64_t keys) {
+    FuzzRng rng(seed * 0x100000001b3ull + run);
+    unsigned insertPerMille = 280 + (unsigned)rng.below(240);
+    Trace trace;
+    trace.reserve(steps);
+    for (uint64_t i = 0; i < steps; ++i) {
+        FuzzOp op = {FUZZ_FIND, (int)rng.below(keys), (int)rng.below(1000)};
+        bool off = rng.below(4) == 0;
+        unsigned roll = (unsigned)rng.below(1000);
+        if (roll == 0) {
+            op.kind = FUZZ_CLEAR;
+        } else if (roll < 4) {
+            op.kind = FUZZ_RELOAD;
+        } else if (roll < 6) {
+            op.kind = FUZZ_CACHE;
+            op.value = off ? 0 : 1 << rng.below(9);
+        } else if (roll < 8) {
+            op.kind = FUZZ_FILTER;
+            op.value = off ? 0 : 1 + (int)rng.below(2 * keys);
+        } else if (roll < 9) {
+            op.kind = FUZZ_BACKGROUND_CLEAR;
+        } else if (roll < 11) {
+            op.kind = FUZZ_REBALANCE;
+            op.value = off ? 0 : 1 + (int)rng.below(12);
+        } else if (roll < 13) {
+            op.kind = FUZZ_RELAYOUT;
+            op.value = off ? 0 : 1 + (int)rng.below(64);
+        } else if (roll < 13 + insertPerMille) {
+            op.kind = FUZZ_INSERT;
+        } else if (roll < 900) {
+            op.kind = FUZZ_REMOVE;
+        }
+        trace.push_back(op);
+    }
+    return trace;
+}
+
+#endif
+
+/*
+  -------------------
+  Targets.
+  -------------------
+*/
+
+/**
+ * One container under test, seen through int keys and values. Targets with
+ * other key or value types map them to and from ints.
+ */
+class FuzzTarget {
+public:
+    virtual ~FuzzTarget() {}
+
+    virtual void insert(int key, int value) = 0;
+    virtual void remove(int key) = 0;
+    virtual void clear() = 0;
+    // a snapshot round trip, or the nearest thing the target has
+    virtual void reload() = 0;
+    // the configuration steps, FUZZ_CACHE to FUZZ_RELAYOUT
+    virtual void configure(const FuzzOp& op) = 0;
+
+    // Looks key up, setting the key and value found.
+    virtual bool find(int key, int& foundKey, int& value) = 0;
+    // Lists every entry in iteration order.
+    virtual void contents(std::vector<std::pair<int, int>>& entries) = 0;
+    virtual bool validate(std::string& violation) = 0;
+
+    // The order iteration must follow.
+    virtual bool keyLess(int a, int b) const {
+        return a < b;
+    }
+
+    // False for sets, whose entries carry no value to compare.
+    virtual bool hasValues() const {
+        return true;
+    }
+
+    // Checks of the target's own after each step. A target that drops
+    // entries by itself, such as on expiry, also drops them from the model.
+    virtual std::string afterStep(const FuzzOp& /* op */, std::map<int, int>& /* model */) {
+        return "";
+    }
+};
+
+// Applies a configuration step to any tree, skipping what its keys or its
+// class do not support.
+template<typename Key, typename Value>
+static void configureTree(BinarySearchTree<Key, Value>& tree, const FuzzOp& op) {
+    switch (op.kind) {
+    case FUZZ_CACHE:
+        if (LookupCache<Key, Value>::hashable)
+            tree.setLookupCacheSize(op.value);
+        break;
+    case FUZZ_FILTER:
+        if (MembershipFilter<Key>::hashable)
+            tree.setMembershipFilter(op.value, 0.05);
+        break;
+    case FUZZ_BACKGROUND_CLEAR:
+        tree.clearInBackground();
+        break;
+    case FUZZ_REBALANCE:
+        tree.rebalance();
+        tree.setAutoRebalance(op.value == 0 ? 0.0 : 1.0 + op.value / 4.0);
+        break;
+    case FUZZ_RELAYOUT:
+        if (AVLTree<Key, Value>* avl = dynamic_cast<AVLTree<Key, Value>*>(&tree)) {
+            if (op.value == 0)
+                avl->relayout();
+            else
+                avl->relayoutStep(op.value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Saves the tree, clears it and loads it back, if it is an AVLTree; the other
+// trees have no snapshots.
+template<typename Key, typename Value>
+static void reloadTree(BinarySearchTree<Key, Value>& tree) {
+    if (AVLTree<Key, Value>* avl = dynamic_cast<AVLTree<Key, Value>*>(&tree)) {
+        std::stringstream snapshot;
+        avl->save(snapshot);
+        avl->clear();
+        avl->load(snapshot);
+    }
+}
+
+/**
+ * Any tree with int keys and values.
+ */
+template<typename Tree>
+class MapTarget : public FuzzTarget {
+public:
+    virtual void insert(int key, int value) override {
+        tree_.insert(std::make_pair(key, value));
+    }
+
+    virtual void remove(int key) override {
+        tree_.remove(key);
+    }
+
+    virtual void clear() override {
+        tree_.clear();
+    }
+
+    virtual void reload() override {
+        reloadTree(tree_);
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(tree_, op);
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        typename Tree::iterator it = tree_.find(key);
+        if (it == tree_.end())
+            return false;
+        foundKey = it->first;
+        value = it->second;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (typename Tree::iterator it = tree_.begin(); it != tree_.end(); ++it) {
+            entries.push_back(std::make_pair(it->first, it->second));
+        }
+    }
+
+    virtual bool validate(std::string& violation) override {
+        return tree_.validate(violation);
+    }
+
+protected:
+    Tree tree_;
+};
+
+/**
+ * AVLTree with string keys. Keys are drawn from a few stems that share long
+ * prefixes, past the eight bytes the key prefix holds, and some that embed a
+ * NUL or high bytes, so the prefix comparisons hit every tie-break.
+ */
+class StringTarget : public FuzzTarget {
+public:
+    static std::string encode(int key) {
+        static const std::string stems[] = {
+            std::string(""),
+            std::string("k"),
+            std::string("ab"),
+            std::string("ab\0", 3),
+            std::string("prefix__"),
+            std::string("prefix__longer/"),
+            std::string("\xff\x01"),
+        };
+        static const int stemCount = sizeof(stems) / sizeof(stems[0]);
+        return stems[key % stemCount] + std::to_string(key / stemCount);
+    }
+
+    virtual void insert(int key, int value) override {
+        std::string text = encode(key);
+        keys_[text] = key;
+        tree_.insert(std::make_pair(text, value));
+    }
+
+    virtual void remove(int key) override {
+        tree_.remove(encode(key));
+    }
+
+    virtual void clear() override {
+        tree_.clear();
+    }
+
+    virtual void reload() override {
+        reloadTree(tree_);
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(tree_, op);
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        AVLTree<std::string, int>::iterator it = tree_.find(encode(key));
+        if (it == tree_.end())
+            return false;
+        foundKey = decode(it->first);
+        value = it->second;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (AVLTree<std::string, int>::iterator it = tree_.begin(); it != tree_.end(); ++it) {
+            entries.push_back(std::make_pair(decode(it->first), it->second));
+        }
+    }
+
+    virtual bool validate(std::string& violation) override {
+        return tree_.validate(violation);
+    }
+
+    virtual bool keyLess(int a, int b) const override {
+        return encode(a) < encode(b);
+    }
+
+private:
+    // -1 for a key that was never inserted
+    int decode(const std::string& text) const {
+        std::map<std::string, int>::const_iterator it = keys_.find(text);
+        return it == keys_.end() ? -1 : it->second;
+    }
+
+    AVLTree<std::string, int> tree_;
+    std::map<std::string, int> keys_;  // every key ever inserted, encoded
+};
+
+/**
+ * AVLSet, checking contains() against find() on every step. The model's
+ * values are ignored.
+ */
+class SetTarget : public FuzzTarget {
+public:
+    virtual void insert(int key, int /* value */) override {
+        set_.insert(key);
+    }
+
+    virtual void remove(int key) override {
+        set_.remove(key);
+    }
+
+    virtual void clear() override {
+        set_.clear();
+    }
+
+    virtual void reload() override {
+        reloadTree(set_);
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(set_, op);
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        AVLSet<int>::iterator it = set_.find(key);
+        if (it == set_.end())
+            return false;
+        foundKey = it->first;
+        value = 0;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (AVLSet<int>::iterator it = set_.begin(); it != set_.end(); ++it) {
+            entries.push_back(std::make_pair(it->first, 0));
+        }
+    }
+
+    virtual bool validate(std::string& violation) override {
+        return set_.validate(violation);
+    }
+
+    virtual bool hasValues() const override {
+        return false;
+    }
+
+    virtual std::string afterStep(const FuzzOp& op, std::map<int, int>& /* model */) override {
+        if (set_.contains(op.key) != (set_.find(op.key) != set_.end()))
+            return "contains(" + std::to_string(op.key) + ") disagrees with find()";
+        return "";
+    }
+
+private:
+    AVLSet<int> set_;
+};
+
+/**
+ * AVLMultiMap, with every key's values kept beside it in insertion order.
+ * The model holds the last value under each key. Some inserts append a
+ * key's values to themselves, or one of its values again, through
+ * equalRange(), so that growing a list from its own storage is covered.
+ */
+class MultiMapTarget : public FuzzTarget {
+public:
+    virtual void insert(int key, int value) override {
+        std::vector<int>& expected = lists_[key];
+        std::pair<int*, int*> range = map_.equalRange(key);
+        if (value % 3 == 0 && !expected.empty() && expected.size() < 64) {
+            map_.insert(key, range.first, range.second);
+            expected.insert(expected.end(), expected.begin(), expected.end());
+        } else if (value % 3 == 1 && !expected.empty()) {
+            map_.insert(key, range.second[-1]);
+            expected.push_back(expected.back());
+        } else {
+            map_.insert(key, value);
+            expected.push_back(value);
+        }
+    }
+
+    virtual void remove(int key) override {
+        map_.remove(key);
+        lists_.erase(key);
+    }
+
+    virtual void clear() override {
+        map_.clear();
+        lists_.clear();
+    }
+
+    virtual void reload() override {
+        reloadTree(map_);
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(map_, op);
+        if (op.kind == FUZZ_BACKGROUND_CLEAR)
+            lists_.clear();
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        AVLMultiMap<int, int>::iterator it = map_.find(key);
+        if (it == map_.end())
+            return false;
+        foundKey = it->first;
+        value = last(it->second);
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (AVLMultiMap<int, int>::iterator it = map_.begin(); it != map_.end(); ++it) {
+            entries.push_back(std::make_pair(it->first, last(it->second)));
+        }
+    }
+
+    // Checks every key's values, in order, and valueCount().
+    virtual bool validate(std::string& violation) override {
+        if (!map_.validate(violation))
+            return false;
+        const AVLMultiMap<int, int>& view = map_;
+        size_t total = 0;
+        for (std::map<int, std::vector<int>>::const_iterator it = lists_.begin(); it != lists_.end(); ++it) {
+            std::pair<const int*, const int*> range = view.equalRange(it->first);
+            if (!std::equal(range.first, range.second, it->second.begin(), it->second.end())) {
+                violation = "values under key " + std::to_string(it->first) + " differ from those inserted";
+                return false;
+            }
+            total += it->second.size();
+        }
+        if (map_.valueCount() != total) {
+            violation = "valueCount() is " + std::to_string(map_.valueCount()) + ", expected " + std::to_string(total);
+            return false;
+        }
+        return true;
+    }
+
+    virtual std::string afterStep(const FuzzOp& op, std::map<int, int>& model) override {
+        std::map<int, std::vector<int>>::const_iterator expected = lists_.find(op.key);
+        size_t size = expected == lists_.end() ? 0 : expected->second.size();
+        if (map_.count(op.key) != size) {
+            return "count(" + std::to_string(op.key) + ") is " + std::to_string(map_.count(op.key)) + ", expected "
+                   + std::to_string(size);
+        }
+        if (op.kind == FUZZ_INSERT)
+            model[op.key] = expected->second.back();
+        return "";
+    }
+
+private:
+    // -1 for an empty list, which the map should never hold
+    static int last(const ValueList<int>& values) {
+        return values.size() == 0 ? -1 : values[values.size() - 1];
+    }
+
+    AVLMultiMap<int, int> map_;
+    std::map<int, std::vector<int>> lists_;
+};
+
+/**
+ * AVLIntervalTree, with key k standing for the interval [k % 64, k % 64 + k / 64],
+ * so that many intervals share a low end and overlap each other. After each
+ * step an overlap query and a stabbing query derived from the step's key
+ * are checked against a scan of the model.
+ */
+class IntervalTarget : public FuzzTarget {
+public:
+    typedef AVLIntervalTree<int, int> Tree;
+
+    static Interval<int> encode(int key) {
+        return Interval<int>(key % 64, key % 64 + key / 64);
+    }
+
+    static int decode(const Interval<int>& interval) {
+        return (interval.high - interval.low) * 64 + interval.low;
+    }
+
+    virtual void insert(int key, int value) override {
+        tree_.insert(std::make_pair(encode(key), value));
+    }
+
+    virtual void remove(int key) override {
+        tree_.remove(encode(key));
+    }
+
+    virtual void clear() override {
+        tree_.clear();
+    }
+
+    virtual void reload() override {
+        reloadTree(tree_);
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(tree_, op);
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        Tree::iterator it = tree_.find(encode(key));
+        if (it == tree_.end())
+            return false;
+        foundKey = decode(it->first);
+        value = it->second;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (Tree::iterator it = tree_.begin(); it != tree_.end(); ++it) {
+            entries.push_back(std::make_pair(decode(it->first), it->second));
+        }
+    }
+
+    virtual bool validate(std::string& violation) override {
+        return tree_.validate(violation);
+    }
+
+    virtual bool keyLess(int a, int b) const override {
+        return encode(a) < encode(b);
+    }
+
+    virtual std::string afterStep(const FuzzOp& op, std::map<int, int>& model) override {
+        int low = op.key * 7 % 80;
+        int high = low + op.key % 5;
+        std::string problem = compare("overlapping", low, high, tree_.overlapping(low, high), model);
+        if (problem.empty())
+            problem = compare("stabbing", low, low, tree_.stabbing(low), model);
+        return problem;
+    }
+
+private:
+    // Compares the keys a query returned with those of the model's intervals
+    // that overlap [low, high].
+    static std::string compare(const char* query,
+                               int low,
+                               int high,
+                               const std::vector<Tree::iterator>& found,
+                               const std::map<int, int>& model) {
+        std::vector<int> keys;
+        for (size_t i = 0; i < found.size(); ++i) {
+            keys.push_back(decode(found[i]->first));
+        }
+        std::sort(keys.begin(), keys.end());
+        std::vector<int> expected;
+        for (std::map<int, int>::const_iterator it = model.begin(); it != model.end(); ++it) {
+            if (encode(it->first).overlaps(low, high))
+                expected.push_back(it->first);
+        }
+        if (keys == expected)
+            return "";
+        std::ostringstream out;
+        out << query << "(" << low << ", " << high << ") returned " << keys.size() << " intervals, expected "
+            << expected.size();
+        return out.str();
+    }
+
+    Tree tree_;
+};
+
+/**
+ * ExpiringAVLMap under a memory budget, with a clock that ticks once per
+ * step. Inserts whose value is a multiple of 4 expire a few ticks later.
+ * The target tracks every entry's expiry and the LRU order, and after each
+ * step checks that evictions took the least recently used entries, that
+ * purgeExpired() removed exactly the expired ones, and nextExpiry().
+ */
+class ExpiringTarget : public FuzzTarget {
+public:
+    // room for about 170 entries, which most runs outgrow
+    static const size_t budget = 16 * 1024;
+
+    ExpiringTarget() : now_(0) {
+        map_.setMemoryBudget(budget);
+    }
+
+    virtual void insert(int key, int value) override {
+        if (value % 4 == 0) {
+            uint64_t expiresAt = now_ + 1 + value % 32;
+            map_.insert(std::make_pair(key, value), expiresAt);
+            expiry_[key] = expiresAt;
+        } else {
+            map_.insert(std::make_pair(key, value));
+            expiry_.erase(key);
+        }
+        touch(key);
+    }
+
+    virtual void remove(int key) override {
+        map_.remove(key);
+        forget(key);
+    }
+
+    virtual void clear() override {
+        map_.clear();
+        reset();
+    }
+
+    // Entries come back never to expire, and colder than any entry touched
+    // since, in an LRU order that the shape of the tree decides.
+    virtual void reload() override {
+        reloadTree(map_);
+        loaded_.insert(lru_.begin(), lru_.end());
+        lru_.clear();
+        positions_.clear();
+        expiry_.clear();
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(map_, op);
+        if (op.kind == FUZZ_BACKGROUND_CLEAR)
+            reset();
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        ExpiringAVLMap<int, int>::iterator it = map_.find(key);
+        if (it == map_.end())
+            return false;
+        touch(key);
+        foundKey = it->first;
+        value = it->second;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (ExpiringAVLMap<int, int>::iterator it = map_.begin(); it != map_.end(); ++it) {
+            entries.push_back(std::make_pair(it->first, it->second));
+        }
+    }
+
+    virtual bool validate(std::string& violation) override {
+        return map_.validate(violation);
+    }
+
+    virtual std::string afterStep(const FuzzOp& op, std::map<int, int>& model) override {
+        std::ostringstream out;
+        // an insert evicts from the cold end until the map fits its budget,
+        // the entries restored by the last reload first
+        if (op.kind == FUZZ_INSERT && lru_.size() + loaded_.size() > map_.size()) {
+            if (!loaded_.empty()) {
+                std::set<int> present;
+                for (ExpiringAVLMap<int, int>::iterator it = map_.begin(); it != map_.end(); ++it) {
+                    present.insert(it->first);
+                }
+                for (std::set<int>::iterator it = loaded_.begin(); it != loaded_.end();) {
+                    int key = *it++;
+                    if (present.count(key) == 0) {
+                        model.erase(key);
+                        forget(key);
+                    }
+                }
+                if (!loaded_.empty() && lru_.size() + loaded_.size() > map_.size())
+                    return "evicted a recently used entry before the reloaded ones";
+            }
+            while (lru_.size() + loaded_.size() > map_.size()) {
+                model.erase(lru_.front());
+                forget(lru_.front());
+            }
+            if (map_.memoryCharged() > budget && map_.size() > 1) {
+                out << "memoryCharged() is " << map_.memoryCharged() << " after evicting, over the budget";
+                return out.str();
+            }
+        }
+
+        now_++;
+        size_t expected = 0;
+        for (std::map<int, uint64_t>::iterator it = expiry_.begin(); it != expiry_.end();) {
+            int key = it->first;
+            uint64_t expiresAt = it->second;
+            ++it;
+            if (expiresAt <= now_) {
+                model.erase(key);
+                forget(key);
+                expected++;
+            }
+        }
+        size_t purged = map_.purgeExpired(now_);
+        if (purged != expected) {
+            out << "purgeExpired(" << now_ << ") removed " << purged << " entries, expected " << expected;
+            return out.str();
+        }
+
+        uint64_t next = EXPIRY_NEVER;
+        for (std::map<int, uint64_t>::iterator it = expiry_.begin(); it != expiry_.end(); ++it) {
+            next = std::min(next, it->second);
+        }
+        if (map_.nextExpiry() != next) {
+            out << "nextExpiry() is " << map_.nextExpiry() << ", expected " << next;
+            return out.str();
+        }
+        return "";
+    }
+
+private:
+    // Moves key to the recently used end.
+    void touch(int key) {
+        loaded_.erase(key);
+        std::map<int, std::list<int>::iterator>::iterator it = positions_.find(key);
+        if (it != positions_.end())
+            lru_.erase(it->second);
+        positions_[key] = lru_.insert(lru_.end(), key);
+    }
+
+    void forget(int key) {
+        std::map<int, std::list<int>::iterator>::iterator it = positions_.find(key);
+        if (it != positions_.end()) {
+            lru_.erase(it->second);
+            positions_.erase(it);
+        }
+        loaded_.erase(key);
+        expiry_.erase(key);
+    }
+
+    void reset() {
+        loaded_.clear();
+        lru_.clear();
+        positions_.clear();
+        expiry_.clear();
+    }
+
+    ExpiringAVLMap<int, int> map_;
+    uint64_t now_;
+    std::map<int, uint64_t> expiry_;  // the entries that expire
+    std::list<int> lru_;              // least recently used first
+    std::map<int, std::list<int>::iterator> positions_;
+    std::set<int> loaded_;            // restored by reload() and not touched since, older than lru_
+};
+
+/**
+ * SplitAVLMap with string values of assorted lengths, so that a value read
+ * through a stale handle or from a freed chunk shows up under ASan. compact()
+ * stands in for the snapshot round trip, which the map does not support.
+ */
+class SplitTarget : public FuzzTarget {
+public:
+    typedef SplitAVLMap<int, std::string> Map;
+
+    static std::string encode(int value) {
+        return "value " + std::to_string(value) + " " + std::string(value % 40, '.');
+    }
+
+    // -1 for a string encode() did not make
+    static int decode(const std::string& text) {
+        int value = -1;
+        if (std::sscanf(text.c_str(), "value %d", &value) != 1 || text != encode(value))
+            return -1;
+        return value;
+    }
+
+    virtual void insert(int key, int value) override {
+        if (value % 2 == 0)
+            map_.insert(key, encode(value));
+        else
+            map_.insert(std::pair<const int, std::string>(key, encode(value)));
+    }
+
+    virtual void remove(int key) override {
+        map_.remove(key);
+    }
+
+    virtual void clear() override {
+        map_.clear();
+    }
+
+    virtual void reload() override {
+        map_.compact();
+    }
+
+    virtual void configure(const FuzzOp& op) override {
+        configureTree(map_, op);
+    }
+
+    // Looks the value up both through findValue() and through the handle.
+    virtual bool find(int key, int& foundKey, int& value) override {
+        Map::iterator it = map_.find(key);
+        std::string* direct = map_.findValue(key);
+        if (it == map_.end() && direct == nullptr)
+            return false;
+        if (it == map_.end()) {
+            foundKey = key;
+            value = -1;
+            return true;
+        }
+        foundKey = it->first;
+        value = decode(map_.value(it->second));
+        if (direct != &map_.value(it->second))
+            value = -1;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (Map::iterator it = map_.begin(); it != map_.end(); ++it) {
+            entries.push_back(std::make_pair(it->first, decode(map_.value(it->second))));
+        }
+    }
+
+    virtual bool validate(std::string& violation) override {
+        return map_.validate(violation);
+    }
+
+private:
+    Map map_;
+};
+
+/**
+ * The part shared by the OffsetAVLTree targets: a tree over a temporary
+ * file, which subclasses open and reopen. Some inserts of a key already
+ * present go through value() instead.
+ */
+template<typename Tree>
+class OffsetTarget : public FuzzTarget {
+public:
+    OffsetTarget() {
+        std::vector<char> path(scratchDir.begin(), scratchDir.end());
+        const char name[] = "/avl_fuzz_XXXXXX";
+        path.insert(path.end(), name, name + sizeof(name));
+        int fd = mkstemp(path.data());
+        if (fd < 0)
+            throw std::runtime_error(std::string("mkstemp: ") + std::strerror(errno));
+        ::close(fd);
+        path_ = path.data();
+    }
+
+    virtual ~OffsetTarget() {
+        tree_.reset();
+        unlink(path_.c_str());
+    }
+
+    virtual void insert(int key, int value) override {
+        typename Tree::iterator it = tree_->find(key);
+        if (value % 3 == 0 && it != tree_->end())
+            tree_->value(it) = value;
+        else
+            tree_->insert(std::make_pair(key, value));
+    }
+
+    virtual void remove(int key) override {
+        tree_->remove(key);
+    }
+
+    virtual void clear() override {
+        tree_->clear();
+    }
+
+    // The tree has none of the features the configuration steps set up, so
+    // only a background clear does anything: it clears.
+    virtual void configure(const FuzzOp& op) override {
+        if (op.kind == FUZZ_BACKGROUND_CLEAR)
+            tree_->clear();
+    }
+
+    virtual bool find(int key, int& foundKey, int& value) override {
+        typename Tree::iterator it = tree_->find(key);
+        if (it == tree_->end())
+            return false;
+        foundKey = it->first;
+        value = it->second;
+        return true;
+    }
+
+    virtual void contents(std::vector<std::pair<int, int>>& entries) override {
+        for (typename Tree::iterator it = tree_->begin(); it != tree_->end(); ++it) {
+            entries.push_back(std::make_pair(it->first, it->second));
+        }
+    }
+
+    // isBalanced() checks the heights; the count must match the entries.
+    virtual bool validate(std::string& violation) override {
+        if (!tree_->isBalanced()) {
+            violation = "isBalanced() is false";
+            return false;
+        }
+        uint64_t count = 0;
+        for (typename Tree::iterator it = tree_->begin(); it != tree_->end(); ++it) {
+            count++;
+        }
+        if (count != tree_->size()) {
+            violation = "size() is " + std::to_string(tree_->size()) + " with " + std::to_string(count) + " entries";
+            return false;
+        }
+        return true;
+    }
+
+protected:
+    std::string path_;
+    std::unique_ptr<Tree> tree_;
+};
+
+/**
+ * MappedAVLTree. The reload step syncs and closes the file, checks that a
+ * read-only mapping of it sees the same entries and rejects every write,
+ * and reopens it for writing.
+ */
+class MappedTarget : public OffsetTarget<MappedAVLTree<int, int>> {
+public:
+    typedef MappedAVLTree<int, int> Tree;
+
+    MappedTarget() {
+        tree_.reset(new Tree(path_));
+    }
+
+    virtual void reload() override {
+        std::vector<std::pair<int, int>> written;
+        contents(written);
+        tree_->sync();
+        tree_.reset();
+        tree_.reset(new Tree(path_, true));
+        std::vector<std::pair<int, int>> mapped;
+        contents(mapped);
+        if (mapped != written)
+            problem_ = "a read-only mapping sees different entries";
+        else
+            problem_ = readOnlyProblem();
+        tree_.reset();
+        tree_.reset(new Tree(path_));
+    }
+
+    virtual std::string afterStep(const FuzzOp& /* op */, std::map<int, int>& /* model */) override {
+        std::string problem;
+        problem.swap(problem_);
+        return problem;
+    }
+
+private:
+    // What, if anything, the read-only tree let through.
+    std::string readOnlyProblem() {
+        const char* accepted = nullptr;
+        try {
+            tree_->insert(std::make_pair(0, 0));
+            accepted = "insert()";
+        } catch (const MappedFileError&) {
+        }
+        try {
+            tree_->remove(0);
+            accepted = "remove()";
+        } catch (const MappedFileError&) {
+        }
+        try {
+            tree_->clear();
+            accepted = "clear()";
+        } catch (const MappedFileError&) {
+        }
+        if (!tree_->empty()) {
+            try {
+                tree_->value(tree_->begin()) = 0;
+                accepted = "value()";
+            } catch (const MappedFileError&) {
+            }
+        }
+        if (accepted != nullptr)
+            return std::string("a read-only mapping accepted ") + accepted;
+        return "";
+    }
+
+    std::string problem_;  // found by reload(), reported by afterStep()
+};
+
+/**
+ * PagedAVLTree with pages of a few nodes and the smallest buffer pool, so
+ * that nearly every step evicts and reads pages back. The reload step
+ * alternates between recluster() and flushing, closing and reopening the
+ * file.
+ */
+class PagedTarget : public OffsetTarget<PagedAVLTree<int, int>> {
+public:
+    typedef PagedAVLTree<int, int> Tree;
+
+    static const size_t pageSize = 256;
+    static const size_t memoryBudget = PAGED_MIN_FRAMES * pageSize;
+
+    PagedTarget() : reloads_(0) {
+        tree_.reset(new Tree(path_, memoryBudget, pageSize));
+    }
+
+    virtual void reload() override {
+        if (reloads_++ % 2 == 0) {
+            tree_->recluster();
+        } else {
+            tree_->flush();
+            tree_.reset();
+            tree_.reset(new Tree(path_, memoryBudget, pageSize));
+        }
+    }
+
+private:
+    uint64_t reloads_;
+};
+
+struct FuzzTargetInfo {
+    const char* name;
+    FuzzTarget* (*make)();
+};
+
+template<typename Target>
+static FuzzTarget* makeTarget() {
+    return new Target();
+}
+
+static const FuzzTargetInfo fuzzTargets[] = {
+    {"avl", &makeTarget<MapTarget<AVLTree<int, int>>>},
+    {"string", &makeTarget<StringTarget>},
+    {"bst", &makeTarget<MapTarget<BinarySearchTree<int, int>>>},
+    {"avl-policy", &makeTarget<MapTarget<AVLBalancedTree<int, int>>>},
+    {"red-black", &makeTarget<MapTarget<RedBlackTree<int, int>>>},
+    {"wavl", &makeTarget<MapTarget<WAVLTree<int, int>>>},
+    {"treap", &makeTarget<MapTarget<Treap<int, int>>>},
+    {"splay", &makeTarget<MapTarget<SplayTree<int, int>>>},
+    {"hybrid", &makeTarget<MapTarget<HybridAVLMap<int, int>>>},
+    {"set", &makeTarget<SetTarget>},
+    {"multimap", &makeTarget<MultiMapTarget>},
+    {"interval", &makeTarget<IntervalTarget>},
+    {"expiring", &makeTarget<ExpiringTarget>},
+    {"split", &makeTarget<SplitTarget>},
+    {"mapped", &makeTarget<MappedTarget>},
+    {"paged", &makeTarget<PagedTarget>},
+};
+
+static const size_t fuzzTargetCount = sizeof(fuzzTargets) / sizeof(fuzzTargets[0]);
+
+// Returns the target with the given name, or null.
+static const FuzzTargetInfo* findTarget(const std::string& name) {
+    for (size_t i = 0; i < fuzzTargetCount; ++i) {
+        if (name == fuzzTargets[i].name)
+            return &fuzzTargets[i];
+    }
+    return nullptr;
+}
+
+/*
+  -------------------
+  Lockstep checking.
+  -------------------
+*/
+
+// Compares every entry of the target against the map: first that iteration
+// follows the target's key order, then the entries themselves.
+static std::string compareContents(FuzzTarget& target, const std::map<int, int>& model) {
+    std::vector<std::pair<int, int>> entries;
+    target.contents(entries);
+    std::ostringstream out;
+    for (size_t i = 1; i < entries.size(); ++i) {
+        if (!target.keyLess(entries[i - 1].first, entries[i].first)) {
+            out << "entry " << i << " (" << entries[i].first << ") does not follow entry " << i - 1 << " ("
+                << entries[i - 1].first << ") in key order";
+            return out.str();
+        }
+    }
+
+    std::sort(entries.begin(), entries.end());
+    std::map<int, int>::const_iterator expected = model.begin();
+    for (size_t i = 0; i < entries.size(); ++i, ++expected) {
+        if (expected == model.end()) {
+            out << "target has an extra entry (" << entries[i].first << ", " << entries[i].second << "), expected "
+                << model.size() << " entries";
+            return out.str();
+        }
+        if (entries[i].first != expected->first
+                || (target.hasValues() && entries[i].second != expected->second)) {
+            out << "entry (" << entries[i].first << ", " << entries[i].second << ") found where ("
+                << expected->first << ", " << expected->second << ") was expected";
+            return out.str();
+        }
+    }
+    if (expected != model.end()) {
+        out << "target has " << entries.size() << " entries, expected " << model.size();
+        return out.str();
+    }
+    return "";
+}
+
+// Applies one step to both containers and checks the step's own outcome.
+static std::string applyOp(FuzzTarget& target, std::map<int, int>& model, const FuzzOp& op) {
+    switch (op.kind) {
+    case FUZZ_INSERT:
+        target.insert(op.key, op.value);
+        model[op.key] = op.value;
+        break;
+    case FUZZ_REMOVE:
+        target.remove(op.key);
+        model.erase(op.key);
+        break;
+    case FUZZ_CLEAR:
+        target.clear();
+        model.clear();
+        break;
+    case FUZZ_RELOAD:
+        target.reload();
+        break;
+    case FUZZ_BACKGROUND_CLEAR:
+        target.configure(op);
+        model.clear();
+        break;
+    case FUZZ_CACHE:
+    case FUZZ_FILTER:
+    case FUZZ_REBALANCE:
+    case FUZZ_RELAYOUT:
+        target.configure(op);
+        break;
+    case FUZZ_FIND:
+        break;
+    }
+
+    std::string problem = target.afterStep(op, model);
+    if (!problem.empty())
+        return problem;
+
+    // every step ends with a lookup of its key
+    std::ostringstream out;
+    int foundKey = 0;
+    int value = 0;
+    bool found = target.find(op.key, foundKey, value);
+    std::map<int, int>::iterator expected = model.find(op.key);
+    if (expected == model.end() && found) {
+        out << "find(" << op.key << ") returned (" << foundKey << ", " << value << "), expected end()";
+    } else if (expected != model.end() && !found) {
+        out << "find(" << op.key << ") returned end(), expected value " << expected->second;
+    } else if (found && (foundKey != op.key || (target.hasValues() && value != expected->second))) {
+        out << "find(" << op.key << ") returned (" << foundKey << ", " << value << "), expected value "
+            << expected->second;
+    }
+    return out.str();
+}
+
+// Runs a trace, returning a description of the first failure, or an empty
+// string if every check passed. failedStep is set to the index of the step.
+// An exception from the target counts as a failure.
+static std::string runTrace(const FuzzTargetInfo& info, const Trace& trace, uint64_t checkEvery, size_t& failedStep) {
+    std::unique_ptr<FuzzTarget> target(info.make());
+    std::map<int, int> model;
+    for (size_t i = 0; i < trace.size(); ++i) {
+        failedStep = i;
+        std::string problem;
+        try {
+            problem = applyOp(*target, model, trace[i]);
+            bool fullCheck = checkEvery != 0 && ((i + 1) % checkEvery == 0 || i + 1 == trace.size());
+            if (problem.empty() && fullCheck) {
+                std::string violation;
+                if (!target->validate(violation))
+                    problem = "validate: " + violation;
+                else
+                    problem = compareContents(*target, model);
+            }
+        } catch (const std::exception& e) {
+            problem = std::string("threw ") + e.what();
+        }
+        if (!problem.empty())
+            return problem;
+    }
+    return "";
+}
+
+static void reportFailure(
+        const FuzzTargetInfo& info, const Trace& trace, size_t failedStep, const std::string& problem) {
+    std::fprintf(stderr,
+                 "%s, step %zu (%s): %s\n",
+                 info.name,
+                 failedStep,
+                 formatOp(trace[failedStep]).c_str(),
+                 problem.c_str());
+}
+
+#ifdef AVLBST_LIBFUZZER
+
+/*
+  -------------------
+  libFuzzer entry point.
+  -------------------
+*/
+
+// The first byte picks the target; after it come three bytes per step: the
+// kind, the key and the value. Keys stay in [0, 256) so that inserts and
+// removes keep hitting each other.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0)
+        return 0;
+    const FuzzTargetInfo& info = fuzzTargets[data[0] % fuzzTargetCount];
+    Trace trace;
+    for (size_t i = 1; i + 3 <= size; i += 3) {
+        FuzzOp op = {FUZZ_FIND, data[i + 1], data[i + 2]};
+        static const FuzzOpKind rare[] = {FUZZ_CLEAR,
+                                          FUZZ_RELOAD,
+                                          FUZZ_CACHE,
+                                          FUZZ_FILTER,
+                                          FUZZ_BACKGROUND_CLEAR,
+                                          FUZZ_REBALANCE,
+                                          FUZZ_RELAYOUT};
+        unsigned kind = data[i] % 64;
+        if (kind < 7)
+            op.kind = rare[kind];
+        else if (kind < 35)
+            op.kind = FUZZ_INSERT;
+        else if (kind < 56)
+            op.kind = FUZZ_REMOVE;
+        trace.push_back(op);
+    }
+
+    size_t failedStep = 0;
+    std::string problem = runTrace(info, trace, 1, failedStep);
+    if (!problem.empty()) {
+        reportFailure(info, trace, failedStep, problem);
+        std::abort();
+    }
+    return 0;
+}
+
+#else
+
+/*
+  -------------------
+  Isolated runs and trace minimization.
+  -------------------
+*/
+
+/**
+ * The harness's scratch directory, emptied by clear() and removed with all
+ * it holds by the destructor.
+ */
+struct ScratchDir {
+    ScratchDir() {
+        char path[] = "/tmp/avl_fuzz_XXXXXX";
+        if (mkdtemp(path) == nullptr) {
+            std::perror("mkdtemp");
+            std::exit(2);
+        }
+        scratchDir = path;
+    }
+
+    ~ScratchDir() {
+        clear();
+        rmdir(scratchDir.c_str());
+    }
+
+    static void clear() {
+        DIR* dir = opendir(scratchDir.c_str());
+        if (dir == nullptr)
+            return;
+        while (struct dirent* entry = readdir(dir)) {
+            if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0)
+                unlink((scratchDir + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+};
+
+// Runs a trace in a child process, so that a crash or a sanitizer abort
+// counts as a failure instead of ending the harness. With quiet set the
+// child's output is discarded. Returns true if the trace failed.
+static bool failsInChild(const FuzzTargetInfo& info, const Trace& trace, uint64_t checkEvery, bool quiet) {
+    std::fflush(stdout);
+    std::fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        std::exit(2);
+    }
+    if (pid == 0) {
+        if (quiet) {
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) {
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+            }
+        }
+        size_t failedStep = 0;
+        std::string problem = runTrace(info, trace, checkEvery, failedStep);
+        if (!problem.empty()) {
+            reportFailure(info, trace, failedStep, problem);
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            std::perror("waitpid");
+            std::exit(2);
+        }
+    }
+    ScratchDir::clear();
+    if (WIFSIGNALED(status)) {
+        if (!quiet)
+            std::fprintf(stderr, "crashed with signal %d\n", WTERMSIG(status));
+        return true;
+    }
+    return WEXITSTATUS(status) != 0;
+}
+
+// Shrinks a failing trace by deleting ever smaller chunks of it, keeping
+// each deletion that still fails (a simplified ddmin). Candidates are
+// checked after every step, so a failure that --check-every would only have
+// caught later still counts.
+static Trace minimize(const FuzzTargetInfo& info, Trace trace) {
+    for (size_t chunk = trace.size() / 2; chunk >= 1; chunk /= 2) {
+        bool removed = true;
+        while (removed) {
+            removed = false;
+            for (size_t start = 0; start < trace.size();) {
+                Trace candidate(trace.begin(), trace.begin() + start);
+                size_t end = std::min(trace.size(), start + chunk);
+                candidate.insert(candidate.end(), trace.begin() + end, trace.end());
+                if (!candidate.empty() && failsInChild(info, candidate, 1, true)) {
+                    trace.swap(candidate);
+                    removed = true;
+                } else {
+                    start += chunk;
+                }
+            }
+        }
+    }
+    return trace;
+}
+
+static void printTrace(const FuzzTargetInfo& info, const Trace& trace) {
+    std::printf("target %s\n", info.name);
+    for (size_t i = 0; i < trace.size(); ++i) {
+        std::printf("%s\n", formatOp(trace[i]).c_str());
+    }
+}
+
+static bool parseFlag(const char* arg, const char* name, uint64_t& out) {
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    out = std::strtoull(arg + len + 1, nullptr, 10);
+    return true;
+}
+
+static void printUsage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--target=NAME] [--seed=N] [--runs=N] [--steps=N] [--keys=N] [--check-every=N] "
+                 "[--replay=FILE]\ntargets:",
+                 program);
+    for (size_t i = 0; i < fuzzTargetCount; ++i) {
+        std::fprintf(stderr, " %s", fuzzTargets[i].name);
+    }
+    std::fprintf(stderr, "\n");
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t seed = 1;
+    uint64_t runs = 100;
+    uint64_t steps = 10000;
+    uint64_t keys = 1000;
+    uint64_t checkEvery = 1;
+    const char* replay = nullptr;
+    const FuzzTargetInfo* selected = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--replay=", 9) == 0) {
+            replay = argv[i] + 9;
+        } else if (std::strncmp(argv[i], "--target=", 9) == 0) {
+            selected = findTarget(argv[i] + 9);
+            if (selected == nullptr) {
+                std::fprintf(stderr, "unknown target %s\n", argv[i] + 9);
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (!parseFlag(argv[i], "--seed", seed) && !parseFlag(argv[i], "--runs", runs)
+                   && !parseFlag(argv[i], "--steps", steps) && !parseFlag(argv[i], "--keys", keys)
+                   && !parseFlag(argv[i], "--check-every", checkEvery)) {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (keys == 0)
+        keys = 1;
+    ScratchDir scratch;
+
+    if (replay != nullptr) {
+        std::ifstream in(replay);
+        Trace trace;
+        std::string name = "avl";
+        if (!in || !parseTrace(in, trace, name)) {
+            std::fprintf(stderr, "%s: cannot read trace\n", replay);
+            return 2;
+        }
+        // --target wins over the trace's own target line
+        const FuzzTargetInfo* info = selected != nullptr ? selected : findTarget(name);
+        if (info == nullptr) {
+            std::fprintf(stderr, "%s: unknown target %s\n", replay, name.c_str());
+            return 2;
+        }
+        size_t failedStep = 0;
+        std::string problem = runTrace(*info, trace, 1, failedStep);
+        if (!problem.empty()) {
+            reportFailure(*info, trace, failedStep, problem);
+            return 1;
+        }
+        std::printf("%s: %zu steps passed on %s\n", replay, trace.size(), info->name);
+        return 0;
+    }
+
+    for (uint64_t run = 0; run < runs; ++run) {
+        const FuzzTargetInfo& info = selected != nullptr ? *selected : fuzzTargets[run % fuzzTargetCount];
+        Trace trace = generateTrace(seed, run, steps, keys);
+        if (!failsInChild(info, trace, checkEvery, false))
+            continue;
+
+        std::fprintf(stderr, "run %llu (seed %llu, target %s) failed, minimizing %zu steps\n",
+                     (unsigned long long)run,
+                     (unsigned long long)seed,
+                     info.name,
+                     trace.size());
+        Trace minimal = minimize(info, trace);
+        std::fprintf(stderr, "minimal trace has %zu steps:\n", minimal.size());
+        failsInChild(info, minimal, 1, false);
+        printTrace(info, minimal);
+        return 1;
+    }
+
+    std::printf("%llu runs of %llu steps passed (seed %llu, keys [0, %llu), target %s)\n",
+                (unsigned long long)runs,
+                (unsigned long long)steps,
+                (unsigned long long)seed,
+                (unsigned long long)keys,
+                selected != nullptr ? selected->name : "all");
+    return 0;
+}
+
+#endif
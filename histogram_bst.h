@@ -0,0 +1,199 @@
+#ifndef HISTOGRAM_BST_H
+#define HISTOGRAM_BST_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Layout of a LatencyHistogram, in the style of HdrHistogram: values below
+// 2^HISTOGRAM_SUB_BUCKET_BITS get a bucket each, and every power of two above
+// that is split into 2^(HISTOGRAM_SUB_BUCKET_BITS - 1) equal buckets, so a
+// recorded value is off by at most 1/64 (about 1.6%). Values of
+// 2^HISTOGRAM_MAX_BITS and above (about 18 minutes in nanoseconds) are
+// clamped into the last bucket.
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_MAX_BITS 40
+
+/**
+ * A fixed-precision histogram of non-negative integer values, meant for
+ * latencies in nanoseconds. record() is a handful of instructions and never
+ * allocates; percentiles are read back by walking the buckets.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t min() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double p) const;
+
+private:
+    static size_t bucketFor(uint64_t value);
+    static uint64_t highestValueIn(size_t bucket);
+
+    static const uint64_t subBuckets = 1ull << HISTOGRAM_SUB_BUCKET_BITS;
+    static const uint64_t halfSubBuckets = subBuckets / 2;
+    static const size_t bucketCount
+            = subBuckets + (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS) * halfSubBuckets;
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the LatencyHistogram class.
+  -----------------------------------------------------
+*/
+
+/**
+ * Default constructor, which creates an empty histogram.
+ */
+inline LatencyHistogram::LatencyHistogram() : counts_(bucketCount, 0), total_(0), sum_(0), min_(UINT64_MAX), max_(0) {}
+
+/**
+ * Records one value.
+ */
+inline void LatencyHistogram::record(uint64_t value) {
+    counts_[bucketFor(value)]++;
+    total_++;
+    sum_ += value;
+    if (value < min_)
+        min_ = value;
+    if (value > max_)
+        max_ = value;
+}
+
+/**
+ * Adds every value recorded in other to this histogram.
+ */
+inline void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < bucketCount; ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    sum_ += other.sum_;
+    if (other.min_ < min_)
+        min_ = other.min_;
+    if (other.max_ > max_)
+        max_ = other.max_;
+}
+
+/**
+ * Forgets every recorded value.
+ */
+inline void LatencyHistogram::reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    sum_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+}
+
+inline uint64_t LatencyHistogram::count() const {
+    return total_;
+}
+
+/**
+ * The smallest recorded value (exact), or 0 if the histogram is empty.
+ */
+inline uint64_t LatencyHistogram::min() const {
+    return total_ == 0 ? 0 : min_;
+}
+
+/**
+ * The largest recorded value (exact).
+ */
+inline uint64_t LatencyHistogram::max() const {
+    return max_;
+}
+
+/**
+ * The mean of the recorded values (exact), or 0 if the histogram is empty.
+ */
+inline double LatencyHistogram::mean() const {
+    return total_ == 0 ? 0.0 : (double)sum_ / total_;
+}
+
+/**
+ * Returns the value below which p percent of the recorded values fall, e.g.
+ * percentile(99.9). The answer is the top of the bucket the value fell in,
+ * capped at the exact maximum.
+ */
+inline uint64_t LatencyHistogram::percentile(double p) const {
+    if (total_ == 0)
+        return 0;
+    if (p > 100.0)
+        p = 100.0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * total_ + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank >= total_)
+        return max_;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            uint64_t value = highestValueIn(i);
+            return value < max_ ? value : max_;
+        }
+    }
+    return max_;
+}
+
+/**
+ * Maps a value to its bucket. Values above the first subBuckets land in the
+ * upper half of a sub-bucket range scaled down by a power of two.
+ */
+inline size_t LatencyHistogram::bucketFor(uint64_t value) {
+    if (value < subBuckets)
+        return (size_t)value;
+    if (value >> HISTOGRAM_MAX_BITS)
+        return bucketCount - 1;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+    return (size_t)(subBuckets + (shift - 1) * halfSubBuckets + ((value >> shift) - halfSubBuckets));
+}
+
+/**
+ * The largest value that maps to a bucket.
+ */
+inline uint64_t LatencyHistogram::highestValueIn(size_t bucket) {
+    if (bucket < subBuckets)
+        return bucket;
+
+    uint64_t shift = (bucket - subBuckets) / halfSubBuckets + 1;
+    uint64_t sub = (bucket - subBuckets) % halfSubBuckets + halfSubBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the LatencyHistogram class.
+  ---------------------------------------------------
+*/
+
+/**
+ * Writes a one-line summary: count, mean and the usual percentiles.
+ */
+inline std::ostream& operator<<(std::ostream& out, const LatencyHistogram& h) {
+    out << "count=" << h.count() << " mean=" << h.mean() << " min=" << h.min() << " p50=" << h.percentile(50)
+        << " p90=" << h.percentile(90) << " p99=" << h.percentile(99) << " p99.9=" << h.percentile(99.9)
+        << " max=" << h.max();
+    return out;
+}
+
+#endif
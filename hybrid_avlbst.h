@@ -0,0 +1,280 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef HYBRID_AVLBST_H
+#define HYBRID_AVLBST_H
+
+#include "avlbst.h"
+
+#define HASH_INDEX_MIN_CAPACITY 16
+#define HASH_INDEX_MAX_LOAD 0.75
+
+/**
+ * An open-addressing hash table from key to node, with linear probing and
+ * backward-shift deletion (no tombstones). Each slot keeps the key's hash
+ * next to the node pointer so that a probe only dereferences a node whose
+ * hash matches. It grows by doubling past HASH_INDEX_MAX_LOAD and never
+ * shrinks on its own.
+ */
+template<typename Key, typename Value>
+class NodeIndex {
+public:
+    NodeIndex() : size_(0) {}
+
+    Node<Key, Value>* find(const Key& key) const;
+    void insert(Node<Key, Value>* node);
+    void erase(const Node<Key, Value>* node);
+    void reserve(size_t entries);
+
+    size_t size() const {
+        return size_;
+    }
+    size_t heapBytes() const {
+        return slots_.capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Slot {
+        uint64_t hash;
+        Node<Key, Value>* node;  // nullptr for an empty slot
+    };
+
+    static uint64_t hash(const Key& key);
+    void rehash(size_t capacity);
+
+    std::vector<Slot> slots_;  // a power of two in size, or empty
+    size_t size_;
+};
+
+/**
+ * An AVLTree with a hash index beside it: find() is an expected O(1) hash
+ * lookup instead of a tree descent, while iteration, ordered and range
+ * operations still use the tree. The index follows the tree through the
+ * nodeCreated()/nodeDestroyed() hooks, and nodesReleased() for
+ * clearInBackground(), so every insert, remove, clear and snapshot load
+ * keeps it in sync; nodeSwap() moves links, not items, and so
+ * needs nothing. Keys need a std::hash.
+ *
+ * The index costs about 21 to 43 bytes per entry on top of the tree's 64
+ * (for 8-byte keys and values), depending on how full it is; reserve()
+ * sizes it up front.
+ */
+template<typename Key, typename Value>
+class HybridAVLMap : public AVLTree<Key, Value> {
+public:
+    typedef typename AVLTree<Key, Value>::iterator iterator;
+
+    iterator find(const Key& key) const;
+    void reserve(size_t entries);
+
+protected:
+    virtual void nodeCreated(Node<Key, Value>* node) override;
+    virtual void nodeDestroyed(Node<Key, Value>* node) override;
+    virtual void nodesReleased() override;
+    virtual AVLNode<Key, Value>* relocateNode(AVLNode<Key, Value>* node, void* place) override;
+    virtual bool validateNode(const Node<Key, Value>* node, int left_height, int right_height, std::string* violation)
+            const override;
+    virtual size_t objectSize() const override;
+
+    NodeIndex<Key, Value> index_;
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the NodeIndex class.
+  ----------------------------------------------
+*/
+
+/**
+ * Returns the node holding key, or nullptr.
+ */
+template<typename Key, typename Value>
+Node<Key, Value>* NodeIndex<Key, Value>::find(const Key& key) const {
+    if (size_ == 0)
+        return nullptr;
+    uint64_t h = hash(key);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots_[i];
+        if (slot.node == nullptr)
+            return nullptr;
+        if (slot.hash == h && !(key < slot.node->getKey()) && !(slot.node->getKey() < key))
+            return slot.node;
+    }
+}
+
+/**
+ * Adds a node whose key is not in the index yet.
+ */
+template<typename Key, typename Value>
+void NodeIndex<Key, Value>::insert(Node<Key, Value>* node) {
+    if ((double)(size_ + 1) > slots_.size() * HASH_INDEX_MAX_LOAD)
+        rehash(slots_.empty() ? HASH_INDEX_MIN_CAPACITY : slots_.size() * 2);
+    uint64_t h = hash(node->getKey());
+    size_t mask = slots_.size() - 1;
+    size_t i = h & mask;
+    while (slots_[i].node != nullptr) {
+        i = (i + 1) & mask;
+    }
+    slots_[i].hash = h;
+    slots_[i].node = node;
+    size_++;
+}
+
+/**
+ * Removes a node, then shifts back any later slots in its probe run that
+ * may move closer to their home slot, so lookups never need tombstones.
+ */
+template<typename Key, typename Value>
+void NodeIndex<Key, Value>::erase(const Node<Key, Value>* node) {
+    if (size_ == 0)
+        return;
+    size_t mask = slots_.size() - 1;
+    size_t i = hash(node->getKey()) & mask;
+    while (slots_[i].node != node) {
+        if (slots_[i].node == nullptr)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    for (size_t j = (i + 1) & mask; slots_[j].node != nullptr; j = (j + 1) & mask) {
+        size_t home = slots_[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i].node = nullptr;
+    size_--;
+}
+
+/**
+ * Grows the table so that entries fit without another rehash.
+ */
+template<typename Key, typename Value>
+void NodeIndex<Key, Value>::reserve(size_t entries) {
+    size_t capacity = slots_.empty() ? HASH_INDEX_MIN_CAPACITY : slots_.size();
+    while ((double)entries > capacity * HASH_INDEX_MAX_LOAD) {
+        capacity *= 2;
+    }
+    if (capacity != slots_.size())
+        rehash(capacity);
+}
+
+/**
+ * std::hash through mixHash(), since the table uses the low bits.
+ */
+template<typename Key, typename Value>
+uint64_t NodeIndex<Key, Value>::hash(const Key& key) {
+    return mixHash((uint64_t)std::hash<Key>()(key));
+}
+
+template<typename Key, typename Value>
+void NodeIndex<Key, Value>::rehash(size_t capacity) {
+    std::vector<Slot> old(capacity, Slot{0, nullptr});
+    old.swap(slots_);
+    size_t mask = capacity - 1;
+    for (size_t k = 0; k < old.size(); ++k) {
+        if (old[k].node == nullptr)
+            continue;
+        size_t i = old[k].hash & mask;
+        while (slots_[i].node != nullptr) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = old[k];
+    }
+}
+
+/*
+  --------------------------------------------
+  End implementations for the NodeIndex class.
+  --------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the HybridAVLMap class.
+  -------------------------------------------------
+*/
+
+/**
+ * Looks key up in the hash index, without touching the tree.
+ */
+template<typename Key, typename Value>
+typename HybridAVLMap<Key, Value>::iterator HybridAVLMap<Key, Value>::find(const Key& key) const {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    return this->iteratorAt(index_.find(key));
+}
+
+/**
+ * Sizes the hash index for entries keys, to save rehashing while it fills.
+ */
+template<typename Key, typename Value>
+void HybridAVLMap<Key, Value>::reserve(size_t entries) {
+    index_.reserve(entries);
+}
+
+template<typename Key, typename Value>
+void HybridAVLMap<Key, Value>::nodeCreated(Node<Key, Value>* node) {
+    index_.insert(node);
+}
+
+template<typename Key, typename Value>
+void HybridAVLMap<Key, Value>::nodeDestroyed(Node<Key, Value>* node) {
+    index_.erase(node);
+}
+
+template<typename Key, typename Value>
+void HybridAVLMap<Key, Value>::nodesReleased() {
+    index_ = NodeIndex<Key, Value>();
+}
+
+/**
+ * The index follows a node that relayout() moves.
+ */
+template<typename Key, typename Value>
+AVLNode<Key, Value>* HybridAVLMap<Key, Value>::relocateNode(AVLNode<Key, Value>* node, void* place) {
+    AVLNode<Key, Value>* moved = AVLTree<Key, Value>::relocateNode(node, place);
+    index_.erase(node);
+    index_.insert(moved);
+    return moved;
+}
+
+/**
+ * On top of AVLTree's checks, every node must be the one the index finds
+ * for its key, and the index must hold exactly as many entries as the tree.
+ */
+template<typename Key, typename Value>
+bool HybridAVLMap<Key, Value>::validateNode(
+        const Node<Key, Value>* node, int left_height, int right_height, std::string* violation) const {
+    if (!AVLTree<Key, Value>::validateNode(node, left_height, right_height, violation))
+        return false;
+    if (index_.find(node->getKey()) != node) {
+        this->reportViolation(node, "not found through the hash index", violation);
+        return false;
+    }
+    if (node->getParent() == nullptr && index_.size() != this->size_) {
+        this->reportViolation(node, "hash index and tree sizes differ", violation);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The tree object plus the hash index's table.
+ */
+template<typename Key, typename Value>
+size_t HybridAVLMap<Key, Value>::objectSize() const {
+    return sizeof(*this) + (index_.heapBytes() == 0 ? 0 : mallocChunkSize(index_.heapBytes()));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the HybridAVLMap class.
+  -----------------------------------------------
+*/
+
+#endif
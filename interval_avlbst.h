@@ -0,0 +1,301 @@
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef INTERVAL_AVLBST_H
+#define INTERVAL_AVLBST_H
+
+#include "avlbst.h"
+
+// AVL interval tree
+// Version 1
+//
+// AVLIntervalTree maps closed intervals [low, high] to values. The tree is
+// ordered by (low, high), so an interval is a key like any other and the
+// same interval inserted twice replaces the value. Each node also keeps the
+// largest high in its subtree, which lets overlap queries skip every
+// subtree that ends before the query starts: overlapping() and stabbing()
+// run in O(log n + k) for k results.
+//
+// The maximum is kept up to date by updateHeight(), which rotations,
+// retracing and load() all call, by nodeSwap(), and by a walk from the
+// changed node to the root after every insert and remove, since AVL
+// retracing stops as soon as heights settle and maxima may change above.
+
+/**
+ * A closed interval, ordered by low and then high.
+ */
+template<typename Point>
+struct Interval {
+    Interval(const Point& low, const Point& high);
+
+    Point low;
+    Point high;
+
+    bool operator<(const Interval& other) const {
+        return low < other.low || (!(other.low < low) && high < other.high);
+    }
+    bool overlaps(const Point& from, const Point& to) const {
+        return !(high < from) && !(to < low);
+    }
+};
+
+template<typename Point>
+Interval<Point>::Interval(const Point& low, const Point& high) : low(low), high(high) {
+    if (high < low)
+        throw std::invalid_argument("interval ends before it starts");
+}
+
+/**
+ * Writes the interval as "[low, high]".
+ */
+template<typename Point>
+std::ostream& operator<<(std::ostream& out, const Interval<Point>& interval) {
+    return out << '[' << interval.low << ", " << interval.high << ']';
+}
+
+/**
+ * An AVLNode that also stores the largest high in its subtree.
+ */
+template<typename Point, typename Value>
+class IntervalNode : public AVLNode<Interval<Point>, Value> {
+public:
+    IntervalNode(const Interval<Point>& key, const Value& value, AVLNode<Interval<Point>, Value>* parent)
+            : AVLNode<Interval<Point>, Value>(key, value, parent), maxHigh_(key.high) {}
+
+    const Point& getMaxHigh() const {
+        return maxHigh_;
+    }
+    void setMaxHigh(const Point& maxHigh) {
+        maxHigh_ = maxHigh;
+    }
+
+protected:
+    Point maxHigh_;
+};
+
+/**
+ * An AVLTree of intervals with overlap queries.
+ */
+template<typename Point, typename Value>
+class AVLIntervalTree : public AVLTree<Interval<Point>, Value> {
+public:
+    typedef typename AVLTree<Interval<Point>, Value>::iterator iterator;
+
+    virtual void insert(const std::pair<const Interval<Point>, Value>& new_item) override;
+    virtual void remove(const Interval<Point>& key) override;
+
+    std::vector<iterator> overlapping(const Point& low, const Point& high) const;
+    std::vector<iterator> stabbing(const Point& point) const;
+
+protected:
+    typedef AVLNode<Interval<Point>, Value> BaseNode;
+
+    virtual void updateHeight(BaseNode* node) override;
+    virtual void nodeSwap(BaseNode* n1, BaseNode* n2) override;
+    virtual void nodeDestroyed(Node<Interval<Point>, Value>* node) override;
+    virtual bool validateNode(const Node<Interval<Point>, Value>* node, int left_height, int right_height,
+                              std::string* violation) const override;
+    virtual BaseNode* createNode(const Interval<Point>& key, const Value& value, BaseNode* parent) override;
+    virtual BaseNode* relocateNode(BaseNode* node, void* place) override;
+    virtual size_t nodeSize() const override;
+    virtual size_t objectSize() const override;
+
+    static IntervalNode<Point, Value>* asInterval(const Node<Interval<Point>, Value>* node);
+    static Point subtreeMax(const IntervalNode<Point, Value>* node);
+    void updateMaxToRoot(BaseNode* node);
+
+    BaseNode* removedParent_ = nullptr;  // set by nodeDestroyed() during remove()
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the AVLIntervalTree class.
+  ----------------------------------------------------
+*/
+
+/**
+ * Inserts or replaces like AVLTree::insert(), then fixes the maxima above a
+ * new node.
+ */
+template<typename Point, typename Value>
+void AVLIntervalTree<Point, Value>::insert(const std::pair<const Interval<Point>, Value>& new_item) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
+
+    bool created;
+    BaseNode* node = this->findOrCreate(new_item.first, new_item.second, created);
+    if (created)
+        updateMaxToRoot(node->getParent());
+    else
+        node->setValue(new_item.second);
+}
+
+/**
+ * Removes like AVLTree::remove(), then fixes the maxima above the node that
+ * was unlinked.
+ */
+template<typename Point, typename Value>
+void AVLIntervalTree<Point, Value>::remove(const Interval<Point>& key) {
+    removedParent_ = nullptr;
+    AVLTree<Interval<Point>, Value>::remove(key);
+    updateMaxToRoot(removedParent_);
+    removedParent_ = nullptr;
+}
+
+/**
+ * Every interval that shares at least one point with [low, high], in tree
+ * order. Subtrees whose largest high is below low are skipped, and so are
+ * right subtrees once the intervals start after high.
+ */
+template<typename Point, typename Value>
+std::vector<typename AVLIntervalTree<Point, Value>::iterator>
+AVLIntervalTree<Point, Value>::overlapping(const Point& low, const Point& high) const {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    std::vector<iterator> result;
+    std::vector<IntervalNode<Point, Value>*> stack;
+    IntervalNode<Point, Value>* curr = asInterval(this->root_);
+
+    // in-order walk that only descends into subtrees that can overlap
+    while (curr != nullptr || !stack.empty()) {
+        while (curr != nullptr && !(curr->getMaxHigh() < low)) {
+            this->stats_.visit();
+            stack.push_back(curr);
+            curr = asInterval(curr->getLeft());
+        }
+        if (stack.empty())
+            break;
+        curr = stack.back();
+        stack.pop_back();
+        if (high < curr->getKey().low)
+            break;  // this node and everything after it start too late
+        if (curr->getKey().overlaps(low, high))
+            result.push_back(this->iteratorAt(curr));
+        curr = asInterval(curr->getRight());
+    }
+    return result;
+}
+
+/**
+ * Every interval that contains point.
+ */
+template<typename Point, typename Value>
+std::vector<typename AVLIntervalTree<Point, Value>::iterator>
+AVLIntervalTree<Point, Value>::stabbing(const Point& point) const {
+    return overlapping(point, point);
+}
+
+/**
+ * Recomputes the height and the subtree maximum.
+ */
+template<typename Point, typename Value>
+void AVLIntervalTree<Point, Value>::updateHeight(BaseNode* node) {
+    AVLTree<Interval<Point>, Value>::updateHeight(node);
+    IntervalNode<Point, Value>* interval = asInterval(node);
+    interval->setMaxHigh(subtreeMax(interval));
+}
+
+/**
+ * The maximum belongs to the position, like the height, so it is swapped
+ * along with it.
+ */
+template<typename Point, typename Value>
+void AVLIntervalTree<Point, Value>::nodeSwap(BaseNode* n1, BaseNode* n2) {
+    AVLTree<Interval<Point>, Value>::nodeSwap(n1, n2);
+    Point tempMax = asInterval(n1)->getMaxHigh();
+    asInterval(n1)->setMaxHigh(asInterval(n2)->getMaxHigh());
+    asInterval(n2)->setMaxHigh(tempMax);
+}
+
+template<typename Point, typename Value>
+void AVLIntervalTree<Point, Value>::nodeDestroyed(Node<Interval<Point>, Value>* node) {
+    removedParent_ = static_cast<BaseNode*>(node->getParent());
+}
+
+/**
+ * On top of AVLTree's checks, the stored maximum must be the largest high
+ * in the subtree.
+ */
+template<typename Point, typename Value>
+bool AVLIntervalTree<Point, Value>::validateNode(const Node<Interval<Point>, Value>* node, int left_height,
+                                                 int right_height, std::string* violation) const {
+    if (!AVLTree<Interval<Point>, Value>::validateNode(node, left_height, right_height, violation))
+        return false;
+    const IntervalNode<Point, Value>* interval = asInterval(node);
+    Point expected = subtreeMax(interval);
+    if (expected < interval->getMaxHigh() || interval->getMaxHigh() < expected) {
+        this->reportViolation(node, "stored maximum does not match the subtree", violation);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Allocates an interval node, counting it like BinarySearchTree::createNode().
+ */
+template<typename Point, typename Value>
+typename AVLIntervalTree<Point, Value>::BaseNode*
+AVLIntervalTree<Point, Value>::createNode(const Interval<Point>& key, const Value& value, BaseNode* parent) {
+    IntervalNode<Point, Value>* node = new IntervalNode<Point, Value>(key, value, parent);
+    this->adoptNode(node);
+    return node;
+}
+
+/**
+ * Moves an interval node, maximum included, for relayout().
+ */
+template<typename Point, typename Value>
+typename AVLIntervalTree<Point, Value>::BaseNode* AVLIntervalTree<Point, Value>::relocateNode(BaseNode* node,
+                                                                                              void* place) {
+    return new (place) IntervalNode<Point, Value>(std::move(*asInterval(node)));
+}
+
+template<typename Point, typename Value>
+size_t AVLIntervalTree<Point, Value>::nodeSize() const {
+    return sizeof(IntervalNode<Point, Value>);
+}
+
+template<typename Point, typename Value>
+size_t AVLIntervalTree<Point, Value>::objectSize() const {
+    return sizeof(*this);
+}
+
+template<typename Point, typename Value>
+IntervalNode<Point, Value>* AVLIntervalTree<Point, Value>::asInterval(const Node<Interval<Point>, Value>* node) {
+    return static_cast<IntervalNode<Point, Value>*>(const_cast<Node<Interval<Point>, Value>*>(node));
+}
+
+/**
+ * The largest of node's own high and its children's stored maxima.
+ */
+template<typename Point, typename Value>
+Point AVLIntervalTree<Point, Value>::subtreeMax(const IntervalNode<Point, Value>* node) {
+    const Point* result = &node->getKey().high;
+    const IntervalNode<Point, Value>* children[2] = {asInterval(node->getLeft()), asInterval(node->getRight())};
+    for (const IntervalNode<Point, Value>* child : children) {
+        if (child != nullptr && *result < child->getMaxHigh())
+            result = &child->getMaxHigh();
+    }
+    return *result;
+}
+
+/**
+ * Recomputes the maximum of node and each of its ancestors.
+ */
+template<typename Point, typename Value>
+void AVLIntervalTree<Point, Value>::updateMaxToRoot(BaseNode* node) {
+    for (; node != nullptr; node = node->getParent()) {
+        IntervalNode<Point, Value>* interval = asInterval(node);
+        interval->setMaxHigh(subtreeMax(interval));
+    }
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the AVLIntervalTree class.
+  --------------------------------------------------
+*/
+
+#endif
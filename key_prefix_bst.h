@@ -0,0 +1,90 @@
+#include <cstdint>
+#include <string>
+
+#ifndef KEY_PREFIX_BST_H
+#define KEY_PREFIX_BST_H
+
+// Inline key prefixes
+// Version 1
+//
+// Comparing two std::string keys reads both heap buffers, so every level of
+// a descent through a tree of long string keys costs a cache miss for the
+// node and another for its key. For such keys each node also stores the
+// first KEY_PREFIX_BYTES bytes of its key packed big-endian into an integer,
+// next to the node header. Descents pack the probe key once and compare the
+// integers; only when they are equal is the full key read. Integer order is
+// byte order because unused low bytes are zero, so shorter keys sort first,
+// and equal prefixes prove nothing, so ties always fall back to the key.
+//
+// Keys that share a long common prefix (URLs, paths) gain nothing, since
+// every prefix comparison ties. Other key types store nothing: the prefix
+// holder is an empty base there. Specialize KeyPrefix for other key types
+// whose order an integer prefix can capture.
+
+#define KEY_PREFIX_BYTES 8
+
+/**
+ * Placeholder prefix for keys without one.
+ */
+struct NoKeyPrefix {};
+
+/**
+ * The prefix trait: enabled, the prefix Type, and of(key) to compute it.
+ * The default has no prefix.
+ */
+template<typename Key>
+struct KeyPrefix {
+    static const bool enabled = false;
+    typedef NoKeyPrefix Type;
+
+    static Type of(const Key& /* key */) {
+        return Type();
+    }
+};
+
+/**
+ * std::string with the default traits, which order by unsigned bytes like
+ * memcmp, the same order as the packed integers.
+ */
+template<typename Alloc>
+struct KeyPrefix<std::basic_string<char, std::char_traits<char>, Alloc>> {
+    static const bool enabled = true;
+    typedef uint64_t Type;
+
+    static Type of(const std::basic_string<char, std::char_traits<char>, Alloc>& key) {
+        size_t n = key.size() < KEY_PREFIX_BYTES ? key.size() : KEY_PREFIX_BYTES;
+        uint64_t prefix = 0;
+        for (size_t i = 0; i < n; ++i) {
+            prefix |= (uint64_t)(unsigned char)key[i] << (56 - 8 * i);
+        }
+        return prefix;
+    }
+};
+
+/**
+ * The base of Node that holds the prefix, empty when the key has none.
+ */
+template<typename Key, bool = KeyPrefix<Key>::enabled>
+class KeyPrefixHolder {
+public:
+    explicit KeyPrefixHolder(const Key& /* key */) {}
+
+    typename KeyPrefix<Key>::Type getKeyPrefix() const {
+        return typename KeyPrefix<Key>::Type();
+    }
+};
+
+template<typename Key>
+class KeyPrefixHolder<Key, true> {
+public:
+    explicit KeyPrefixHolder(const Key& key) : prefix_(KeyPrefix<Key>::of(key)) {}
+
+    typename KeyPrefix<Key>::Type getKeyPrefix() const {
+        return prefix_;
+    }
+
+private:
+    typename KeyPrefix<Key>::Type prefix_;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#ifndef LOOKUP_CACHE_BST_H
+#define LOOKUP_CACHE_BST_H
+
+// BST lookup cache
+// Version 1
+//
+// An optional cache of key -> node that find() consults before walking the
+// tree, for workloads where a few hot keys take most of the lookups. It is
+// off until setLookupCacheSize() is called with a non-zero size, and then
+// costs a hash and at most two key comparisons per find.
+//
+// The cache is set associative with LOOKUP_CACHE_WAYS ways per set, most
+// recently used first, and new nodes go in last. It holds node pointers only, and only for keys that
+// were found: a miss never caches absence, so inserts need no invalidation.
+// Every node destroyed (remove, clear, loading a snapshot) and both nodes of
+// a nodeSwap() are dropped from it. Like the stats, it is updated by const
+// find() and so is not thread safe.
+//
+// Keys need a std::hash specialization to enable it.
+
+#define LOOKUP_CACHE_WAYS 2
+
+template<typename Key, typename Value>
+class Node;
+
+/**
+ * Lookup cache counters, as returned by BinarySearchTree::lookupCacheStats().
+ */
+struct LookupCacheStats {
+    size_t entries;  // capacity, 0 when disabled
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+
+    double hitRate() const {
+        return hits + misses == 0 ? 0.0 : (double)hits / (hits + misses);
+    }
+};
+
+/**
+ * Writes the counters one per line as "avlbst_<name> <value>", like the
+ * operation counters in stats_bst.h.
+ */
+inline std::ostream& operator<<(std::ostream& out, const LookupCacheStats& s) {
+    out << "avlbst_cache_entries " << s.entries << "\n"
+        << "avlbst_cache_hits " << s.hits << "\n"
+        << "avlbst_cache_misses " << s.misses << "\n"
+        << "avlbst_cache_invalidations " << s.invalidations << "\n"
+        << "avlbst_cache_hit_rate " << s.hitRate() << "\n";
+    return out;
+}
+
+/**
+ * The cache itself, a member of every BinarySearchTree.
+ */
+template<typename Key, typename Value>
+class LookupCache {
+public:
+    static const bool hashable = std::is_default_constructible<std::hash<Key>>::value;
+
+    LookupCache() : shift_(64), hits_(0), misses_(0), invalidations_(0) {}
+
+    bool enabled() const {
+        return !sets_.empty();
+    }
+
+    // Rounds entries up to a power of two (at least one set) and empties the
+    // cache; 0 turns it off and frees it.
+    void resize(size_t entries) {
+        if (entries != 0 && !hashable)
+            throw std::invalid_argument("lookup cache needs a std::hash for the key type");
+        std::vector<Set>().swap(sets_);
+        shift_ = 64;
+        if (entries == 0)
+            return;
+        size_t sets = 1;
+        int bits = 0;
+        while (sets * LOOKUP_CACHE_WAYS < entries) {
+            sets <<= 1;
+            bits++;
+        }
+        sets_.assign(sets, Set());
+        shift_ = 64 - bits;
+    }
+
+    // Returns the cached node for key, or nullptr, counting a hit or a miss.
+    Node<Key, Value>* lookup(const Key& key) {
+        Set& set = sets_[index(key)];
+        for (int way = 0; way < LOOKUP_CACHE_WAYS; ++way) {
+            Node<Key, Value>* node = set.ways[way];
+            if (node != nullptr && !(key < node->getKey()) && !(node->getKey() < key)) {
+                for (; way > 0; --way) {
+                    set.ways[way] = set.ways[way - 1];
+                }
+                set.ways[0] = node;
+                hits_++;
+                return node;
+            }
+        }
+        misses_++;
+        return nullptr;
+    }
+
+    // Caches a node just found by walking the tree. It replaces the least
+    // recently used way and stays there until it is hit, so a run of cold
+    // keys through a set cannot push out a hot one.
+    void fill(Node<Key, Value>* node) {
+        sets_[index(node->getKey())].ways[LOOKUP_CACHE_WAYS - 1] = node;
+    }
+
+    void erase(const Node<Key, Value>* node) {
+        Set& set = sets_[index(node->getKey())];
+        for (int way = 0; way < LOOKUP_CACHE_WAYS; ++way) {
+            if (set.ways[way] == node) {
+                set.ways[way] = nullptr;
+                invalidations_++;
+            }
+        }
+    }
+
+    // Drops every entry, for when the whole tree is cleared at once.
+    void clear() {
+        std::fill(sets_.begin(), sets_.end(), Set());
+    }
+
+    LookupCacheStats stats() const {
+        LookupCacheStats s;
+        s.entries = sets_.size() * LOOKUP_CACHE_WAYS;
+        s.hits = hits_;
+        s.misses = misses_;
+        s.invalidations = invalidations_;
+        return s;
+    }
+
+    // The size of the one heap block holding the sets, 0 when disabled.
+    size_t heapBytes() const {
+        return sets_.capacity() * sizeof(Set);
+    }
+
+    void resetStats() {
+        hits_ = misses_ = invalidations_ = 0;
+    }
+
+private:
+    struct Set {
+        Node<Key, Value>* ways[LOOKUP_CACHE_WAYS] = {};
+    };
+
+    // Fibonacci hashing on top of std::hash, which is the identity for
+    // integers; the top bits pick the set.
+    size_t index(const Key& key) const {
+        if (shift_ >= 64)
+            return 0;
+        if constexpr (hashable) {
+            uint64_t h = (uint64_t)std::hash<Key>()(key) * 0x9e3779b97f4a7c15ull;
+            return (size_t)(h >> shift_);
+        } else {
+            return 0;
+        }
+    }
+
+    std::vector<Set> sets_;
+    int shift_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t invalidations_;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifndef MEMORY_BST_H
+#define MEMORY_BST_H
+
+// BST memory accounting
+// Version 1
+//
+// memoryUsage() adds up what a tree costs on the heap without walking it,
+// unless the keys or values own heap memory of their own:
+//
+//   nodeBytes          size() * sizeof(node)
+//   allocatorOverhead  the malloc chunk header and rounding on every node,
+//                      modelled on glibc's allocator for 64-bit targets:
+//                      an 8-byte header, 16-byte alignment, 32-byte minimum
+//                      (for nodes placed in slabs by relayout(), the slab
+//                      slots left empty by removals instead)
+//   payloadBytes       heap memory owned by keys and values (e.g. long
+//                      std::string contents) including their own chunk
+//                      overhead, as estimated by HeapFootprint
+//   objectBytes        the tree object itself, with its lookup cache and
+//                      membership filter if any
+//
+// Specialize HeapFootprint for key/value types that own heap memory and are
+// not covered below; the default assumes they own none.
+
+#define MALLOC_CHUNK_HEADER 8
+#define MALLOC_CHUNK_ALIGN 16
+#define MALLOC_MIN_CHUNK 32
+
+/**
+ * Where the bytes of a tree go, as returned by BinarySearchTree::memoryUsage().
+ */
+struct MemoryUsage {
+    size_t nodes;
+    size_t nodeBytes;
+    size_t allocatorOverhead;
+    size_t payloadBytes;
+    size_t objectBytes;
+
+    size_t total() const {
+        return nodeBytes + allocatorOverhead + payloadBytes + objectBytes;
+    }
+};
+
+// The size of the chunk malloc hands out for a request of the given size.
+inline size_t mallocChunkSize(size_t request) {
+    size_t chunk = (request + MALLOC_CHUNK_HEADER + MALLOC_CHUNK_ALIGN - 1) & ~(size_t)(MALLOC_CHUNK_ALIGN - 1);
+    return chunk < MALLOC_MIN_CHUNK ? MALLOC_MIN_CHUNK : chunk;
+}
+
+/**
+ * Estimates the heap memory owned by one key or value, not counting the
+ * object itself. owns tells memoryUsage() whether it needs to visit every
+ * node at all.
+ */
+template<typename T, typename Enable = void>
+struct HeapFootprint {
+    static const bool owns = false;
+
+    static size_t bytes(const T& /* item */) {
+        return 0;
+    }
+};
+
+/**
+ * Strings own a buffer unless their contents fit in the object itself (the
+ * short string optimization), which shows as data() pointing inside it.
+ */
+template<typename Char, typename Traits, typename Alloc>
+struct HeapFootprint<std::basic_string<Char, Traits, Alloc>> {
+    static const bool owns = true;
+
+    static size_t bytes(const std::basic_string<Char, Traits, Alloc>& item) {
+        const char* data = reinterpret_cast<const char*>(item.data());
+        const char* self = reinterpret_cast<const char*>(&item);
+        if (data >= self && data < self + sizeof(item))
+            return 0;
+        return mallocChunkSize((item.capacity() + 1) * sizeof(Char));
+    }
+};
+
+/**
+ * Vectors own their capacity, plus whatever their elements own.
+ */
+template<typename T, typename Alloc>
+struct HeapFootprint<std::vector<T, Alloc>> {
+    static const bool owns = true;
+
+    static size_t bytes(const std::vector<T, Alloc>& item) {
+        if (item.capacity() == 0)
+            return 0;
+        size_t total = mallocChunkSize(item.capacity() * sizeof(T));
+        if (HeapFootprint<T>::owns) {
+            for (size_t i = 0; i < item.size(); ++i) {
+                total += HeapFootprint<T>::bytes(item[i]);
+            }
+        }
+        return total;
+    }
+};
+
+/**
+ * Returns the number of entries in the tree, in O(1).
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::size() const {
+    return size_;
+}
+
+/**
+ * Breaks down the heap memory the tree uses. O(1) unless the keys or values
+ * own heap memory, in which case it walks the tree once to add that up.
+ */
+template<typename Key, typename Value>
+MemoryUsage BinarySearchTree<Key, Value>::memoryUsage() const {
+    MemoryUsage usage;
+    size_t node_size = nodeSize();
+    usage.nodes = size_;
+    usage.nodeBytes = size_ * node_size;
+    usage.allocatorOverhead = (size_ - slabs_.live()) * (mallocChunkSize(node_size) - node_size);
+    if (!slabs_.empty())
+        usage.allocatorOverhead += slabs_.bytes() - slabs_.live() * node_size;
+    usage.payloadBytes = 0;
+    usage.objectBytes = objectSize();
+    if (cache_.heapBytes() != 0)
+        usage.objectBytes += mallocChunkSize(cache_.heapBytes());
+    if (filter_.heapBytes() != 0)
+        usage.objectBytes += mallocChunkSize(filter_.heapBytes());
+
+    if (HeapFootprint<Key>::owns || HeapFootprint<Value>::owns) {
+        for (iterator it = begin(); it != end(); ++it) {
+            usage.payloadBytes += HeapFootprint<Key>::bytes(it->first) + HeapFootprint<Value>::bytes(it->second);
+        }
+    }
+    return usage;
+}
+
+/**
+ * The size of one node as allocated by createNode(); subclasses with
+ * bigger nodes override it.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::nodeSize() const {
+    return sizeof(Node<Key, Value>);
+}
+
+/**
+ * The size of the tree object itself; subclasses override it so that their
+ * own members are counted.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::objectSize() const {
+    return sizeof(*this);
+}
+
+#endif
@@ -0,0 +1,398 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "offset_avlbst.h"
+
+#ifndef MMAP_AVLBST_H
+#define MMAP_AVLBST_H
+
+// Memory-mapped AVL tree file format
+// Version 1
+//
+// The file is a header page followed by an arena of fixed-size node slots.
+// Node references are byte offsets from the start of the file, so the file
+// can be mapped at any address, by any number of processes. Offset 0 falls
+// inside the header and doubles as the null reference.
+//
+// Opening a file maps it and checks the header; nothing is read or rebuilt,
+// and node pages only fault in once a lookup touches them.
+
+#define MAPPED_MAGIC 0x4d4c5641u  // "AVLM"
+#define MAPPED_VERSION 1u
+#define MAPPED_BYTE_ORDER 0x01020304u
+#define MAPPED_HEADER_SIZE 4096
+#define MAPPED_MIN_CAPACITY (1 << 20)
+
+/**
+ * Thrown when a mapped tree file cannot be opened, grown or synced, when its
+ * header does not match the tree's key/value types, or on a write to a tree
+ * that was opened read-only.
+ */
+struct MappedFileError : public std::runtime_error {
+    explicit MappedFileError(const std::string& what) : std::runtime_error(what) {}
+};
+
+/**
+ * The header at offset 0 of a mapped tree file.
+ */
+struct MappedHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeSize;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t root;
+    uint64_t count;
+    uint64_t freeList;  // offset of the first free slot; each free slot stores the next one
+    uint64_t used;      // end of the part of the arena that has ever been handed out
+    uint64_t capacity;  // current file size
+};
+
+/**
+ * OffsetAVLTree storage that carves nodes out of a shared file mapping.
+ * Freed slots are kept on a free list threaded through the slots themselves.
+ * The file grows by doubling; on Linux the mapping is extended with mremap(),
+ * which may move it, so node pointers do not survive allocate(). An arena
+ * owns its descriptor and mapping and cannot be copied.
+ */
+template<typename Key, typename Value>
+class MappedArena {
+public:
+    typedef OffsetAVLNode<Key, Value> NodeType;
+
+    MappedArena();
+    MappedArena(const MappedArena&) = delete;
+    MappedArena& operator=(const MappedArena&) = delete;
+    ~MappedArena();
+
+    void open(const std::string& path, bool readOnly);
+    void close();
+    void sync();
+
+    const NodeType* read(uint64_t ref) const;
+    NodeType* write(uint64_t ref) const;
+    uint64_t allocate(uint64_t near);
+    void release(uint64_t ref);
+    uint64_t root() const;
+    void setRoot(uint64_t root);
+    uint64_t count() const;
+    void setCount(uint64_t count);
+    void reset();
+    void checkWritable() const;
+
+private:
+    MappedHeader* header() const;
+    void map(size_t length);
+    void grow();
+
+    static const uint64_t slotSize
+            = (sizeof(NodeType) + alignof(NodeType) - 1) / alignof(NodeType) * alignof(NodeType);
+
+    int fd_;
+    char* base_;
+    size_t mapped_;
+    bool readOnly_;
+};
+
+/**
+ * An AVL tree that lives in a memory-mapped file. Opening an existing file is
+ * an O(1) mmap with no deserialization, and changes are written back by the
+ * kernel (call sync() to force them to disk).
+ *
+ * Several processes may map the same file. Only one of them may modify it,
+ * and readers should open it read-only and reopen it after the writer has
+ * grown the file, since their mapping does not follow the new size.
+ */
+template<typename Key, typename Value>
+class MappedAVLTree : public OffsetAVLTree<Key, Value, MappedArena<Key, Value>> {
+public:
+    MappedAVLTree(const std::string& path, bool readOnly = false);
+
+    void sync();
+    void close();
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the MappedArena class.
+  ------------------------------------------------
+*/
+
+/**
+ * Default constructor, which leaves the arena unmapped until open().
+ */
+template<typename Key, typename Value>
+MappedArena<Key, Value>::MappedArena() : fd_(-1), base_(nullptr), mapped_(0), readOnly_(true) {}
+
+/**
+ * Destructor, which unmaps the file. Dirty pages are still written back by
+ * the kernel; call sync() first to wait for that.
+ */
+template<typename Key, typename Value>
+MappedArena<Key, Value>::~MappedArena() {
+    close();
+}
+
+/**
+ * Opens (or, unless readOnly, creates) the tree file at path and maps all of it.
+ */
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::open(const std::string& path, bool readOnly) {
+    close();
+    readOnly_ = readOnly;
+
+    fd_ = ::open(path.c_str(), readOnly ? O_RDONLY : (O_RDWR | O_CREAT), 0644);
+    if (fd_ < 0) {
+        throw MappedFileError("mmap: cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        int err = errno;
+        close();
+        throw MappedFileError("mmap: cannot stat " + path + ": " + std::strerror(err));
+    }
+
+    bool fresh = st.st_size == 0;
+    if (fresh) {
+        if (readOnly) {
+            close();
+            throw MappedFileError("mmap: " + path + " is empty");
+        }
+        if (ftruncate(fd_, MAPPED_MIN_CAPACITY) != 0) {
+            int err = errno;
+            close();
+            throw MappedFileError("mmap: cannot size " + path + ": " + std::strerror(err));
+        }
+        st.st_size = MAPPED_MIN_CAPACITY;
+    } else if ((size_t)st.st_size < MAPPED_HEADER_SIZE) {
+        close();
+        throw MappedFileError("mmap: " + path + " is too short");
+    }
+
+    map(st.st_size);
+
+    MappedHeader* h = header();
+    if (fresh) {
+        h->magic = MAPPED_MAGIC;
+        h->version = MAPPED_VERSION;
+        h->byteOrder = MAPPED_BYTE_ORDER;
+        h->nodeSize = sizeof(NodeType);
+        h->keySize = sizeof(Key);
+        h->valueSize = sizeof(Value);
+        h->root = 0;
+        h->count = 0;
+        h->freeList = 0;
+        h->used = MAPPED_HEADER_SIZE;
+        h->capacity = MAPPED_MIN_CAPACITY;
+        return;
+    }
+
+    const char* problem = nullptr;
+    if (h->magic != MAPPED_MAGIC)
+        problem = "bad magic";
+    else if (h->version != MAPPED_VERSION)
+        problem = "unsupported version";
+    else if (h->byteOrder != MAPPED_BYTE_ORDER)
+        problem = "written with a different byte order";
+    else if (h->nodeSize != sizeof(NodeType) || h->keySize != sizeof(Key) || h->valueSize != sizeof(Value))
+        problem = "key/value types do not match";
+    else if (h->capacity > (uint64_t)st.st_size || h->used > h->capacity)
+        problem = "truncated file";
+    if (problem != nullptr) {
+        close();
+        throw MappedFileError("mmap: " + path + ": " + problem);
+    }
+}
+
+/**
+ * Unmaps and closes the file, if one is open.
+ */
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::close() {
+    if (base_ != nullptr) {
+        munmap(base_, mapped_);
+        base_ = nullptr;
+        mapped_ = 0;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+/**
+ * Blocks until every modified page has been written to the file.
+ */
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::sync() {
+    if (base_ != nullptr && !readOnly_ && msync(base_, mapped_, MS_SYNC) != 0) {
+        throw MappedFileError(std::string("mmap: msync failed: ") + std::strerror(errno));
+    }
+}
+
+template<typename Key, typename Value>
+const OffsetAVLNode<Key, Value>* MappedArena<Key, Value>::read(uint64_t ref) const {
+    return reinterpret_cast<const OffsetAVLNode<Key, Value>*>(base_ + ref);
+}
+
+template<typename Key, typename Value>
+OffsetAVLNode<Key, Value>* MappedArena<Key, Value>::write(uint64_t ref) const {
+    return reinterpret_cast<OffsetAVLNode<Key, Value>*>(base_ + ref);
+}
+
+/**
+ * Returns the offset of a free slot, reusing released slots first. The hint
+ * is ignored: the arena has no notion of locality beyond allocation order.
+ */
+template<typename Key, typename Value>
+uint64_t MappedArena<Key, Value>::allocate(uint64_t /* near */) {
+    MappedHeader* h = header();
+    if (h->freeList != 0) {
+        uint64_t ref = h->freeList;
+        std::memcpy(&h->freeList, base_ + ref, sizeof(uint64_t));
+        return ref;
+    }
+
+    if (h->used + slotSize > h->capacity) {
+        grow();
+        h = header();
+    }
+    uint64_t ref = h->used;
+    h->used += slotSize;
+    return ref;
+}
+
+/**
+ * Puts a slot on the free list.
+ */
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::release(uint64_t ref) {
+    MappedHeader* h = header();
+    std::memcpy(base_ + ref, &h->freeList, sizeof(uint64_t));
+    h->freeList = ref;
+}
+
+template<typename Key, typename Value>
+uint64_t MappedArena<Key, Value>::root() const {
+    return header()->root;
+}
+
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::setRoot(uint64_t root) {
+    header()->root = root;
+}
+
+template<typename Key, typename Value>
+uint64_t MappedArena<Key, Value>::count() const {
+    return header()->count;
+}
+
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::setCount(uint64_t count) {
+    header()->count = count;
+}
+
+/**
+ * Forgets every node. The file keeps its size; the slots get reused.
+ */
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::reset() {
+    MappedHeader* h = header();
+    h->root = 0;
+    h->count = 0;
+    h->freeList = 0;
+    h->used = MAPPED_HEADER_SIZE;
+}
+
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::checkWritable() const {
+    if (readOnly_) {
+        throw MappedFileError("mmap: tree was opened read-only");
+    }
+}
+
+template<typename Key, typename Value>
+MappedHeader* MappedArena<Key, Value>::header() const {
+    return reinterpret_cast<MappedHeader*>(base_);
+}
+
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::map(size_t length) {
+    int prot = readOnly_ ? PROT_READ : (PROT_READ | PROT_WRITE);
+    void* addr = mmap(nullptr, length, prot, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        close();
+        throw MappedFileError(std::string("mmap: mmap failed: ") + std::strerror(err));
+    }
+    base_ = static_cast<char*>(addr);
+    mapped_ = length;
+}
+
+/**
+ * Doubles the file and the mapping.
+ */
+template<typename Key, typename Value>
+void MappedArena<Key, Value>::grow() {
+    uint64_t capacity = header()->capacity * 2;
+    if (ftruncate(fd_, capacity) != 0) {
+        throw MappedFileError(std::string("mmap: cannot grow file: ") + std::strerror(errno));
+    }
+
+#ifdef MREMAP_MAYMOVE
+    void* addr = mremap(base_, mapped_, capacity, MREMAP_MAYMOVE);
+    if (addr == MAP_FAILED) {
+        throw MappedFileError(std::string("mmap: mremap failed: ") + std::strerror(errno));
+    }
+    base_ = static_cast<char*>(addr);
+    mapped_ = capacity;
+#else
+    munmap(base_, mapped_);
+    base_ = nullptr;
+    map(capacity);
+#endif
+    header()->capacity = capacity;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the MappedArena class.
+  ----------------------------------------------
+*/
+
+/**
+ * Opens the tree stored at path, creating an empty one if the file does not
+ * exist (unless readOnly).
+ */
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>::MappedAVLTree(const std::string& path, bool readOnly) {
+    this->storage_.open(path, readOnly);
+}
+
+/**
+ * Forces all changes out to the file.
+ */
+template<typename Key, typename Value>
+void MappedAVLTree<Key, Value>::sync() {
+    this->storage_.sync();
+}
+
+/**
+ * Unmaps the file. The tree must not be used afterwards.
+ */
+template<typename Key, typename Value>
+void MappedAVLTree<Key, Value>::close() {
+    this->storage_.close();
+}
+
+#endif
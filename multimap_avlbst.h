@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#ifndef MULTIMAP_AVLBST_H
+#define MULTIMAP_AVLBST_H
+
+#include "avlbst.h"
+
+// AVL multimap
+// Version 1
+//
+// AVLMultiMap keeps every value inserted under a key, in insertion order,
+// in one node per distinct key. The values live in a ValueList: the first
+// few sit inline in the node (MULTIMAP_INLINE_BYTES worth, at least one),
+// and only a key with more than that spills them to a heap array that grows
+// by doubling. Compared with AVLTree<Key, std::vector<Value>>, keys with few
+// values cost no allocation beyond the node, and the node is no bigger.
+//
+// Inserting a value, or a batch of values, for a key descends the tree once
+// whether or not the key is new. remove(key) drops the key with all its
+// values. size() counts distinct keys and valueCount() counts values.
+
+#define MULTIMAP_INLINE_BYTES 16
+
+/**
+ * The values of one key: inline up to inlineCapacity, then on the heap.
+ */
+template<typename Value>
+class ValueList {
+public:
+    static const size_t inlineCapacity =
+            sizeof(Value) >= MULTIMAP_INLINE_BYTES ? 1 : MULTIMAP_INLINE_BYTES / sizeof(Value);
+
+    ValueList();
+    ValueList(const ValueList& other);
+    ValueList(ValueList&& other);
+    ValueList& operator=(const ValueList& other);
+    ValueList& operator=(ValueList&& other);
+    ~ValueList();
+
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    bool spilled() const {
+        return capacity_ > inlineCapacity;
+    }
+    Value* begin() {
+        return data();
+    }
+    Value* end() {
+        return data() + size_;
+    }
+    const Value* begin() const {
+        return data();
+    }
+    const Value* end() const {
+        return data() + size_;
+    }
+    Value& operator[](size_t i) {
+        return data()[i];
+    }
+    const Value& operator[](size_t i) const {
+        return data()[i];
+    }
+
+    void push_back(const Value& value);
+    template<typename InputIt>
+    void append(InputIt first, InputIt last);
+    void reserve(size_t capacity);
+
+    // The heap array's size, 0 while the values are inline.
+    size_t heapBytes() const {
+        return spilled() ? capacity_ * sizeof(Value) : 0;
+    }
+
+private:
+    size_t grownCapacity(size_t needed) const;
+
+    Value* data() {
+        return spilled() ? storage_.heap : reinterpret_cast<Value*>(&storage_.local);
+    }
+    const Value* data() const {
+        return spilled() ? storage_.heap : reinterpret_cast<const Value*>(&storage_.local);
+    }
+
+    union Storage {
+        typename std::aligned_storage<sizeof(Value) * inlineCapacity, alignof(Value)>::type local;
+        Value* heap;
+    } storage_;
+    uint32_t size_;
+    uint32_t capacity_;  // inlineCapacity while inline
+};
+
+/**
+ * An AVLTree from each key to all the values inserted under it.
+ */
+template<typename Key, typename Value>
+class AVLMultiMap : public AVLTree<Key, ValueList<Value>> {
+public:
+    typedef typename AVLTree<Key, ValueList<Value>>::iterator iterator;
+
+    AVLMultiMap();
+
+    virtual void insert(const std::pair<const Key, ValueList<Value>>& item) override;
+    void insert(const Key& key, const Value& value);
+    template<typename InputIt>
+    void insert(const Key& key, InputIt first, InputIt last);
+
+    size_t count(const Key& key) const;
+    std::pair<Value*, Value*> equalRange(const Key& key);
+    std::pair<const Value*, const Value*> equalRange(const Key& key) const;
+    size_t valueCount() const;
+
+protected:
+    virtual void nodeCreated(Node<Key, ValueList<Value>>* node) override;
+    virtual void nodeDestroyed(Node<Key, ValueList<Value>>* node) override;
+    virtual void nodesReleased() override;
+
+    size_t values_;
+};
+
+/**
+ * Writes the values as "[a, b, c]", for print().
+ */
+template<typename Value>
+std::ostream& operator<<(std::ostream& out, const ValueList<Value>& values) {
+    out << '[';
+    for (size_t i = 0; i < values.size(); ++i) {
+        out << (i == 0 ? "" : ", ") << values[i];
+    }
+    return out << ']';
+}
+
+/**
+ * Value lists own a heap array once they spill.
+ */
+template<typename Value>
+struct HeapFootprint<ValueList<Value>> {
+    static const bool owns = true;
+
+    static size_t bytes(const ValueList<Value>& item) {
+        size_t total = item.heapBytes() == 0 ? 0 : mallocChunkSize(item.heapBytes());
+        if (HeapFootprint<Value>::owns) {
+            for (size_t i = 0; i < item.size(); ++i) {
+                total += HeapFootprint<Value>::bytes(item[i]);
+            }
+        }
+        return total;
+    }
+};
+
+/**
+ * Value lists are stored as a 64-bit count followed by the values.
+ */
+template<typename Value>
+struct SnapshotCodec<ValueList<Value>> {
+    static void write(SnapshotWriter& out, const ValueList<Value>& item) {
+        uint64_t count = item.size();
+        out.write(&count, sizeof(count));
+        for (size_t i = 0; i < item.size(); ++i) {
+            SnapshotCodec<Value>::write(out, item[i]);
+        }
+    }
+
+    // the count is not trusted before the checksum is, so the list grows
+    // with the values actually read
+    static ValueList<Value> read(SnapshotReader& in) {
+        uint64_t count;
+        in.read(&count, sizeof(count));
+        if (count > UINT32_MAX) {
+            throw SnapshotError("snapshot: value list too long");
+        }
+        ValueList<Value> item;
+        item.reserve((size_t)std::min(count, (uint64_t)SNAPSHOT_BLOCK_NODES));
+        for (uint64_t i = 0; i < count; ++i) {
+            item.push_back(SnapshotCodec<Value>::read(in));
+        }
+        return item;
+    }
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the ValueList class.
+  ----------------------------------------------
+*/
+
+template<typename Value>
+ValueList<Value>::ValueList() : size_(0), capacity_(inlineCapacity) {}
+
+template<typename Value>
+ValueList<Value>::ValueList(const ValueList& other) : size_(0), capacity_(inlineCapacity) {
+    reserve(other.size_);
+    append(other.begin(), other.end());
+}
+
+/**
+ * Takes over other's heap array, or moves its inline values one by one.
+ */
+template<typename Value>
+ValueList<Value>::ValueList(ValueList&& other) : size_(0), capacity_(inlineCapacity) {
+    if (other.spilled()) {
+        storage_.heap = other.storage_.heap;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        other.size_ = 0;
+        other.capacity_ = inlineCapacity;
+        return;
+    }
+    for (Value& value : other) {
+        new (end()) Value(std::move(value));
+        size_++;
+    }
+}
+
+template<typename Value>
+ValueList<Value>& ValueList<Value>::operator=(const ValueList& other) {
+    if (this != &other)
+        *this = ValueList(other);
+    return *this;
+}
+
+template<typename Value>
+ValueList<Value>& ValueList<Value>::operator=(ValueList&& other) {
+    if (this != &other) {
+        this->~ValueList();
+        new (this) ValueList(std::move(other));
+    }
+    return *this;
+}
+
+template<typename Value>
+ValueList<Value>::~ValueList() {
+    for (Value& value : *this) {
+        value.~Value();
+    }
+    if (spilled())
+        std::allocator<Value>().deallocate(storage_.heap, capacity_);
+}
+
+/**
+ * Appends a value, spilling to the heap or doubling the heap array when full.
+ * The value may be one of the list's own: it is copied before they move.
+ */
+template<typename Value>
+void ValueList<Value>::push_back(const Value& value) {
+    if (size_ == capacity_) {
+        Value copy(value);
+        reserve(grownCapacity(size_ + 1));
+        new (end()) Value(std::move(copy));
+    } else {
+        new (end()) Value(value);
+    }
+    size_++;
+}
+
+/**
+ * Appends [first, last), growing at most once when the range's length is
+ * known up front. A range out of the list itself is copied first, since
+ * growing would move it.
+ */
+template<typename Value>
+template<typename InputIt>
+void ValueList<Value>::append(InputIt first, InputIt last) {
+    typedef typename std::iterator_traits<InputIt>::iterator_category Category;
+    typedef typename std::remove_cv<typename std::remove_pointer<InputIt>::type>::type Pointee;
+    if constexpr (std::is_pointer<InputIt>::value && std::is_same<Pointee, Value>::value) {
+        std::less<const Value*> less;
+        if (first != last && !less(first, begin()) && less(first, end())) {
+            ValueList<Value> copy;
+            copy.append(first, last);
+            append(copy.begin(), copy.end());
+            return;
+        }
+    }
+    if constexpr (std::is_base_of<std::forward_iterator_tag, Category>::value) {
+        size_t n = (size_t)std::distance(first, last);
+        if (size_ + n > capacity_)
+            reserve(grownCapacity(size_ + n));
+    }
+    for (; first != last; ++first) {
+        push_back(*first);
+    }
+}
+
+/**
+ * Moves the values to a heap array of at least capacity slots; lists never
+ * move back inline. The capacity is counted in 32 bits, so more than
+ * UINT32_MAX slots throw std::length_error.
+ */
+template<typename Value>
+void ValueList<Value>::reserve(size_t capacity) {
+    if (capacity <= capacity_)
+        return;
+    if (capacity > UINT32_MAX)
+        throw std::length_error("value list is too long");
+    Value* heap = std::allocator<Value>().allocate(capacity);
+    Value* from = data();
+    for (uint32_t i = 0; i < size_; ++i) {
+        new (heap + i) Value(std::move(from[i]));
+        from[i].~Value();
+    }
+    if (spilled())
+        std::allocator<Value>().deallocate(storage_.heap, capacity_);
+    storage_.heap = heap;
+    capacity_ = (uint32_t)capacity;
+}
+
+/**
+ * Twice the current capacity, or needed if that is more, but never beyond
+ * what the 32-bit capacity holds unless needed is.
+ */
+template<typename Value>
+size_t ValueList<Value>::grownCapacity(size_t needed) const {
+    return std::max(needed, std::min((size_t)capacity_ * 2, (size_t)UINT32_MAX));
+}
+
+/*
+  --------------------------------------------
+  End implementations for the ValueList class.
+  --------------------------------------------
+*/
+
+/*
+  ------------------------------------------------
+  Begin implementations for the AVLMultiMap class.
+  ------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+AVLMultiMap<Key, Value>::AVLMultiMap() : values_(0) {}
+
+/**
+ * Appends all of item's values under its key, instead of replacing them.
+ */
+template<typename Key, typename Value>
+void AVLMultiMap<Key, Value>::insert(const std::pair<const Key, ValueList<Value>>& item) {
+    insert(item.first, item.second.begin(), item.second.end());
+}
+
+/**
+ * Appends value under key.
+ */
+template<typename Key, typename Value>
+void AVLMultiMap<Key, Value>::insert(const Key& key, const Value& value) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
+    bool created;
+    this->findOrCreate(key, ValueList<Value>(), created)->getValue().push_back(value);
+    values_++;
+}
+
+/**
+ * Appends the values in [first, last) under key, with one descent for all.
+ */
+template<typename Key, typename Value>
+template<typename InputIt>
+void AVLMultiMap<Key, Value>::insert(const Key& key, InputIt first, InputIt last) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
+    bool created;
+    ValueList<Value>& values = this->findOrCreate(key, ValueList<Value>(), created)->getValue();
+    size_t before = values.size();
+    values.append(first, last);
+    values_ += values.size() - before;
+}
+
+/**
+ * The number of values under key.
+ */
+template<typename Key, typename Value>
+size_t AVLMultiMap<Key, Value>::count(const Key& key) const {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    Node<Key, ValueList<Value>>* node = this->internalFind(key);
+    return node == nullptr ? 0 : node->getValue().size();
+}
+
+/**
+ * The values under key as a [begin, end) range in insertion order, empty
+ * if the key is absent. The range stays valid until values are added under
+ * the same key or the key is removed.
+ */
+template<typename Key, typename Value>
+std::pair<Value*, Value*> AVLMultiMap<Key, Value>::equalRange(const Key& key) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    Node<Key, ValueList<Value>>* node = this->internalFind(key);
+    if (node == nullptr)
+        return std::pair<Value*, Value*>(nullptr, nullptr);
+    return std::pair<Value*, Value*>(node->getValue().begin(), node->getValue().end());
+}
+
+template<typename Key, typename Value>
+std::pair<const Value*, const Value*> AVLMultiMap<Key, Value>::equalRange(const Key& key) const {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_FIND);
+    const Node<Key, ValueList<Value>>* node = this->internalFind(key);
+    if (node == nullptr)
+        return std::pair<const Value*, const Value*>(nullptr, nullptr);
+    const ValueList<Value>& values = node->getValue();
+    return std::pair<const Value*, const Value*>(values.begin(), values.end());
+}
+
+/**
+ * The number of values under all keys.
+ */
+template<typename Key, typename Value>
+size_t AVLMultiMap<Key, Value>::valueCount() const {
+    return values_;
+}
+
+/**
+ * Nodes are created empty by insert(), or with their values by load().
+ */
+template<typename Key, typename Value>
+void AVLMultiMap<Key, Value>::nodeCreated(Node<Key, ValueList<Value>>* node) {
+    values_ += node->getValue().size();
+}
+
+template<typename Key, typename Value>
+void AVLMultiMap<Key, Value>::nodeDestroyed(Node<Key, ValueList<Value>>* node) {
+    values_ -= node->getValue().size();
+}
+
+template<typename Key, typename Value>
+void AVLMultiMap<Key, Value>::nodesReleased() {
+    values_ = 0;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the AVLMultiMap class.
+  ----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,57 @@
+#include <ostream>
+#include <utility>
+
+#ifndef NODE_ITEM_BST_H
+#define NODE_ITEM_BST_H
+
+// Node items
+// Version 1
+//
+// What a node stores for its key and value, and what iterators point to.
+// Maps store a std::pair<const Key, Value>. Sets use NoValue for the value
+// type and store a SetItem, which holds the key alone: first is the key and
+// second is a static NoValue that every item shares, so code written against
+// pairs (it->first, getValue(), insert of a pair) compiles unchanged while
+// the node carries no value and no padding for one.
+
+/**
+ * The value type of a set.
+ */
+struct NoValue {};
+
+inline bool operator==(const NoValue&, const NoValue&) {
+    return true;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const NoValue&) {
+    return out;
+}
+
+/**
+ * The item of a set node: the key, with a shared empty second.
+ */
+template<typename Key>
+struct SetItem {
+    SetItem(const Key& key, const NoValue& /* value */) : first(key) {}
+
+    const Key first;
+    static NoValue second;
+};
+
+template<typename Key>
+NoValue SetItem<Key>::second;
+
+/**
+ * Picks the item type a node stores for Key and Value.
+ */
+template<typename Key, typename Value>
+struct NodeItem {
+    typedef std::pair<const Key, Value> Type;
+};
+
+template<typename Key>
+struct NodeItem<Key, NoValue> {
+    typedef SetItem<Key> Type;
+};
+
+#endif
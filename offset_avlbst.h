@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef OFFSET_AVLBST_H
+#define OFFSET_AVLBST_H
+
+/**
+ * A node of an AVL tree that does not live on the heap. The links are
+ * references handed out by the tree's storage (a file offset, a page/slot
+ * pair, ...) instead of raw pointers, so the node is position independent
+ * and can be written to disk as is. Reference 0 means "no node".
+ */
+template<typename Key, typename Value>
+struct OffsetAVLNode {
+    OffsetAVLNode(const Key& key, const Value& value, uint64_t parent);
+
+    std::pair<const Key, Value> item;
+    uint64_t parent;
+    uint64_t left;
+    uint64_t right;
+    int32_t height;
+};
+
+/**
+ * Explicit constructor for a node, the counterpart of AVLNode's.
+ */
+template<typename Key, typename Value>
+OffsetAVLNode<Key, Value>::OffsetAVLNode(const Key& key, const Value& value, uint64_t parent)
+        : item(key, value), parent(parent), left(0), right(0), height(1) {}
+
+/**
+ * An AVL tree whose nodes are addressed through a Storage policy instead of
+ * pointers. The storage decides where nodes live; the tree only ever holds
+ * references, and asks for a node pointer right before each access:
+ *
+ *   const Node* read(uint64_t ref)  node for reading
+ *   Node* write(uint64_t ref)       node for writing (lets storage mark it dirty)
+ *   uint64_t allocate(uint64_t near) raw slot for a new node, ideally close to near
+ *   void release(uint64_t ref)       slot no longer in use
+ *   uint64_t root() / setRoot()      persisted root reference
+ *   uint64_t count() / setCount()    persisted number of entries
+ *   void reset()                     drop every node at once
+ *   void checkWritable()             throw if the tree may not be modified
+ *
+ * A pointer returned by read()/write() is only guaranteed to stay valid until
+ * the next allocate() (storage may grow and move), so the algorithms below
+ * keep references across calls and never cache node pointers.
+ *
+ * Keys and values must be trivially copyable since nodes are copied around
+ * as raw bytes by the storage.
+ */
+template<typename Key, typename Value, typename Storage>
+class OffsetAVLTree {
+public:
+    typedef OffsetAVLNode<Key, Value> NodeType;
+
+    static_assert(std::is_trivially_copyable<Key>::value, "OffsetAVLTree keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Value>::value, "OffsetAVLTree values must be trivially copyable");
+
+    // the storage owns a file, so a tree cannot be copied
+    OffsetAVLTree() {}
+    OffsetAVLTree(const OffsetAVLTree&) = delete;
+    OffsetAVLTree& operator=(const OffsetAVLTree&) = delete;
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    uint64_t size() const;
+    bool isBalanced() const;
+
+public:
+    /**
+     * An iterator that walks the nodes in order through their parent references.
+     * Dereferencing hands out a read-only reference into storage which, like
+     * the node pointers themselves, is only good until the tree is modified.
+     * Values are changed through OffsetAVLTree::value(), so that walking the
+     * tree does not mark its storage dirty.
+     */
+    class iterator {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class OffsetAVLTree<Key, Value, Storage>;
+        iterator(const OffsetAVLTree<Key, Value, Storage>* tree, uint64_t ref);
+        const OffsetAVLTree<Key, Value, Storage>* tree_;
+        uint64_t current_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& value(const iterator& it);
+
+protected:
+    uint64_t internalFind(const Key& key) const;
+    uint64_t getParent(uint64_t ref) const;
+    uint64_t getLeft(uint64_t ref) const;
+    uint64_t getRight(uint64_t ref) const;
+    int getHeight(uint64_t ref) const;
+    void setParent(uint64_t ref, uint64_t parent);
+    void setLeft(uint64_t ref, uint64_t left);
+    void setRight(uint64_t ref, uint64_t right);
+    void updateHeight(uint64_t ref);
+    void replaceChild(uint64_t parent, uint64_t oldChild, uint64_t newChild);
+    uint64_t leftRotate(uint64_t z);
+    uint64_t rightRotate(uint64_t z);
+    uint64_t balance(uint64_t ref);
+    void retrace(uint64_t ref);
+    int checkSubtree(uint64_t ref) const;
+
+protected:
+    mutable Storage storage_;
+};
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the OffsetAVLTree::iterator.
+  -------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Storage>
+OffsetAVLTree<Key, Value, Storage>::iterator::iterator() : tree_(nullptr), current_(0) {}
+
+template<typename Key, typename Value, typename Storage>
+OffsetAVLTree<Key, Value, Storage>::iterator::iterator(const OffsetAVLTree<Key, Value, Storage>* tree, uint64_t ref)
+        : tree_(tree), current_(ref) {}
+
+/**
+ * Provides access to the item.
+ */
+template<typename Key, typename Value, typename Storage>
+const std::pair<const Key, Value>& OffsetAVLTree<Key, Value, Storage>::iterator::operator*() const {
+    return tree_->storage_.read(current_)->item;
+}
+
+/**
+ * Provides access to the address of the item.
+ */
+template<typename Key, typename Value, typename Storage>
+const std::pair<const Key, Value>* OffsetAVLTree<Key, Value, Storage>::iterator::operator->() const {
+    return &(tree_->storage_.read(current_)->item);
+}
+
+template<typename Key, typename Value, typename Storage>
+bool OffsetAVLTree<Key, Value, Storage>::iterator::operator==(const iterator& rhs) const {
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Storage>
+bool OffsetAVLTree<Key, Value, Storage>::iterator::operator!=(const iterator& rhs) const {
+    return current_ != rhs.current_;
+}
+
+/**
+ * Advances to the in-order successor: the leftmost node of the right subtree,
+ * or else the first ancestor reached from its left side.
+ */
+template<typename Key, typename Value, typename Storage>
+typename OffsetAVLTree<Key, Value, Storage>::iterator& OffsetAVLTree<Key, Value, Storage>::iterator::operator++() {
+    if (current_ == 0)
+        return *this;
+
+    uint64_t next = tree_->getRight(current_);
+    if (next != 0) {
+        while (tree_->getLeft(next) != 0) {
+            next = tree_->getLeft(next);
+        }
+        current_ = next;
+        return *this;
+    }
+
+    uint64_t child = current_;
+    next = tree_->getParent(current_);
+    while (next != 0 && tree_->getRight(next) == child) {
+        child = next;
+        next = tree_->getParent(next);
+    }
+    current_ = next;
+    return *this;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the OffsetAVLTree::iterator.
+  -----------------------------------------------------
+*/
+
+/*
+  --------------------------------------------------
+  Begin implementations for the OffsetAVLTree class.
+  --------------------------------------------------
+*/
+
+/**
+ * Returns an iterator to the smallest item in the tree.
+ */
+template<typename Key, typename Value, typename Storage>
+typename OffsetAVLTree<Key, Value, Storage>::iterator OffsetAVLTree<Key, Value, Storage>::begin() const {
+    uint64_t node = storage_.root();
+    if (node != 0) {
+        while (getLeft(node) != 0) {
+            node = getLeft(node);
+        }
+    }
+    return iterator(this, node);
+}
+
+/**
+ * Returns an iterator whose value means INVALID.
+ */
+template<typename Key, typename Value, typename Storage>
+typename OffsetAVLTree<Key, Value, Storage>::iterator OffsetAVLTree<Key, Value, Storage>::end() const {
+    return iterator(this, 0);
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end() if there is none.
+ */
+template<typename Key, typename Value, typename Storage>
+typename OffsetAVLTree<Key, Value, Storage>::iterator
+OffsetAVLTree<Key, Value, Storage>::find(const Key& key) const {
+    return iterator(this, internalFind(key));
+}
+
+/**
+ * Returns the value of the item an iterator points to, for writing. The node
+ * is fetched with write(), so the change reaches the storage; the reference
+ * is only good until the tree is next accessed. Throws like insert() if the
+ * tree may not be modified.
+ */
+template<typename Key, typename Value, typename Storage>
+Value& OffsetAVLTree<Key, Value, Storage>::value(const iterator& it) {
+    storage_.checkWritable();
+    return storage_.write(it.current_)->item.second;
+}
+
+/**
+ * Returns true if the tree is empty.
+ */
+template<typename Key, typename Value, typename Storage>
+bool OffsetAVLTree<Key, Value, Storage>::empty() const {
+    return storage_.root() == 0;
+}
+
+/**
+ * Returns the number of items, which the storage keeps alongside the root.
+ */
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::size() const {
+    return storage_.count();
+}
+
+/**
+ * Inserts a key/value pair, replacing the value if the key is already present.
+ */
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::insert(const std::pair<const Key, Value>& keyValuePair) {
+    storage_.checkWritable();
+
+    uint64_t parent = 0;
+    uint64_t curr = storage_.root();
+    bool goLeft = false;
+    while (curr != 0) {
+        const Key& key = storage_.read(curr)->item.first;
+        if (keyValuePair.first < key) {
+            goLeft = true;
+        } else if (key < keyValuePair.first) {
+            goLeft = false;
+        } else {
+            storage_.write(curr)->item.second = keyValuePair.second;  // replace the value
+            return;
+        }
+        parent = curr;
+        curr = goLeft ? getLeft(curr) : getRight(curr);
+    }
+
+    uint64_t node = storage_.allocate(parent);
+    new (storage_.write(node)) NodeType(keyValuePair.first, keyValuePair.second, parent);
+    if (parent == 0)
+        storage_.setRoot(node);
+    else if (goLeft)
+        setLeft(parent, node);
+    else
+        setRight(parent, node);
+    storage_.setCount(storage_.count() + 1);
+
+    retrace(parent);
+}
+
+/**
+ * Removes the item with the given key, if any. A node with two children
+ * takes over its predecessor's item and the predecessor is unlinked instead.
+ */
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::remove(const Key& key) {
+    storage_.checkWritable();
+
+    uint64_t node = internalFind(key);
+    if (node == 0)
+        return;
+
+    if (getLeft(node) != 0 && getRight(node) != 0) {
+        uint64_t pred = getLeft(node);
+        while (getRight(pred) != 0) {
+            pred = getRight(pred);
+        }
+        std::pair<const Key, Value> item = storage_.read(pred)->item;
+        NodeType* target = storage_.write(node);
+        target->item.~pair();
+        new (&target->item) std::pair<const Key, Value>(item);
+        node = pred;
+    }
+
+    uint64_t parent = getParent(node);
+    uint64_t child = getLeft(node) != 0 ? getLeft(node) : getRight(node);
+    if (child != 0)
+        setParent(child, parent);
+    replaceChild(parent, node, child);
+
+    storage_.release(node);
+    storage_.setCount(storage_.count() - 1);
+
+    retrace(parent);
+}
+
+/**
+ * Removes every item. The storage reclaims all nodes at once instead of
+ * visiting them.
+ */
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::clear() {
+    storage_.checkWritable();
+    storage_.reset();
+}
+
+/**
+ * Returns true iff every stored height is right and every node is AVL balanced.
+ */
+template<typename Key, typename Value, typename Storage>
+bool OffsetAVLTree<Key, Value, Storage>::isBalanced() const {
+    return checkSubtree(storage_.root()) >= 0;
+}
+
+template<typename Key, typename Value, typename Storage>
+int OffsetAVLTree<Key, Value, Storage>::checkSubtree(uint64_t ref) const {
+    if (ref == 0)
+        return 0;
+
+    int left_height = checkSubtree(getLeft(ref));
+    int right_height = checkSubtree(getRight(ref));
+    if (left_height < 0 || right_height < 0 || std::abs(left_height - right_height) > 1)
+        return -1;
+    int height = std::max(left_height, right_height) + 1;
+    return height == getHeight(ref) ? height : -1;
+}
+
+/**
+ * Walks down from the root and returns the reference of the node holding key, or 0.
+ */
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::internalFind(const Key& key) const {
+    uint64_t curr = storage_.root();
+    while (curr != 0) {
+        const NodeType* node = storage_.read(curr);
+        if (key < node->item.first) {
+            curr = node->left;
+        } else if (node->item.first < key) {
+            curr = node->right;
+        } else {
+            return curr;
+        }
+    }
+    return 0;
+}
+
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::getParent(uint64_t ref) const {
+    return storage_.read(ref)->parent;
+}
+
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::getLeft(uint64_t ref) const {
+    return storage_.read(ref)->left;
+}
+
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::getRight(uint64_t ref) const {
+    return storage_.read(ref)->right;
+}
+
+/**
+ * Returns the stored height of a node, 0 for the empty subtree.
+ */
+template<typename Key, typename Value, typename Storage>
+int OffsetAVLTree<Key, Value, Storage>::getHeight(uint64_t ref) const {
+    return ref == 0 ? 0 : storage_.read(ref)->height;
+}
+
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::setParent(uint64_t ref, uint64_t parent) {
+    storage_.write(ref)->parent = parent;
+}
+
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::setLeft(uint64_t ref, uint64_t left) {
+    storage_.write(ref)->left = left;
+}
+
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::setRight(uint64_t ref, uint64_t right) {
+    storage_.write(ref)->right = right;
+}
+
+/**
+ * Recomputes a node's height from its children.
+ */
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::updateHeight(uint64_t ref) {
+    int height = std::max(getHeight(getLeft(ref)), getHeight(getRight(ref))) + 1;
+    if (storage_.read(ref)->height != height)
+        storage_.write(ref)->height = height;
+}
+
+/**
+ * Points parent (or the root, if parent is 0) at newChild in place of oldChild.
+ */
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::replaceChild(uint64_t parent, uint64_t oldChild, uint64_t newChild) {
+    if (parent == 0) {
+        storage_.setRoot(newChild);
+    } else if (getLeft(parent) == oldChild) {
+        setLeft(parent, newChild);
+    } else {
+        setRight(parent, newChild);
+    }
+}
+
+/**
+ * Rotates z's right child y up into z's place and returns y.
+ */
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::leftRotate(uint64_t z) {
+    uint64_t y = getRight(z);
+    uint64_t orphaned_child = getLeft(y);
+    uint64_t parent = getParent(z);
+
+    setRight(z, orphaned_child);
+    if (orphaned_child != 0)
+        setParent(orphaned_child, z);
+    replaceChild(parent, z, y);
+    setParent(y, parent);
+    setLeft(y, z);
+    setParent(z, y);
+
+    updateHeight(z);
+    updateHeight(y);
+    return y;
+}
+
+/**
+ * Rotates z's left child y up into z's place and returns y.
+ */
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::rightRotate(uint64_t z) {
+    uint64_t y = getLeft(z);
+    uint64_t orphaned_child = getRight(y);
+    uint64_t parent = getParent(z);
+
+    setLeft(z, orphaned_child);
+    if (orphaned_child != 0)
+        setParent(orphaned_child, z);
+    replaceChild(parent, z, y);
+    setParent(y, parent);
+    setRight(y, z);
+    setParent(z, y);
+
+    updateHeight(z);
+    updateHeight(y);
+    return y;
+}
+
+/**
+ * Restores the AVL property at one node with a single or double rotation and
+ * returns the root of the (possibly rotated) subtree with its height updated.
+ */
+template<typename Key, typename Value, typename Storage>
+uint64_t OffsetAVLTree<Key, Value, Storage>::balance(uint64_t ref) {
+    int diff = getHeight(getLeft(ref)) - getHeight(getRight(ref));
+
+    if (diff > 1) {
+        uint64_t y = getLeft(ref);
+        if (getHeight(getLeft(y)) < getHeight(getRight(y)))
+            leftRotate(y);
+        return rightRotate(ref);
+    }
+    if (diff < -1) {
+        uint64_t y = getRight(ref);
+        if (getHeight(getRight(y)) < getHeight(getLeft(y)))
+            rightRotate(y);
+        return leftRotate(ref);
+    }
+
+    updateHeight(ref);
+    return ref;
+}
+
+/**
+ * Walks up from ref after an insert or remove below it, rebalancing each
+ * ancestor. Stops as soon as a subtree's height comes out unchanged, since
+ * nothing above it can have been affected.
+ */
+template<typename Key, typename Value, typename Storage>
+void OffsetAVLTree<Key, Value, Storage>::retrace(uint64_t ref) {
+    while (ref != 0) {
+        int old_height = getHeight(ref);
+        ref = balance(ref);
+        if (getHeight(ref) == old_height)
+            return;
+        ref = getParent(ref);
+    }
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the OffsetAVLTree class.
+  ------------------------------------------------
+*/
+
+#endif
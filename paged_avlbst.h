@@ -0,0 +1,751 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "offset_avlbst.h"
+
+#ifndef PAGED_AVLBST_H
+#define PAGED_AVLBST_H
+
+// Disk-backed AVL tree file format
+// Version 1
+//
+// The file is an array of fixed-size pages. Page 0 holds the PagedHeader;
+// every other page starts with a PageHeader followed by node slots. A node
+// reference is page * slotsPerPage + slot, so page 0 never yields a valid
+// reference and 0 stays the null reference.
+//
+// Only the pages in the buffer pool are in memory. A new node goes on its
+// parent's page while that has room, so a search stays within one page for
+// several levels; recluster() repacks the whole tree so that each page holds
+// a complete top part of a subtree and a root-to-leaf search touches
+// O(log_B n) pages.
+
+#define PAGED_MAGIC 0x504c5641u  // "AVLP"
+#define PAGED_VERSION 1u
+#define PAGED_BYTE_ORDER 0x01020304u
+#define PAGED_DEFAULT_PAGE_SIZE 4096
+#define PAGED_DEFAULT_MEMORY (64u << 20)
+#define PAGED_MIN_FRAMES 8  // the tree touches at most a handful of nodes per step
+
+/**
+ * Thrown when the backing file of a paged tree cannot be opened, read or
+ * written, or does not match the tree's key/value types.
+ */
+struct PagedFileError : public std::runtime_error {
+    explicit PagedFileError(const std::string& what) : std::runtime_error(what) {}
+};
+
+/**
+ * The header in page 0 of a paged tree file.
+ */
+struct PagedHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t pageSize;
+    uint32_t nodeSize;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t reserved;
+    uint64_t root;
+    uint64_t count;
+    uint64_t pageCount;  // including page 0
+    uint64_t freePage;   // first page on the free page list, 0 if none
+    uint64_t fillPage;   // page new nodes go to when their parent's page is full
+};
+
+/**
+ * The header at the start of every node page.
+ */
+struct PageHeader {
+    uint32_t used;      // live slots
+    uint32_t freeSlot;  // 1 + first released slot, whose bytes hold the next one
+    uint32_t unused;    // first slot that has never been handed out
+    uint32_t reserved;
+    uint64_t nextFree;  // next page on the free page list while this one is free
+};
+
+/**
+ * Buffer pool counters for a paged tree.
+ */
+struct PagePoolStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t pageWrites;
+};
+
+/**
+ * OffsetAVLTree storage that keeps pages on disk behind a fixed-size buffer
+ * pool with LRU replacement. A node pointer stays valid until about
+ * PAGED_MIN_FRAMES other pages have been touched, which is more than any
+ * single step of the tree needs. A store owns its file and buffer pool and
+ * cannot be copied.
+ */
+template<typename Key, typename Value>
+class PagedStore {
+public:
+    typedef OffsetAVLNode<Key, Value> NodeType;
+
+    PagedStore();
+    PagedStore(const PagedStore&) = delete;
+    PagedStore& operator=(const PagedStore&) = delete;
+    ~PagedStore();
+
+    void open(const std::string& path, size_t memoryBudget, size_t pageSize, bool truncate);
+    void close();
+    void flush();
+
+    const NodeType* read(uint64_t ref);
+    NodeType* write(uint64_t ref);
+    uint64_t allocate(uint64_t near);
+    uint64_t allocateOnNewPage();
+    void release(uint64_t ref);
+    uint64_t root() const;
+    void setRoot(uint64_t root);
+    uint64_t count() const;
+    void setCount(uint64_t count);
+    void reset();
+    void checkWritable() const;
+
+    size_t pageSize() const;
+    uint64_t slotsPerPage() const;
+    uint64_t pageCount() const;
+    PagePoolStats stats() const;
+
+private:
+    struct Frame {
+        uint64_t page;
+        bool dirty;
+        uint32_t prev;  // towards the most recently used frame
+        uint32_t next;  // towards the least recently used frame
+    };
+
+    char* fetch(uint64_t page, bool fresh);
+    char* frameData(uint32_t frame);
+    PageHeader* pageHeader(char* page);
+    char* slot(char* page, uint64_t index);
+    uint64_t newPage();
+    uint64_t takeSlot(uint64_t page);
+    void unlink(uint32_t frame);
+    void pushFront(uint32_t frame);
+    void writeBack(uint32_t frame);
+    void readPage(uint64_t page, char* data);
+    void writePage(uint64_t page, const char* data);
+
+    static const uint32_t noFrame = 0xffffffffu;
+    static const uint64_t slotSize
+            = (sizeof(NodeType) + alignof(NodeType) - 1) / alignof(NodeType) * alignof(NodeType);
+    static const uint64_t slotOffset
+            = (sizeof(PageHeader) + alignof(NodeType) - 1) / alignof(NodeType) * alignof(NodeType);
+
+    int fd_;
+    size_t pageSize_;
+    uint64_t slotsPerPage_;
+    PagedHeader header_;
+    bool headerDirty_;
+
+    std::vector<char> pool_;
+    std::vector<Frame> frames_;
+    std::unordered_map<uint64_t, uint32_t> pageTable_;
+    uint32_t head_;  // most recently used
+    uint32_t tail_;  // least recently used
+    uint32_t unusedFrames_;
+    uint64_t lastPage_;  // one-entry cache in front of pageTable_
+    uint32_t lastFrame_;
+    PagePoolStats stats_;
+};
+
+/**
+ * An AVL tree whose nodes live in a file and are paged in on demand through
+ * a buffer pool of at most memoryBudget bytes. find, insert and remove behave
+ * exactly as on AVLTree; references handed out by the iterator are only good
+ * until the tree is next accessed, since the page they point into may be
+ * evicted.
+ */
+template<typename Key, typename Value>
+class PagedAVLTree : public OffsetAVLTree<Key, Value, PagedStore<Key, Value>> {
+public:
+    PagedAVLTree(const std::string& path,
+                 size_t memoryBudget = PAGED_DEFAULT_MEMORY,
+                 size_t pageSize = PAGED_DEFAULT_PAGE_SIZE);
+    ~PagedAVLTree();
+
+    void flush();
+    void recluster();
+    PagePoolStats poolStats() const;
+
+private:
+    std::string path_;
+    size_t memoryBudget_;
+    size_t pageSize_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the PagedStore class.
+  -----------------------------------------------
+*/
+
+/**
+ * Default constructor, which leaves the store closed until open().
+ */
+template<typename Key, typename Value>
+PagedStore<Key, Value>::PagedStore()
+        : fd_(-1),
+          pageSize_(0),
+          slotsPerPage_(0),
+          headerDirty_(false),
+          head_(noFrame),
+          tail_(noFrame),
+          unusedFrames_(0),
+          lastPage_(0),
+          lastFrame_(noFrame),
+          stats_() {
+    std::memset(&header_, 0, sizeof(header_));
+}
+
+/**
+ * Destructor, which writes back dirty pages. Errors at this point cannot be
+ * reported; call flush() first to see them.
+ */
+template<typename Key, typename Value>
+PagedStore<Key, Value>::~PagedStore() {
+    try {
+        close();
+    } catch (const PagedFileError&) {
+    }
+}
+
+/**
+ * Opens the file at path, creating (or with truncate, recreating) it with the
+ * given page size. An existing file keeps the page size it was created with.
+ */
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::open(const std::string& path, size_t memoryBudget, size_t pageSize, bool truncate) {
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (fd_ < 0) {
+        throw PagedFileError("paged: cannot open " + path + ": " + std::strerror(errno));
+    }
+    off_t size = lseek(fd_, 0, SEEK_END);
+    if (size == 0) {
+        std::memset(&header_, 0, sizeof(header_));
+        header_.magic = PAGED_MAGIC;
+        header_.version = PAGED_VERSION;
+        header_.byteOrder = PAGED_BYTE_ORDER;
+        header_.pageSize = pageSize;
+        header_.nodeSize = sizeof(NodeType);
+        header_.keySize = sizeof(Key);
+        header_.valueSize = sizeof(Value);
+        header_.pageCount = 1;
+        headerDirty_ = true;
+    } else {
+        if (pread(fd_, &header_, sizeof(header_), 0) != (ssize_t)sizeof(header_)) {
+            close();
+            throw PagedFileError("paged: cannot read header of " + path);
+        }
+        const char* problem = nullptr;
+        if (header_.magic != PAGED_MAGIC)
+            problem = "bad magic";
+        else if (header_.version != PAGED_VERSION)
+            problem = "unsupported version";
+        else if (header_.byteOrder != PAGED_BYTE_ORDER)
+            problem = "written with a different byte order";
+        else if (header_.nodeSize != sizeof(NodeType) || header_.keySize != sizeof(Key)
+                 || header_.valueSize != sizeof(Value))
+            problem = "key/value types do not match";
+        if (problem != nullptr) {
+            close();
+            throw PagedFileError("paged: " + path + ": " + problem);
+        }
+        headerDirty_ = false;
+    }
+
+    pageSize_ = header_.pageSize;
+    if (pageSize_ < sizeof(PagedHeader) || pageSize_ < slotOffset + 2 * slotSize) {
+        close();
+        throw PagedFileError("paged: page size too small for two nodes");
+    }
+    slotsPerPage_ = (pageSize_ - slotOffset) / slotSize;
+
+    size_t frames = memoryBudget / pageSize_;
+    if (frames < PAGED_MIN_FRAMES)
+        frames = PAGED_MIN_FRAMES;
+    pool_.assign(frames * pageSize_, 0);
+    frames_.assign(frames, Frame());
+    pageTable_.clear();
+    pageTable_.reserve(frames);
+    head_ = tail_ = noFrame;
+    unusedFrames_ = frames;
+    lastFrame_ = noFrame;
+    stats_ = PagePoolStats();
+}
+
+/**
+ * Flushes and closes the file, if one is open.
+ */
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::close() {
+    if (fd_ < 0)
+        return;
+    flush();
+    ::close(fd_);
+    fd_ = -1;
+    pool_.clear();
+    frames_.clear();
+    pageTable_.clear();
+}
+
+/**
+ * Writes every dirty page and the header back to the file and syncs it.
+ */
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::flush() {
+    for (uint32_t frame = head_; frame != noFrame; frame = frames_[frame].next) {
+        writeBack(frame);
+    }
+    if (headerDirty_) {
+        std::vector<char> page(pageSize_, 0);
+        std::memcpy(page.data(), &header_, sizeof(header_));
+        writePage(0, page.data());
+        headerDirty_ = false;
+    }
+    if (fdatasync(fd_) != 0) {
+        throw PagedFileError(std::string("paged: fdatasync failed: ") + std::strerror(errno));
+    }
+}
+
+template<typename Key, typename Value>
+const OffsetAVLNode<Key, Value>* PagedStore<Key, Value>::read(uint64_t ref) {
+    char* page = fetch(ref / slotsPerPage_, false);
+    return reinterpret_cast<const NodeType*>(slot(page, ref % slotsPerPage_));
+}
+
+template<typename Key, typename Value>
+OffsetAVLNode<Key, Value>* PagedStore<Key, Value>::write(uint64_t ref) {
+    char* page = fetch(ref / slotsPerPage_, false);
+    frames_[lastFrame_].dirty = true;
+    return reinterpret_cast<NodeType*>(slot(page, ref % slotsPerPage_));
+}
+
+/**
+ * Returns a free slot on near's page if it has one, else on the current fill
+ * page, else on a new page.
+ */
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::allocate(uint64_t near) {
+    if (near != 0) {
+        uint64_t page = near / slotsPerPage_;
+        if (pageHeader(fetch(page, false))->used < slotsPerPage_)
+            return takeSlot(page);
+    }
+    if (header_.fillPage != 0 && pageHeader(fetch(header_.fillPage, false))->used < slotsPerPage_) {
+        return takeSlot(header_.fillPage);
+    }
+    return allocateOnNewPage();
+}
+
+/**
+ * Returns the first slot of an empty page, which becomes the fill page.
+ */
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::allocateOnNewPage() {
+    uint64_t page = newPage();
+    header_.fillPage = page;
+    headerDirty_ = true;
+    return takeSlot(page);
+}
+
+/**
+ * Returns a slot to its page; a page left empty goes on the free page list.
+ */
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::release(uint64_t ref) {
+    uint64_t page = ref / slotsPerPage_;
+    char* data = fetch(page, false);
+    frames_[lastFrame_].dirty = true;
+    PageHeader* ph = pageHeader(data);
+
+    uint32_t index = ref % slotsPerPage_;
+    std::memcpy(slot(data, index), &ph->freeSlot, sizeof(uint32_t));
+    ph->freeSlot = index + 1;
+    ph->used--;
+
+    if (ph->used == 0) {
+        ph->freeSlot = 0;
+        ph->unused = 0;
+        ph->nextFree = header_.freePage;
+        header_.freePage = page;
+        if (header_.fillPage == page)
+            header_.fillPage = 0;
+        headerDirty_ = true;
+    }
+}
+
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::root() const {
+    return header_.root;
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::setRoot(uint64_t root) {
+    header_.root = root;
+    headerDirty_ = true;
+}
+
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::count() const {
+    return header_.count;
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::setCount(uint64_t count) {
+    header_.count = count;
+    headerDirty_ = true;
+}
+
+/**
+ * Drops every page without writing anything back and truncates the file.
+ */
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::reset() {
+    header_.root = 0;
+    header_.count = 0;
+    header_.pageCount = 1;
+    header_.freePage = 0;
+    header_.fillPage = 0;
+    headerDirty_ = true;
+
+    pageTable_.clear();
+    head_ = tail_ = noFrame;
+    unusedFrames_ = frames_.size();
+    lastFrame_ = noFrame;
+    if (ftruncate(fd_, pageSize_) != 0) {
+        throw PagedFileError(std::string("paged: cannot truncate file: ") + std::strerror(errno));
+    }
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::checkWritable() const {}
+
+template<typename Key, typename Value>
+size_t PagedStore<Key, Value>::pageSize() const {
+    return pageSize_;
+}
+
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::slotsPerPage() const {
+    return slotsPerPage_;
+}
+
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::pageCount() const {
+    return header_.pageCount;
+}
+
+template<typename Key, typename Value>
+PagePoolStats PagedStore<Key, Value>::stats() const {
+    return stats_;
+}
+
+/**
+ * Returns the in-memory copy of a page, reading it in (or with fresh, zeroing
+ * it) on a miss and evicting the least recently used page if the pool is full.
+ */
+template<typename Key, typename Value>
+char* PagedStore<Key, Value>::fetch(uint64_t page, bool fresh) {
+    if (lastFrame_ != noFrame && lastPage_ == page) {
+        stats_.hits++;
+        return frameData(lastFrame_);
+    }
+
+    uint32_t frame;
+    typename std::unordered_map<uint64_t, uint32_t>::iterator it = pageTable_.find(page);
+    if (it != pageTable_.end()) {
+        stats_.hits++;
+        frame = it->second;
+        unlink(frame);
+        pushFront(frame);
+    } else {
+        stats_.misses++;
+        if (unusedFrames_ > 0) {
+            frame = frames_.size() - unusedFrames_--;
+        } else {
+            frame = tail_;
+            writeBack(frame);
+            unlink(frame);
+            pageTable_.erase(frames_[frame].page);
+            stats_.evictions++;
+        }
+        frames_[frame].page = page;
+        frames_[frame].dirty = fresh;
+        if (fresh)
+            std::memset(frameData(frame), 0, pageSize_);
+        else
+            readPage(page, frameData(frame));
+        pageTable_[page] = frame;
+        pushFront(frame);
+    }
+
+    lastPage_ = page;
+    lastFrame_ = frame;
+    return frameData(frame);
+}
+
+template<typename Key, typename Value>
+char* PagedStore<Key, Value>::frameData(uint32_t frame) {
+    return pool_.data() + (size_t)frame * pageSize_;
+}
+
+template<typename Key, typename Value>
+PageHeader* PagedStore<Key, Value>::pageHeader(char* page) {
+    return reinterpret_cast<PageHeader*>(page);
+}
+
+template<typename Key, typename Value>
+char* PagedStore<Key, Value>::slot(char* page, uint64_t index) {
+    return page + slotOffset + index * slotSize;
+}
+
+/**
+ * Takes a page off the free page list, or appends one to the file.
+ */
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::newPage() {
+    uint64_t page;
+    if (header_.freePage != 0) {
+        page = header_.freePage;
+        header_.freePage = pageHeader(fetch(page, false))->nextFree;
+    } else {
+        page = header_.pageCount++;
+        fetch(page, true);
+    }
+    headerDirty_ = true;
+    return page;
+}
+
+/**
+ * Hands out a slot of a page known to have room.
+ */
+template<typename Key, typename Value>
+uint64_t PagedStore<Key, Value>::takeSlot(uint64_t page) {
+    char* data = fetch(page, false);
+    frames_[lastFrame_].dirty = true;
+    PageHeader* ph = pageHeader(data);
+
+    uint32_t index;
+    if (ph->freeSlot != 0) {
+        index = ph->freeSlot - 1;
+        std::memcpy(&ph->freeSlot, slot(data, index), sizeof(uint32_t));
+    } else {
+        index = ph->unused++;
+    }
+    ph->used++;
+    return page * slotsPerPage_ + index;
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::unlink(uint32_t frame) {
+    Frame& f = frames_[frame];
+    if (f.prev != noFrame)
+        frames_[f.prev].next = f.next;
+    else
+        head_ = f.next;
+    if (f.next != noFrame)
+        frames_[f.next].prev = f.prev;
+    else
+        tail_ = f.prev;
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::pushFront(uint32_t frame) {
+    frames_[frame].prev = noFrame;
+    frames_[frame].next = head_;
+    if (head_ != noFrame)
+        frames_[head_].prev = frame;
+    head_ = frame;
+    if (tail_ == noFrame)
+        tail_ = frame;
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::writeBack(uint32_t frame) {
+    if (frames_[frame].dirty) {
+        writePage(frames_[frame].page, frameData(frame));
+        frames_[frame].dirty = false;
+        stats_.pageWrites++;
+    }
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::readPage(uint64_t page, char* data) {
+    size_t done = 0;
+    while (done < pageSize_) {
+        ssize_t got = pread(fd_, data + done, pageSize_ - done, page * pageSize_ + done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            throw PagedFileError(std::string("paged: read failed: ") + std::strerror(errno));
+        }
+        if (got == 0) {
+            // past the end of the file: a page that was never written back
+            std::memset(data + done, 0, pageSize_ - done);
+            return;
+        }
+        done += got;
+    }
+}
+
+template<typename Key, typename Value>
+void PagedStore<Key, Value>::writePage(uint64_t page, const char* data) {
+    size_t done = 0;
+    while (done < pageSize_) {
+        ssize_t put = pwrite(fd_, data + done, pageSize_ - done, page * pageSize_ + done);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put < 0) {
+            throw PagedFileError(std::string("paged: write failed: ") + std::strerror(errno));
+        }
+        done += put;
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the PagedStore class.
+  ---------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PagedAVLTree class.
+  -------------------------------------------------
+*/
+
+/**
+ * Opens the tree stored at path, creating an empty one if needed. The page
+ * size only applies to new files.
+ */
+template<typename Key, typename Value>
+PagedAVLTree<Key, Value>::PagedAVLTree(const std::string& path, size_t memoryBudget, size_t pageSize)
+        : path_(path), memoryBudget_(memoryBudget), pageSize_(pageSize) {
+    this->storage_.open(path, memoryBudget, pageSize, false);
+}
+
+/**
+ * Destructor, which writes everything back through the store.
+ */
+template<typename Key, typename Value>
+PagedAVLTree<Key, Value>::~PagedAVLTree() {}
+
+/**
+ * Writes all dirty pages back and syncs the file.
+ */
+template<typename Key, typename Value>
+void PagedAVLTree<Key, Value>::flush() {
+    this->storage_.flush();
+}
+
+/**
+ * Returns the buffer pool's hit/miss/eviction counters.
+ */
+template<typename Key, typename Value>
+PagePoolStats PagedAVLTree<Key, Value>::poolStats() const {
+    return this->storage_.stats();
+}
+
+/**
+ * Rewrites the tree into a new file so that every page holds the top
+ * slotsPerPage nodes (in breadth-first order) of some subtree, with the
+ * subtrees hanging below a page starting pages of their own. Shape and
+ * heights are unchanged; the file also sheds any free pages. The memory
+ * budget is split between the old and the new file while this runs.
+ */
+template<typename Key, typename Value>
+void PagedAVLTree<Key, Value>::recluster() {
+    typedef OffsetAVLNode<Key, Value> NodeType;
+
+    // (old reference, new parent reference, is left child)
+    struct Pending {
+        uint64_t ref;
+        uint64_t parent;
+        bool left;
+    };
+
+    std::string tmpPath = path_ + ".recluster";
+    PagedStore<Key, Value> fresh;
+    fresh.open(tmpPath, memoryBudget_ / 2, this->storage_.pageSize(), true);
+    const uint64_t perPage = fresh.slotsPerPage();
+
+    std::deque<Pending> pageRoots;
+    std::deque<Pending> level;
+    if (this->storage_.root() != 0)
+        pageRoots.push_back(Pending{this->storage_.root(), 0, false});
+
+    while (!pageRoots.empty()) {
+        level.assign(1, pageRoots.front());
+        pageRoots.pop_front();
+
+        uint64_t first = fresh.allocateOnNewPage();
+        for (uint64_t placed = 0; !level.empty(); ++placed) {
+            Pending next = level.front();
+            level.pop_front();
+
+            uint64_t ref = placed == 0 ? first : fresh.allocate(first);
+            NodeType node = *this->storage_.read(next.ref);
+            uint64_t oldLeft = node.left;
+            uint64_t oldRight = node.right;
+            node.parent = next.parent;
+            node.left = 0;
+            node.right = 0;
+            new (fresh.write(ref)) NodeType(node);
+
+            if (next.parent == 0)
+                fresh.setRoot(ref);
+            else if (next.left)
+                fresh.write(next.parent)->left = ref;
+            else
+                fresh.write(next.parent)->right = ref;
+
+            if (oldLeft != 0)
+                level.push_back(Pending{oldLeft, ref, true});
+            if (oldRight != 0)
+                level.push_back(Pending{oldRight, ref, false});
+
+            // page full: whatever is still queued starts pages of its own
+            if (placed + 1 == perPage) {
+                pageRoots.insert(pageRoots.end(), level.begin(), level.end());
+                level.clear();
+            }
+        }
+    }
+
+    fresh.setCount(this->storage_.count());
+    fresh.close();
+    this->storage_.close();
+    if (std::rename(tmpPath.c_str(), path_.c_str()) != 0) {
+        throw PagedFileError("paged: cannot replace " + path_ + ": " + std::strerror(errno));
+    }
+    this->storage_.open(path_, memoryBudget_, pageSize_, false);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PagedAVLTree class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,339 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef PARALLEL_BST_H
+#define PARALLEL_BST_H
+
+// BST parallel traversal
+// Version 1
+//
+// parallelForEach() and parallelReduce() visit every item of the tree on a
+// work-stealing thread pool. The tree is cut at a fixed depth into subtrees,
+// about PARALLEL_TASKS_PER_THREAD of them per thread, so that stealing can
+// even out the load; the nodes above the cut are single-node tasks. Balanced
+// trees give subtrees of similar size without storing subtree sizes (an AVL
+// subtree at a given depth is within a small factor of its siblings), and the
+// surplus of tasks absorbs the rest. An unbalanced BinarySearchTree still
+// works but may split unevenly.
+//
+// Each worker takes tasks from the back of its own queue and, when that is
+// empty, steals from the front of the others'. The calling thread works too.
+// The functions are called from several threads at once. The tree must not
+// change shape while a traversal runs, but the functions may modify values
+// in place, each item being visited by exactly one thread.
+// The first exception thrown by a function is rethrown to the caller once
+// every task has finished. A pool runs one traversal at a time, so the
+// functions must not start another on the same pool.
+
+#define PARALLEL_TASKS_PER_THREAD 8
+#define PARALLEL_MIN_SIZE 16384
+
+/**
+ * A fixed set of worker threads with a task queue each.
+ */
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads = 0);
+    ~WorkStealingPool();
+
+    // The threads that run tasks, the caller of run() included.
+    unsigned size() const {
+        return (unsigned)queues_.size();
+    }
+
+    void run(std::vector<std::function<void()>>& tasks);
+
+    static WorkStealingPool& shared();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>*> tasks;
+    };
+
+    void workerLoop(unsigned index);
+    bool runOne(unsigned index);
+
+    std::vector<std::unique_ptr<Queue>> queues_;  // queue 0 belongs to the caller
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_;
+    bool stopping_;
+    std::atomic<size_t> pending_;
+    std::mutex runMutex_;
+    std::exception_ptr error_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the WorkStealingPool class.
+  -----------------------------------------------------
+*/
+
+/**
+ * Starts threads - 1 workers, the caller being the last thread; 0 means one
+ * thread per hardware thread.
+ */
+inline WorkStealingPool::WorkStealingPool(unsigned threads) : generation_(0), stopping_(false), pending_(0) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    for (unsigned i = 0; i < threads; ++i) {
+        queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (unsigned i = 1; i < threads; ++i) {
+        threads_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+inline WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+/**
+ * Runs every task, spread round robin over the queues, and returns when all
+ * have finished, rethrowing the first exception any of them threw.
+ */
+inline void WorkStealingPool::run(std::vector<std::function<void()>>& tasks) {
+    std::lock_guard<std::mutex> running(runMutex_);
+    error_ = nullptr;
+    pending_ = tasks.size();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        Queue& queue = *queues_[i % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(&tasks[i]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+    }
+    wake_.notify_all();
+
+    while (runOne(0)) {
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    if (error_ != nullptr)
+        std::rethrow_exception(error_);
+}
+
+/**
+ * The pool behind the parallel traversals that are not given one, with a
+ * thread per hardware thread.
+ */
+inline WorkStealingPool& WorkStealingPool::shared() {
+    static WorkStealingPool pool;
+    return pool;
+}
+
+inline void WorkStealingPool::workerLoop(unsigned index) {
+    uint64_t seen = 0;
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_)
+                return;
+            seen = generation_;
+        }
+        while (runOne(index)) {
+        }
+    }
+}
+
+/**
+ * Runs one task, from the back of the thread's own queue or else stolen
+ * from the front of another's. Returns false when every queue is empty.
+ */
+inline bool WorkStealingPool::runOne(unsigned index) {
+    std::function<void()>* task = nullptr;
+    for (size_t k = 0; k < queues_.size() && task == nullptr; ++k) {
+        Queue& queue = *queues_[(index + k) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        if (k == 0) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        } else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+    }
+    if (task == nullptr)
+        return false;
+
+    try {
+        (*task)();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error_ == nullptr)
+            error_ = std::current_exception();
+    }
+    if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_.notify_all();
+    }
+    return true;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the WorkStealingPool class.
+  ---------------------------------------------------
+*/
+
+/**
+ * Calls fn(item) for every item, where item is a std::pair<const Key,
+ * Value>& whose value fn may change, on the shared pool. The order of the
+ * calls is unspecified.
+ */
+template<typename Key, typename Value>
+template<typename Function>
+void BinarySearchTree<Key, Value>::parallelForEach(Function fn) const {
+    parallelForEach(fn, WorkStealingPool::shared());
+}
+
+template<typename Key, typename Value>
+template<typename Function>
+void BinarySearchTree<Key, Value>::parallelForEach(Function fn, WorkStealingPool& pool) const {
+    std::vector<std::pair<Node<Key, Value>*, bool>> parts;
+    splitWork(pool, parts);
+
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(parts.size());
+    for (const std::pair<Node<Key, Value>*, bool>& part : parts) {
+        tasks.push_back([&fn, part] {
+            if (!part.second)
+                fn(part.first->getItem());
+            else
+                forEachInSubtree(part.first, fn);
+        });
+    }
+    pool.run(tasks);
+}
+
+/**
+ * Combines map(item) over every item with combine, on the shared pool:
+ * combine(...combine(combine(init, map(first)), map(second))..., map(last))
+ * in key order, though grouped differently, so combine must be associative
+ * but need not be commutative.
+ */
+template<typename Key, typename Value>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value>::parallelReduce(T init, Map map, Combine combine) const {
+    return parallelReduce(init, map, combine, WorkStealingPool::shared());
+}
+
+template<typename Key, typename Value>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value>::parallelReduce(T init, Map map, Combine combine, WorkStealingPool& pool) const {
+    std::vector<std::pair<Node<Key, Value>*, bool>> parts;
+    splitWork(pool, parts);
+
+    // one partial result per part, combined in key order at the end
+    std::vector<std::optional<T>> partials(parts.size());
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(parts.size());
+    for (size_t i = 0; i < parts.size(); ++i) {
+        tasks.push_back([&, i] {
+            std::optional<T>& partial = partials[i];
+            auto accumulate = [&](typename Node<Key, Value>::Item& item) {
+                if (partial)
+                    partial = combine(std::move(*partial), map(item));
+                else
+                    partial = map(item);
+            };
+            if (!parts[i].second)
+                accumulate(parts[i].first->getItem());
+            else
+                forEachInSubtree(parts[i].first, accumulate);
+        });
+    }
+    pool.run(tasks);
+
+    for (std::optional<T>& partial : partials) {
+        if (partial)
+            init = combine(std::move(init), std::move(*partial));
+    }
+    return init;
+}
+
+/**
+ * Cuts the tree into parts, in key order: whole subtrees (second is true)
+ * at the depth that gives about PARALLEL_TASKS_PER_THREAD per thread, and
+ * the single nodes above them. Small trees are a single part.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::splitWork(
+        const WorkStealingPool& pool, std::vector<std::pair<Node<Key, Value>*, bool>>& parts) const {
+    if (root_ == nullptr)
+        return;
+    int depth = 0;
+    if (size_ >= PARALLEL_MIN_SIZE && pool.size() > 1) {
+        while (((size_t)1 << depth) < (size_t)pool.size() * PARALLEL_TASKS_PER_THREAD) {
+            depth++;
+        }
+    }
+
+    // in-order walk of the levels above the cut
+    std::vector<std::pair<Node<Key, Value>*, int>> stack;
+    Node<Key, Value>* curr = root_;
+    int level = 0;
+    while (curr != nullptr || !stack.empty()) {
+        while (curr != nullptr && level < depth) {
+            stack.push_back(std::make_pair(curr, level));
+            curr = curr->getLeft();
+            level++;
+        }
+        if (curr != nullptr)
+            parts.push_back(std::make_pair(curr, true));  // a subtree at the cut
+        if (stack.empty())
+            break;
+        parts.push_back(std::make_pair(stack.back().first, false));
+        curr = stack.back().first->getRight();
+        level = stack.back().second + 1;
+        stack.pop_back();
+    }
+}
+
+/**
+ * Calls fn on every item below and including node, in key order.
+ */
+template<typename Key, typename Value>
+template<typename Function>
+void BinarySearchTree<Key, Value>::forEachInSubtree(Node<Key, Value>* node, Function& fn) {
+    std::vector<Node<Key, Value>*> stack;
+    while (node != nullptr || !stack.empty()) {
+        while (node != nullptr) {
+            stack.push_back(node);
+            node = node->getLeft();
+        }
+        node = stack.back();
+        stack.pop_back();
+        fn(node->getItem());
+        node = node->getRight();
+    }
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#ifndef REBALANCE_BST_H
+#define REBALANCE_BST_H
+
+// BST in-place rebalancing
+// Version 1
+//
+// rebalance() reshapes the plain BinarySearchTree with the Day-Stout-Warren
+// algorithm: right rotations turn the tree into a vine, a sorted chain of
+// right children, and rounds of left rotations along the vine fold it back
+// into a tree whose levels are all full but the last. It runs in O(n) time
+// and O(1) extra space and allocates nothing; nodes keep their items, so
+// iterators and the lookup cache stay valid.
+//
+// setAutoRebalance(c) rebuilds part of the tree after an insert that lands
+// deeper than c * log2(size), the way a scapegoat tree does: walking up from
+// the new node, the first ancestor whose distance to it exceeds
+// c * log2(its subtree's size) is rebuilt with the same algorithm. Such an
+// ancestor always exists, the root at the latest, and rebuilding it brings
+// the new node back within the bound. Inserts stay amortized O(log n), with
+// no per-node state; removals never trigger a rebuild.
+//
+// The self-balancing trees keep their own invariants, so for them
+// rebalance() does nothing and the auto-trigger never fires.
+
+/**
+ * Rebuilds the whole tree into a shape no deeper than log2(size) + 1.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalance() {
+    if (root_ != nullptr)
+        rebuildSubtree(root_);
+}
+
+/**
+ * Rebuilds a subtree after each insert that ends up deeper than factor *
+ * log2(size); 0 turns it off. factor must be 0 or above 1: at 1 only a
+ * perfect shape passes, and nearly every insert would rebuild.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setAutoRebalance(double factor) {
+    if (factor != 0 && !(factor > 1))
+        throw std::invalid_argument("auto-rebalance factor must be 0 or above 1");
+    autoRebalance_ = factor;
+}
+
+/**
+ * Rebuilds the subtree rooted at node in place and links the new subtree
+ * root where node was.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildSubtree(Node<Key, Value>* node) {
+    Node<Key, Value>* parent = node->getParent();
+    bool isLeft = parent != nullptr && parent->getLeft() == node;
+
+    Node<Key, Value>* top = node;
+    size_t count = treeToVine(top);
+    // a first partial round leaves 2^k - 1 nodes on the vine, then each
+    // round halves it
+    size_t full = 1;
+    while (full * 2 + 1 <= count) {
+        full = full * 2 + 1;
+    }
+    compressVine(top, count - full);
+    while (full > 1) {
+        full /= 2;
+        compressVine(top, full);
+    }
+
+    if (parent == nullptr)
+        root_ = top;
+    else if (isLeft)
+        parent->setLeft(top);
+    else
+        parent->setRight(top);
+}
+
+/**
+ * Finds the scapegoat above a freshly inserted node, if the node is too
+ * deep, and rebuilds it.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalanceAfterInsert(Node<Key, Value>* node) {
+    size_t depth = 0;
+    for (Node<Key, Value>* curr = node->getParent(); curr != nullptr; curr = curr->getParent()) {
+        depth++;
+    }
+    if ((double)depth <= autoRebalance_ * std::log2((double)size_))
+        return;
+
+    size_t height = 0;
+    size_t size = 1;
+    Node<Key, Value>* child = node;
+    for (Node<Key, Value>* curr = node->getParent(); curr != nullptr; curr = curr->getParent()) {
+        height++;
+        Node<Key, Value>* sibling = curr->getLeft() == child ? curr->getRight() : curr->getLeft();
+        size += 1 + subtreeSize(sibling);
+        if ((double)height > autoRebalance_ * std::log2((double)size)) {
+            rebuildSubtree(curr);
+            return;
+        }
+        child = curr;
+    }
+}
+
+/**
+ * Turns the subtree rooted at top into a vine by rotating right at every
+ * node that has a left child, and returns its length. top ends up as the
+ * vine's head, still attached to the subtree's parent.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::treeToVine(Node<Key, Value>*& top) {
+    size_t count = 0;
+    Node<Key, Value>* tail = nullptr;  // last node already on the vine
+    Node<Key, Value>* rest = top;
+    while (rest != nullptr) {
+        Node<Key, Value>* left = rest->getLeft();
+        if (left == nullptr) {
+            count++;
+            tail = rest;
+            rest = rest->getRight();
+            continue;
+        }
+        stats_.rightRotation();
+        rest->setLeft(left->getRight());
+        if (left->getRight() != nullptr)
+            left->getRight()->setParent(rest);
+        left->setParent(rest->getParent());
+        left->setRight(rest);
+        rest->setParent(left);
+        if (tail == nullptr)
+            top = left;
+        else
+            tail->setRight(left);
+        rest = left;
+    }
+    return count;
+}
+
+/**
+ * Rotates left at every other node of the vine, count times from the head,
+ * which moves every second node one level down.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::compressVine(Node<Key, Value>*& top, size_t count) {
+    Node<Key, Value>* scanner = nullptr;  // last node raised, null for top
+    for (size_t i = 0; i < count; ++i) {
+        Node<Key, Value>* child = scanner == nullptr ? top : scanner->getRight();
+        Node<Key, Value>* grand = child->getRight();
+        stats_.leftRotation();
+        child->setRight(grand->getLeft());
+        if (grand->getLeft() != nullptr)
+            grand->getLeft()->setParent(child);
+        grand->setParent(child->getParent());
+        grand->setLeft(child);
+        child->setParent(grand);
+        if (scanner == nullptr)
+            top = grand;
+        else
+            scanner->setRight(grand);
+        scanner = grand;
+    }
+}
+
+/**
+ * Counts the nodes below and including node by following parent links, so
+ * without a stack.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::subtreeSize(const Node<Key, Value>* node) {
+    if (node == nullptr)
+        return 0;
+    size_t count = 0;
+    const Node<Key, Value>* stop = node->getParent();
+    const Node<Key, Value>* curr = node;
+    const Node<Key, Value>* prev = stop;
+    while (curr != stop) {
+        const Node<Key, Value>* next;
+        if (prev == curr->getParent()) {
+            count++;  // first arrival
+            next = curr->getLeft() != nullptr ? curr->getLeft()
+                 : curr->getRight() != nullptr ? curr->getRight() : curr->getParent();
+        } else if (prev == curr->getLeft() && curr->getRight() != nullptr) {
+            next = curr->getRight();
+        } else {
+            next = curr->getParent();
+        }
+        prev = curr;
+        curr = next;
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#ifndef RELAYOUT_AVLBST_H
+#define RELAYOUT_AVLBST_H
+
+// AVL node relayout
+// Version 1
+//
+// A tree that has seen a lot of inserts and removes has its nodes all over
+// the heap, and a descent misses the cache at nearly every level.
+// relayout() moves every node into one slab, laid out like the pages of
+// PagedAVLTree::recluster(): each RELAYOUT_BLOCK_BYTES block holds the top
+// of some subtree in breadth-first order, and the subtrees hanging below it
+// start blocks of their own. A descent then stays within a block for
+// several levels, and blocks hold the levels that get used together. Shape,
+// heights and items are unchanged; nodes are moved with relocateNode(), so
+// iterators, pointers and references into the tree are invalidated while
+// keys and values themselves are carried over.
+//
+// relayoutStep(maxNodes) does the same one subtree of at most maxNodes
+// nodes at a time, sweeping the tree in key order over successive calls so
+// that no single call pauses for long. Inserts and removes may happen
+// between steps. The few nodes above the subtrees a sweep picks stay
+// where they are. A slab is freed when its last node is removed.
+
+#define RELAYOUT_BLOCK_BYTES 4096
+
+/**
+ * Moves every node into a single new slab.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::relayout() {
+    relayoutCursor_.reset();
+    if (this->root_ != nullptr)
+        relayoutSubtree(static_cast<AVLNode<Key, Value>*>(this->root_), this->size_);
+}
+
+/**
+ * Moves the next subtree of the current sweep, of at most maxNodes nodes,
+ * into a slab of its own. Returns true when this completes the sweep; the
+ * next call starts a new one from the smallest key.
+ */
+template<class Key, class Value>
+bool AVLTree<Key, Value>::relayoutStep(size_t maxNodes) {
+    if (maxNodes == 0)
+        throw std::invalid_argument("relayout step must move at least one node");
+
+    // a node with a left child starts after nodes that were moved already or
+    // sit above an earlier subtree, so it stays put as well
+    AVLNode<Key, Value>* node = relayoutCursor_ ? firstAfter(*relayoutCursor_)
+                                                : static_cast<AVLNode<Key, Value>*>(this->getSmallestNode());
+    while (node != nullptr && node->getLeft() != nullptr) {
+        relayoutCursor_ = node->getKey();
+        node = firstAfter(node->getKey());
+    }
+    if (node == nullptr) {
+        relayoutCursor_.reset();
+        return true;
+    }
+
+    // climb while the parent's subtree is all after the cursor and fits,
+    // going by the 2^height - 1 nodes an AVL subtree can hold at most
+    while (node->getParent() != nullptr && node->getParent()->getLeft() == node
+           && node->getParent()->getHeight() < 64
+           && ((size_t)1 << node->getParent()->getHeight()) - 1 <= maxNodes) {
+        node = node->getParent();
+    }
+
+    AVLNode<Key, Value>* last = node;
+    while (last->getRight() != nullptr) {
+        last = last->getRight();
+    }
+    relayoutCursor_ = last->getKey();
+    bool done = firstAfter(last->getKey()) == nullptr;
+    relayoutSubtree(node, this->subtreeSize(node));
+    if (done)
+        relayoutCursor_.reset();
+    return done;
+}
+
+/**
+ * Moves the count nodes of the subtree rooted at root into a new slab,
+ * block by block, each block filled breadth first from the subtree that
+ * starts it.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::relayoutSubtree(AVLNode<Key, Value>* root, size_t count) {
+    // (node still to move, its new parent, is left child)
+    struct Pending {
+        AVLNode<Key, Value>* node;
+        AVLNode<Key, Value>* parent;
+        bool left;
+    };
+
+    const size_t align = alignof(std::max_align_t);
+    const size_t stride = (nodeSize() + align - 1) / align * align;
+    const size_t perBlock = std::max((size_t)1, (size_t)RELAYOUT_BLOCK_BYTES / stride);
+    char* slab = static_cast<char*>(this->slabs_.allocate(count * stride, count));
+    size_t placed = 0;
+
+    std::deque<Pending> blockRoots;
+    std::deque<Pending> level;
+    AVLNode<Key, Value>* parent = root->getParent();
+    blockRoots.push_back(Pending{root, parent, parent != nullptr && parent->getLeft() == root});
+
+    while (!blockRoots.empty()) {
+        level.assign(1, blockRoots.front());
+        blockRoots.pop_front();
+
+        for (size_t inBlock = 0; !level.empty(); ++inBlock) {
+            Pending next = level.front();
+            level.pop_front();
+
+            AVLNode<Key, Value>* oldLeft = next.node->getLeft();
+            AVLNode<Key, Value>* oldRight = next.node->getRight();
+            AVLNode<Key, Value>* node = relocateNode(next.node, slab + placed++ * stride);
+            this->slabs_.destroy(static_cast<Node<Key, Value>*>(next.node));
+            node->setParent(next.parent);
+            node->setLeft(nullptr);
+            node->setRight(nullptr);
+
+            if (next.parent == nullptr)
+                this->root_ = node;
+            else if (next.left)
+                next.parent->setLeft(node);
+            else
+                next.parent->setRight(node);
+
+            if (oldLeft != nullptr)
+                level.push_back(Pending{oldLeft, node, true});
+            if (oldRight != nullptr)
+                level.push_back(Pending{oldRight, node, false});
+
+            // block full: whatever is still queued starts blocks of its own
+            if (inBlock + 1 == perBlock) {
+                blockRoots.insert(blockRoots.end(), level.begin(), level.end());
+                level.clear();
+            }
+        }
+    }
+
+    // the cache points at the old addresses
+    this->cache_.clear();
+}
+
+/**
+ * Move-constructs node at place, which is nodeSize() bytes, and returns the
+ * copy; relayoutSubtree() then destroys the original and relinks the copy.
+ * Subclasses with their own node type, or that keep node pointers outside
+ * the tree, override it.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::relocateNode(AVLNode<Key, Value>* node, void* place) {
+    return new (place) AVLNode<Key, Value>(std::move(*node));
+}
+
+/**
+ * The node with the smallest key greater than key, or nullptr.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::firstAfter(const Key& key) const {
+    AVLNode<Key, Value>* result = nullptr;
+    AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    while (curr != nullptr) {
+        if (this->keyLess(key, curr->getKey())) {
+            result = curr;
+            curr = curr->getLeft();
+        } else {
+            curr = curr->getRight();
+        }
+    }
+    return result;
+}
+
+#endif
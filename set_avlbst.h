@@ -0,0 +1,51 @@
+#ifndef SET_AVLBST_H
+#define SET_AVLBST_H
+
+#include "avlbst.h"
+
+/**
+ * An ordered set: an AVLTree whose nodes hold only a key, see
+ * node_item_bst.h. It shares all of AVLTree's code, balancing, iterators,
+ * validation, export and snapshots included; iterators point to a SetItem
+ * whose first is the key. With int keys a node takes 40 bytes instead of
+ * the 48 of an AVLTree<int, bool>, and a 48-byte malloc chunk instead of 64.
+ */
+template<typename Key>
+class AVLSet : public AVLTree<Key, NoValue> {
+public:
+    typedef typename AVLTree<Key, NoValue>::iterator iterator;
+
+    using AVLTree<Key, NoValue>::insert;
+    void insert(const Key& key);
+    bool contains(const Key& key) const;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the AVLSet class.
+  -------------------------------------------
+*/
+
+/**
+ * Adds key if it is not in the set yet.
+ */
+template<typename Key>
+void AVLSet<Key>::insert(const Key& key) {
+    this->insert(std::pair<const Key, NoValue>(key, NoValue()));
+}
+
+/**
+ * Whether key is in the set.
+ */
+template<typename Key>
+bool AVLSet<Key>::contains(const Key& key) const {
+    return this->find(key) != this->end();
+}
+
+/*
+  -----------------------------------------
+  End implementations for the AVLSet class.
+  -----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifndef SLAB_BST_H
+#define SLAB_BST_H
+
+// BST node slabs
+// Version 1
+//
+// Nodes normally come from operator new one at a time. relayout() (see
+// relayout_avlbst.h) moves them into slabs instead, single blocks holding
+// many nodes side by side. NodeSlabs remembers the slabs a tree owns, so
+// that freeing a node can tell a slab slot from a node of its own: a slot
+// is destroyed in place, and a slab is returned to operator new once its
+// last node is gone. Trees that never relayout have no slabs, and freeing a
+// node costs one extra branch.
+
+/**
+ * The slabs of one tree, sorted by address.
+ */
+class NodeSlabs {
+public:
+    NodeSlabs() : live_(0) {}
+    NodeSlabs(NodeSlabs&& other);
+    NodeSlabs& operator=(NodeSlabs&& other);
+    NodeSlabs(const NodeSlabs&) = delete;
+    NodeSlabs& operator=(const NodeSlabs&) = delete;
+    ~NodeSlabs();
+
+    bool empty() const {
+        return slabs_.empty();
+    }
+    // Nodes still in slabs, and the bytes the slabs take.
+    size_t live() const {
+        return live_;
+    }
+    size_t bytes() const;
+
+    void* allocate(size_t bytes, size_t nodes);
+    bool owns(const void* node) const;
+    template<typename T>
+    void destroy(T* node);
+
+private:
+    struct Slab {
+        char* begin;
+        size_t bytes;
+        size_t live;
+    };
+
+    std::vector<Slab>::iterator slabOf(const void* node);
+    void release(std::vector<Slab>::iterator slab);
+
+    std::vector<Slab> slabs_;
+    size_t live_;
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the NodeSlabs class.
+  ----------------------------------------------
+*/
+
+inline NodeSlabs::NodeSlabs(NodeSlabs&& other) : slabs_(std::move(other.slabs_)), live_(other.live_) {
+    other.slabs_.clear();
+    other.live_ = 0;
+}
+
+inline NodeSlabs& NodeSlabs::operator=(NodeSlabs&& other) {
+    if (this != &other) {
+        this->~NodeSlabs();
+        new (this) NodeSlabs(std::move(other));
+    }
+    return *this;
+}
+
+/**
+ * Frees the slabs, whose nodes must have been destroyed already.
+ */
+inline NodeSlabs::~NodeSlabs() {
+    for (Slab& slab : slabs_) {
+        ::operator delete(slab.begin);
+    }
+}
+
+inline size_t NodeSlabs::bytes() const {
+    size_t total = 0;
+    for (const Slab& slab : slabs_) {
+        total += slab.bytes;
+    }
+    return total;
+}
+
+/**
+ * Allocates a slab of bytes that the caller fills with nodes. It is freed
+ * once destroy() has been called for each of them.
+ */
+inline void* NodeSlabs::allocate(size_t bytes, size_t nodes) {
+    Slab slab = {static_cast<char*>(::operator new(bytes)), bytes, nodes};
+    slabs_.insert(std::upper_bound(slabs_.begin(), slabs_.end(), slab,
+                                   [](const Slab& a, const Slab& b) { return a.begin < b.begin; }),
+                  slab);
+    live_ += nodes;
+    return slab.begin;
+}
+
+inline bool NodeSlabs::owns(const void* node) const {
+    return const_cast<NodeSlabs*>(this)->slabOf(node) != slabs_.end();
+}
+
+/**
+ * Destroys a node, in place if it sits in a slab and with delete if not.
+ */
+template<typename T>
+void NodeSlabs::destroy(T* node) {
+    if (slabs_.empty()) {
+        delete node;
+        return;
+    }
+    std::vector<Slab>::iterator slab = slabOf(node);
+    if (slab == slabs_.end()) {
+        delete node;
+        return;
+    }
+    node->~T();
+    release(slab);
+}
+
+/**
+ * The slab that contains node, or end().
+ */
+inline std::vector<NodeSlabs::Slab>::iterator NodeSlabs::slabOf(const void* node) {
+    const char* at = static_cast<const char*>(node);
+    std::vector<Slab>::iterator slab = std::upper_bound(
+            slabs_.begin(), slabs_.end(), at, [](const char* a, const Slab& b) { return a < b.begin; });
+    if (slab == slabs_.begin())
+        return slabs_.end();
+    --slab;
+    return at < slab->begin + slab->bytes ? slab : slabs_.end();
+}
+
+inline void NodeSlabs::release(std::vector<Slab>::iterator slab) {
+    live_--;
+    if (--slab->live == 0) {
+        ::operator delete(slab->begin);
+        slabs_.erase(slab);
+    }
+}
+
+/*
+  --------------------------------------------
+  End implementations for the NodeSlabs class.
+  --------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,670 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef SNAPSHOT_AVLBST_H
+#define SNAPSHOT_AVLBST_H
+
+// AVLTree binary snapshot format
+// Version 1
+//
+// Layout (native byte order, checked on load):
+//
+//   header   magic "AVLS", version, byte order mark, flags,
+//            sizeof(Key), sizeof(Value), node count
+//   blocks   up to SNAPSHOT_BLOCK_NODES nodes each, in pre-order:
+//              shape  2 bits per node (has left, has right), packed
+//              keys   bulk array if Key is trivially copyable,
+//                     otherwise one SnapshotCodec record per key
+//              values same as keys
+//   trailer  64-bit FNV-1a checksum of everything above
+//
+// The heights are not stored: they are a function of the shape, and load()
+// recomputes them while it links the nodes, so the tree comes back with the
+// exact shape and height_ values it was saved with.
+
+#define SNAPSHOT_MAGIC 0x534c5641u  // "AVLS"
+#define SNAPSHOT_VERSION 1u
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_BLOCK_NODES 4096
+#define SNAPSHOT_BUFFER_SIZE (1 << 16)
+
+#define SNAPSHOT_FLAG_BULK_KEYS 0x1u
+#define SNAPSHOT_FLAG_BULK_VALUES 0x2u
+
+/**
+ * Thrown by AVLTree::save() and AVLTree::load() when the underlying stream or
+ * file descriptor fails, or when the snapshot is malformed.
+ */
+struct SnapshotError : public std::runtime_error {
+    explicit SnapshotError(const std::string& what) : std::runtime_error(what) {}
+};
+
+/**
+ * A buffered byte sink writing either to an ostream or to a file descriptor
+ * and keeping a running checksum of everything written.
+ */
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(std::ostream& out);
+    explicit SnapshotWriter(int fd);
+
+    void write(const void* data, size_t len);
+    void flush();
+    uint64_t checksum() const;
+
+private:
+    void sink(const char* data, size_t len);
+
+    std::ostream* out_;
+    int fd_;
+    uint64_t checksum_;
+    std::vector<char> buffer_;
+};
+
+/**
+ * A buffered byte source reading either from an istream or from a file
+ * descriptor and keeping a running checksum of everything read.
+ */
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::istream& in);
+    explicit SnapshotReader(int fd);
+
+    void read(void* data, size_t len);
+    uint64_t remaining() const;
+    uint64_t checksum() const;
+    void finish();
+
+private:
+    size_t source(char* data, size_t len);
+
+    std::istream* in_;
+    int fd_;
+    uint64_t checksum_;
+    std::vector<char> buffer_;
+    size_t pos_;
+    size_t end_;
+    uint64_t available_;  // bytes from the start to the end of the input, UINT64_MAX if unknown
+    uint64_t consumed_;
+};
+
+/**
+ * Encodes one key or value that cannot be copied in bulk. The primary
+ * template handles trivially copyable types; specialize it for other
+ * types that should be snapshotted.
+ */
+template<typename T, typename Enable = void>
+struct SnapshotCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize SnapshotCodec for keys/values that are not trivially copyable");
+
+    static void write(SnapshotWriter& out, const T& item) {
+        out.write(&item, sizeof(T));
+    }
+
+    static T read(SnapshotReader& in) {
+        T item;
+        in.read(&item, sizeof(T));
+        return item;
+    }
+};
+
+/**
+ * Strings are stored as a 64-bit length followed by the raw characters.
+ */
+template<typename Char, typename Traits, typename Alloc>
+struct SnapshotCodec<std::basic_string<Char, Traits, Alloc>> {
+    static void write(SnapshotWriter& out, const std::basic_string<Char, Traits, Alloc>& item) {
+        uint64_t len = item.size();
+        out.write(&len, sizeof(len));
+        out.write(item.data(), len * sizeof(Char));
+    }
+
+    // the length is not trusted before the checksum is: it has to fit in
+    // what is left of the input, and where that is unknown the string only
+    // grows as its characters arrive
+    static std::basic_string<Char, Traits, Alloc> read(SnapshotReader& in) {
+        uint64_t len;
+        in.read(&len, sizeof(len));
+        if (len > in.remaining() / sizeof(Char)) {
+            throw SnapshotError("snapshot: string runs past the end of the input");
+        }
+        std::basic_string<Char, Traits, Alloc> item;
+        while (item.size() < len) {
+            size_t at = item.size();
+            size_t chunk = (size_t)std::min(len - at, (uint64_t)(SNAPSHOT_BUFFER_SIZE / sizeof(Char)));
+            item.resize(at + chunk);
+            in.read(&item[at], chunk * sizeof(Char));
+        }
+        return item;
+    }
+};
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the SnapshotWriter/Reader classes.
+  ------------------------------------------------------------
+*/
+
+// 64-bit FNV-1a, folded over every byte that passes through a writer/reader.
+inline uint64_t snapshotChecksum(uint64_t hash, const char* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * Constructs a writer on top of an output stream.
+ */
+inline SnapshotWriter::SnapshotWriter(std::ostream& out)
+        : out_(&out), fd_(-1), checksum_(0xcbf29ce484222325ull) {
+    buffer_.reserve(SNAPSHOT_BUFFER_SIZE);
+}
+
+/**
+ * Constructs a writer on top of a file descriptor. The descriptor is not closed.
+ */
+inline SnapshotWriter::SnapshotWriter(int fd) : out_(nullptr), fd_(fd), checksum_(0xcbf29ce484222325ull) {
+    buffer_.reserve(SNAPSHOT_BUFFER_SIZE);
+}
+
+/**
+ * Appends len bytes to the snapshot. Large writes bypass the buffer.
+ */
+inline void SnapshotWriter::write(const void* data, size_t len) {
+    const char* bytes = static_cast<const char*>(data);
+    checksum_ = snapshotChecksum(checksum_, bytes, len);
+
+    if (buffer_.size() + len > SNAPSHOT_BUFFER_SIZE) {
+        flush();
+        if (len >= SNAPSHOT_BUFFER_SIZE) {
+            sink(bytes, len);
+            return;
+        }
+    }
+    buffer_.insert(buffer_.end(), bytes, bytes + len);
+}
+
+/**
+ * Pushes all buffered bytes to the stream or file descriptor.
+ */
+inline void SnapshotWriter::flush() {
+    if (!buffer_.empty()) {
+        sink(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
+    if (out_ != nullptr) {
+        out_->flush();
+    }
+}
+
+/**
+ * Returns the checksum of everything written so far.
+ */
+inline uint64_t SnapshotWriter::checksum() const {
+    return checksum_;
+}
+
+inline void SnapshotWriter::sink(const char* data, size_t len) {
+    if (out_ != nullptr) {
+        out_->write(data, len);
+        if (!*out_) {
+            throw SnapshotError("snapshot: stream write failed");
+        }
+        return;
+    }
+
+    while (len > 0) {
+        ssize_t written = ::write(fd_, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw SnapshotError(std::string("snapshot: write failed: ") + std::strerror(errno));
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+/**
+ * Constructs a reader on top of an input stream. A seekable stream is
+ * measured up front, for remaining().
+ */
+inline SnapshotReader::SnapshotReader(std::istream& in)
+        : in_(&in),
+          fd_(-1),
+          checksum_(0xcbf29ce484222325ull),
+          buffer_(SNAPSHOT_BUFFER_SIZE),
+          pos_(0),
+          end_(0),
+          available_(UINT64_MAX),
+          consumed_(0) {
+    std::istream::pos_type start = in.tellg();
+    if (start != std::istream::pos_type(-1) && in.seekg(0, std::ios::end)) {
+        std::istream::pos_type stop = in.tellg();
+        if (stop != std::istream::pos_type(-1) && stop >= start)
+            available_ = (uint64_t)(stop - start);
+    }
+    in.clear();
+    if (start != std::istream::pos_type(-1))
+        in.seekg(start);
+}
+
+/**
+ * Constructs a reader on top of a file descriptor. The descriptor is not
+ * closed. A regular file is measured up front, for remaining().
+ */
+inline SnapshotReader::SnapshotReader(int fd)
+        : in_(nullptr),
+          fd_(fd),
+          checksum_(0xcbf29ce484222325ull),
+          buffer_(SNAPSHOT_BUFFER_SIZE),
+          pos_(0),
+          end_(0),
+          available_(UINT64_MAX),
+          consumed_(0) {
+    struct stat st;
+    off_t start = ::lseek(fd, 0, SEEK_CUR);
+    if (start >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= start)
+        available_ = (uint64_t)(st.st_size - start);
+}
+
+/**
+ * Reads exactly len bytes or throws a SnapshotError on a short read.
+ */
+inline void SnapshotReader::read(void* data, size_t len) {
+    char* bytes = static_cast<char*>(data);
+    char* start = bytes;
+    size_t total = len;
+
+    while (len > 0) {
+        if (pos_ == end_) {
+            if (in_ != nullptr || len >= SNAPSHOT_BUFFER_SIZE) {
+                // streams buffer on their own, and large blocks go straight to the destination
+                size_t got = source(bytes, len);
+                bytes += got;
+                len -= got;
+                continue;
+            }
+            pos_ = 0;
+            end_ = source(buffer_.data(), buffer_.size());
+        }
+        size_t chunk = std::min(len, end_ - pos_);
+        std::memcpy(bytes, buffer_.data() + pos_, chunk);
+        pos_ += chunk;
+        bytes += chunk;
+        len -= chunk;
+    }
+    checksum_ = snapshotChecksum(checksum_, start, total);
+    consumed_ += total;
+}
+
+/**
+ * Returns how many bytes are left before the end of the input, or
+ * UINT64_MAX if the input cannot tell (a pipe or an unseekable stream).
+ */
+inline uint64_t SnapshotReader::remaining() const {
+    if (available_ == UINT64_MAX)
+        return UINT64_MAX;
+    return available_ > consumed_ ? available_ - consumed_ : 0;
+}
+
+/**
+ * Returns the checksum of everything read so far.
+ */
+inline uint64_t SnapshotReader::checksum() const {
+    return checksum_;
+}
+
+/**
+ * Gives back bytes that were read ahead from a file descriptor, so that the
+ * offset ends up right after the snapshot. Unseekable descriptors keep
+ * whatever was read ahead.
+ */
+inline void SnapshotReader::finish() {
+    if (fd_ >= 0 && pos_ != end_) {
+        ::lseek(fd_, -(off_t)(end_ - pos_), SEEK_CUR);
+        pos_ = end_;
+    }
+}
+
+inline size_t SnapshotReader::source(char* data, size_t len) {
+    if (in_ != nullptr) {
+        in_->read(data, len);
+        size_t got = in_->gcount();
+        if (got == 0) {
+            throw SnapshotError("snapshot: unexpected end of stream");
+        }
+        return got;
+    }
+
+    while (1) {
+        ssize_t got = ::read(fd_, data, len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            throw SnapshotError(std::string("snapshot: read failed: ") + std::strerror(errno));
+        }
+        if (got == 0) {
+            throw SnapshotError("snapshot: unexpected end of file");
+        }
+        return got;
+    }
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the SnapshotWriter/Reader classes.
+  ----------------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for AVLTree save and load.
+  -------------------------------------------------
+*/
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t flags;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+};
+
+/**
+ * Writes one block of keys or values. Trivially copyable items are gathered
+ * into a contiguous buffer so the whole block goes out in a single write.
+ */
+template<typename T>
+void snapshotWriteItems(SnapshotWriter& writer, const std::vector<const T*>& items) {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        std::vector<char> bulk(items.size() * sizeof(T));
+        for (size_t i = 0; i < items.size(); ++i) {
+            std::memcpy(bulk.data() + i * sizeof(T), items[i], sizeof(T));
+        }
+        writer.write(bulk.data(), bulk.size());
+    } else {
+        for (size_t i = 0; i < items.size(); ++i) {
+            SnapshotCodec<T>::write(writer, *items[i]);
+        }
+    }
+}
+
+/**
+ * One block of keys or values read back by load(). Trivially copyable items
+ * are read with a single bulk read into raw storage (which also keeps
+ * std::vector<bool> out of the picture); anything else goes through the codec.
+ */
+template<typename T>
+class SnapshotBlock {
+public:
+    void read(SnapshotReader& reader, size_t count);
+    const T& operator[](size_t i) const;
+
+private:
+    std::vector<typename std::aligned_storage<sizeof(T), alignof(T)>::type> raw_;
+    std::vector<T> items_;
+};
+
+template<typename T>
+void SnapshotBlock<T>::read(SnapshotReader& reader, size_t count) {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        raw_.resize(count);
+        reader.read(raw_.data(), count * sizeof(T));
+    } else {
+        items_.clear();
+        items_.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            items_.push_back(SnapshotCodec<T>::read(reader));
+        }
+    }
+}
+
+template<typename T>
+const T& SnapshotBlock<T>::operator[](size_t i) const {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        return *reinterpret_cast<const T*>(&raw_[i]);
+    } else {
+        return items_[i];
+    }
+}
+
+/**
+ * Writes the tree to an output stream. See the top of snapshot_avlbst.h for the format.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::save(std::ostream& out) const {
+    SnapshotWriter writer(out);
+    saveSnapshot(writer);
+}
+
+/**
+ * Writes the tree to a file descriptor, starting at its current offset.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::save(int fd) const {
+    SnapshotWriter writer(fd);
+    saveSnapshot(writer);
+}
+
+/**
+ * Replaces the contents of the tree with a snapshot read from an input stream.
+ * On error the tree is left empty and a SnapshotError is thrown.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::load(std::istream& in) {
+    SnapshotReader reader(in);
+    loadSnapshot(reader);
+}
+
+/**
+ * Replaces the contents of the tree with a snapshot read from a file descriptor.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::load(int fd) {
+    SnapshotReader reader(fd);
+    loadSnapshot(reader);
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::saveSnapshot(SnapshotWriter& writer) const {
+    const bool bulkKeys = std::is_trivially_copyable<Key>::value;
+    const bool bulkValues = std::is_trivially_copyable<Value>::value;
+
+    uint64_t count = 0;
+    for (typename BinarySearchTree<Key, Value>::iterator it = this->begin(); it != this->end(); ++it) {
+        ++count;
+    }
+
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.flags = (bulkKeys ? SNAPSHOT_FLAG_BULK_KEYS : 0) | (bulkValues ? SNAPSHOT_FLAG_BULK_VALUES : 0);
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = count;
+    writer.write(&header, sizeof(header));
+
+    // pre-order walk with an explicit stack of pending right children
+    std::vector<AVLNode<Key, Value>*> pending;
+    std::vector<AVLNode<Key, Value>*> block;
+    std::vector<unsigned char> shape;
+    std::vector<const Key*> keys;
+    std::vector<const Value*> values;
+    block.reserve(SNAPSHOT_BLOCK_NODES);
+
+    AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    while (curr != nullptr || !pending.empty() || !block.empty()) {
+        while (curr != nullptr && block.size() < SNAPSHOT_BLOCK_NODES) {
+            block.push_back(curr);
+            if (curr->getRight() != nullptr)
+                pending.push_back(curr->getRight());
+            curr = curr->getLeft();
+            if (curr == nullptr && !pending.empty()) {
+                curr = pending.back();
+                pending.pop_back();
+            }
+        }
+
+        // emit the block: shape bits, then keys, then values
+        shape.assign((block.size() + 3) / 4, 0);
+        keys.clear();
+        values.clear();
+        for (size_t i = 0; i < block.size(); ++i) {
+            unsigned char bits = (block[i]->getLeft() != nullptr ? 1 : 0) | (block[i]->getRight() != nullptr ? 2 : 0);
+            shape[i / 4] |= bits << (2 * (i % 4));
+            keys.push_back(&block[i]->getKey());
+            values.push_back(&block[i]->getValue());
+        }
+        writer.write(shape.data(), shape.size());
+        snapshotWriteItems(writer, keys);
+        snapshotWriteItems(writer, values);
+        block.clear();
+    }
+
+    uint64_t checksum = writer.checksum();
+    writer.write(&checksum, sizeof(checksum));
+    writer.flush();
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::loadSnapshot(SnapshotReader& reader) {
+    this->clear();
+
+    SnapshotHeader header;
+    reader.read(&header, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC) {
+        throw SnapshotError("snapshot: bad magic");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw SnapshotError("snapshot: unsupported version " + std::to_string(header.version));
+    }
+    if (header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+        throw SnapshotError("snapshot: written with a different byte order");
+    }
+    uint32_t flags = (std::is_trivially_copyable<Key>::value ? SNAPSHOT_FLAG_BULK_KEYS : 0)
+                     | (std::is_trivially_copyable<Value>::value ? SNAPSHOT_FLAG_BULK_VALUES : 0);
+    if (header.flags != flags || header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+        throw SnapshotError("snapshot: key/value types do not match");
+    }
+
+    // Nodes arrive in pre-order. A node is linked as the left child of the
+    // previous node if that one has a left subtree, otherwise as the right
+    // child of the most recent node still waiting for its right subtree.
+    // Heights are filled in as subtrees complete, walking up only as far as
+    // the first ancestor that still has an unfinished right subtree.
+    std::vector<AVLNode<Key, Value>*> pending;
+    std::vector<unsigned char> shape;
+    SnapshotBlock<Key> keys;
+    SnapshotBlock<Value> values;
+    AVLNode<Key, Value>* prev = nullptr;
+    bool prevHasLeft = false;
+    bool prevHasRight = false;
+
+    try {
+        uint64_t remaining = header.count;
+        while (remaining > 0) {
+            size_t count = remaining < SNAPSHOT_BLOCK_NODES ? remaining : SNAPSHOT_BLOCK_NODES;
+            shape.resize((count + 3) / 4);
+            reader.read(shape.data(), shape.size());
+            keys.read(reader, count);
+            values.read(reader, count);
+
+            for (size_t i = 0; i < count; ++i) {
+                unsigned char bits = (shape[i / 4] >> (2 * (i % 4))) & 3;
+                AVLNode<Key, Value>* node;
+
+                if (prev == nullptr) {
+                    node = this->createNode(keys[i], values[i], nullptr);
+                    this->root_ = node;
+                } else if (prevHasLeft) {
+                    node = this->createNode(keys[i], values[i], prev);
+                    prev->setLeft(node);
+                } else {
+                    if (pending.empty()) {
+                        throw SnapshotError("snapshot: corrupt tree shape");
+                    }
+                    AVLNode<Key, Value>* parent = pending.back();
+                    pending.pop_back();
+                    node = this->createNode(keys[i], values[i], parent);
+                    parent->setRight(node);
+                }
+
+                prevHasLeft = (bits & 1) != 0;
+                prevHasRight = (bits & 2) != 0;
+                prev = node;
+
+                // the height doubles as a marker until the subtree is complete:
+                // 0 while a right subtree is still to come, -1 for left-only nodes
+                if (prevHasRight) {
+                    node->setHeight(0);
+                    pending.push_back(node);
+                } else if (prevHasLeft) {
+                    node->setHeight(-1);
+                } else {
+                    completeSubtree(node);
+                }
+            }
+            remaining -= count;
+        }
+
+        if (prevHasLeft || prevHasRight || !pending.empty()) {
+            throw SnapshotError("snapshot: truncated tree shape");
+        }
+
+        uint64_t expected = reader.checksum();
+        uint64_t checksum;
+        reader.read(&checksum, sizeof(checksum));
+        if (checksum != expected) {
+            throw SnapshotError("snapshot: checksum mismatch");
+        }
+        reader.finish();
+    } catch (...) {
+        this->clear();
+        throw;
+    }
+}
+
+/**
+ * Sets the height of a node whose subtrees are both fully loaded, then keeps
+ * going up while the node just finished was the last subtree of its parent.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::completeSubtree(AVLNode<Key, Value>* node) {
+    while (node != nullptr) {
+        this->updateHeight(node);
+
+        AVLNode<Key, Value>* parent = node->getParent();
+        if (parent == nullptr)
+            return;
+        // a finished left subtree whose sibling is still to come
+        if (parent->getLeft() == node && parent->getHeight() == 0)
+            return;
+        node = parent;
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for AVLTree save and load.
+  -----------------------------------------------
+*/
+
+#endif
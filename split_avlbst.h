@@ -0,0 +1,353 @@
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef SPLIT_AVLBST_H
+#define SPLIT_AVLBST_H
+
+#include "avlbst.h"
+
+// AVL map with out-of-line values
+// Version 1
+//
+// SplitAVLMap keeps the values out of the tree. A node holds the key, the
+// links and a 32-bit ValueHandle; the values sit in a ValueStore, chunks of
+// VALUE_STORE_CHUNK values each. With a large Value the nodes a descent
+// walks through stay as small as those of an AVLTree<Key, uint32_t>, so
+// more of them fit in the cache, and only the node found reaches into the
+// store. Chunks never move, so a value keeps its address until it is
+// removed or compact() runs. Removed values leave holes that later inserts
+// reuse. compact() rewrites the store in key order, without the holes, so
+// that an in-order scan reads the values sequentially, and never touches
+// the tree's shape.
+//
+// The nodes' values are handles, so iterators give (key, handle) pairs;
+// value(handle) returns the value. Snapshots are not supported: a snapshot
+// would hold the handles without the store, so save() and load() are
+// deleted.
+
+#define VALUE_STORE_CHUNK 1024
+#define VALUE_HANDLE_NONE UINT32_MAX
+
+/**
+ * A reference to a value in a ValueStore.
+ */
+struct ValueHandle {
+    uint32_t index = VALUE_HANDLE_NONE;
+
+    bool operator==(const ValueHandle& other) const {
+        return index == other.index;
+    }
+};
+
+/**
+ * Writes the handle as "#index", for print().
+ */
+inline std::ostream& operator<<(std::ostream& out, const ValueHandle& handle) {
+    return out << '#' << handle.index;
+}
+
+/**
+ * Values in fixed-size chunks, addressed by index, with a free list for the
+ * slots of released values.
+ */
+template<typename Value>
+class ValueStore {
+public:
+    ValueStore() : used_(0), size_(0) {}
+    ValueStore(ValueStore&& other);
+    ValueStore& operator=(ValueStore&& other);
+    ValueStore(const ValueStore&) = delete;
+    ValueStore& operator=(const ValueStore&) = delete;
+    ~ValueStore();
+
+    template<typename V>
+    ValueHandle add(V&& value);
+    void release(ValueHandle handle);
+    bool live(ValueHandle handle) const;
+
+    Value& operator[](ValueHandle handle) const {
+        return chunks_[handle.index / VALUE_STORE_CHUNK][handle.index % VALUE_STORE_CHUNK];
+    }
+    // Values held, and the bytes of the chunks and bookkeeping.
+    size_t size() const {
+        return size_;
+    }
+    size_t heapBytes() const;
+
+private:
+    std::vector<Value*> chunks_;
+    std::vector<uint32_t> free_;  // released slots, reused last in first out
+    std::vector<bool> live_;
+    uint32_t used_;  // slots ever handed out
+    size_t size_;
+};
+
+/**
+ * An AVLTree whose nodes hold a handle to a value kept out of line.
+ */
+template<typename Key, typename Value>
+class SplitAVLMap : public AVLTree<Key, ValueHandle> {
+public:
+    typedef typename AVLTree<Key, ValueHandle>::iterator iterator;
+
+    virtual void insert(const std::pair<const Key, ValueHandle>& item) override;
+    void insert(const std::pair<const Key, Value>& item);
+    void insert(const Key& key, const Value& value);
+
+    Value* findValue(const Key& key) const;
+    Value& value(ValueHandle handle) const;
+    void compact();
+
+    void save(std::ostream& out) const = delete;
+    void save(int fd) const = delete;
+    void load(std::istream& in) = delete;
+    void load(int fd) = delete;
+
+protected:
+    virtual void nodeDestroyed(Node<Key, ValueHandle>* node) override;
+    virtual void nodesReleased() override;
+    virtual bool validateNode(const Node<Key, ValueHandle>* node, int left_height, int right_height,
+                              std::string* violation) const override;
+    virtual size_t objectSize() const override;
+
+    mutable ValueStore<Value> store_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the ValueStore class.
+  -----------------------------------------------
+*/
+
+template<typename Value>
+ValueStore<Value>::ValueStore(ValueStore&& other)
+        : chunks_(std::move(other.chunks_)),
+          free_(std::move(other.free_)),
+          live_(std::move(other.live_)),
+          used_(other.used_),
+          size_(other.size_) {
+    other.chunks_.clear();
+    other.free_.clear();
+    other.live_.clear();
+    other.used_ = 0;
+    other.size_ = 0;
+}
+
+template<typename Value>
+ValueStore<Value>& ValueStore<Value>::operator=(ValueStore&& other) {
+    if (this != &other) {
+        this->~ValueStore();
+        new (this) ValueStore(std::move(other));
+    }
+    return *this;
+}
+
+template<typename Value>
+ValueStore<Value>::~ValueStore() {
+    for (uint32_t i = 0; i < used_; ++i) {
+        if (live_[i])
+            (*this)[ValueHandle{i}].~Value();
+    }
+    for (Value* chunk : chunks_) {
+        std::allocator<Value>().deallocate(chunk, VALUE_STORE_CHUNK);
+    }
+}
+
+/**
+ * Stores a copy of value, in a released slot if there is one, and returns
+ * its handle.
+ */
+template<typename Value>
+template<typename V>
+ValueHandle ValueStore<Value>::add(V&& value) {
+    ValueHandle handle;
+    if (!free_.empty()) {
+        handle.index = free_.back();
+    } else {
+        if (used_ == VALUE_HANDLE_NONE)
+            throw std::length_error("value store is full");
+        if (used_ % VALUE_STORE_CHUNK == 0)
+            chunks_.push_back(std::allocator<Value>().allocate(VALUE_STORE_CHUNK));
+        handle.index = used_;
+    }
+    new (&(*this)[handle]) Value(std::forward<V>(value));
+    if (!free_.empty()) {
+        free_.pop_back();
+    } else {
+        used_++;
+        live_.push_back(false);
+    }
+    live_[handle.index] = true;
+    size_++;
+    return handle;
+}
+
+/**
+ * Destroys the value and keeps its slot for the next add().
+ */
+template<typename Value>
+void ValueStore<Value>::release(ValueHandle handle) {
+    (*this)[handle].~Value();
+    live_[handle.index] = false;
+    free_.push_back(handle.index);
+    size_--;
+}
+
+template<typename Value>
+bool ValueStore<Value>::live(ValueHandle handle) const {
+    return handle.index < used_ && live_[handle.index];
+}
+
+template<typename Value>
+size_t ValueStore<Value>::heapBytes() const {
+    size_t total = chunks_.size() * mallocChunkSize(VALUE_STORE_CHUNK * sizeof(Value));
+    if (chunks_.capacity() != 0)
+        total += mallocChunkSize(chunks_.capacity() * sizeof(Value*));
+    if (free_.capacity() != 0)
+        total += mallocChunkSize(free_.capacity() * sizeof(uint32_t));
+    if (live_.capacity() != 0)
+        total += mallocChunkSize(live_.capacity() / 8);
+    return total;
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the ValueStore class.
+  ---------------------------------------------
+*/
+
+/*
+  ------------------------------------------------
+  Begin implementations for the SplitAVLMap class.
+  ------------------------------------------------
+*/
+
+/**
+ * Handles only mean something to the store that issued them, so they
+ * cannot be inserted; insert the value instead.
+ */
+template<typename Key, typename Value>
+void SplitAVLMap<Key, Value>::insert(const std::pair<const Key, ValueHandle>& /* item */) {
+    throw std::invalid_argument("a split map takes values, not handles");
+}
+
+template<typename Key, typename Value>
+void SplitAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& item) {
+    insert(item.first, item.second);
+}
+
+/**
+ * Inserts or replaces the value under key, with a single descent. A new
+ * key's value goes into the store once its node exists.
+ */
+template<typename Key, typename Value>
+void SplitAVLMap<Key, Value>::insert(const Key& key, const Value& value) {
+    TreeOpScope<TreeStats> scope(this->stats_, TREE_OP_INSERT);
+    bool created;
+    AVLNode<Key, ValueHandle>* node = this->findOrCreate(key, ValueHandle(), created);
+    if (!created) {
+        store_[node->getValue()] = value;
+        return;
+    }
+    try {
+        node->getValue() = store_.add(value);
+    } catch (...) {
+        this->remove(key);
+        throw;
+    }
+}
+
+/**
+ * The value under key, or nullptr if the key is absent.
+ */
+template<typename Key, typename Value>
+Value* SplitAVLMap<Key, Value>::findValue(const Key& key) const {
+    iterator it = this->find(key);
+    return it == this->end() ? nullptr : &store_[it->second];
+}
+
+/**
+ * The value a handle from this map's iterators refers to.
+ */
+template<typename Key, typename Value>
+Value& SplitAVLMap<Key, Value>::value(ValueHandle handle) const {
+    return store_[handle];
+}
+
+/**
+ * Moves the values into a new store in key order, dropping the holes left
+ * by removals. Handles and value addresses change; the tree does not.
+ */
+template<typename Key, typename Value>
+void SplitAVLMap<Key, Value>::compact() {
+    ValueStore<Value> packed;
+    for (typename Node<Key, ValueHandle>::Item& item : *this) {
+        item.second = packed.add(std::move(store_[item.second]));
+    }
+    store_ = std::move(packed);
+}
+
+template<typename Key, typename Value>
+void SplitAVLMap<Key, Value>::nodeDestroyed(Node<Key, ValueHandle>* node) {
+    if (node->getValue().index != VALUE_HANDLE_NONE)
+        store_.release(node->getValue());
+}
+
+/**
+ * The values are freed here, on the caller's thread; only the nodes go to
+ * the reaper.
+ */
+template<typename Key, typename Value>
+void SplitAVLMap<Key, Value>::nodesReleased() {
+    store_ = ValueStore<Value>();
+}
+
+/**
+ * On top of AVLTree's checks, every node's handle must refer to a live
+ * value, and the store must hold exactly as many values as the tree.
+ */
+template<typename Key, typename Value>
+bool SplitAVLMap<Key, Value>::validateNode(const Node<Key, ValueHandle>* node, int left_height, int right_height,
+                                           std::string* violation) const {
+    if (!AVLTree<Key, ValueHandle>::validateNode(node, left_height, right_height, violation))
+        return false;
+    if (!store_.live(node->getValue())) {
+        this->reportViolation(node, "handle does not refer to a stored value", violation);
+        return false;
+    }
+    if (node->getParent() == nullptr && store_.size() != this->size_) {
+        this->reportViolation(node, "store holds a different number of values than the tree", violation);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The map itself plus the store, and whatever heap the values own.
+ */
+template<typename Key, typename Value>
+size_t SplitAVLMap<Key, Value>::objectSize() const {
+    size_t total = sizeof(*this) + store_.heapBytes();
+    if (HeapFootprint<Value>::owns) {
+        for (const typename Node<Key, ValueHandle>::Item& item : *this) {
+            total += HeapFootprint<Value>::bytes(store_[item.second]);
+        }
+    }
+    return total;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the SplitAVLMap class.
+  ----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef STATS_BST_H
+#define STATS_BST_H
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "histogram_bst.h"
+
+/**
+ * The operations that are counted and, with AVLBST_LATENCY, timed.
+ */
+enum TreeOp { TREE_OP_FIND, TREE_OP_INSERT, TREE_OP_REMOVE, TREE_OP_COUNT };
+
+/**
+ * Operation counters for a search tree, as returned by stats().
+ *
+ * nodesVisited counts every node a find, insert or remove descended
+ * through, so nodesVisited / operations() is the mean search path length.
+ * retraceSteps counts the ancestors an AVL insert/remove walked back up
+ * through, so retraceSteps / retraces is the mean retrace length.
+ */
+struct TreeStatsSnapshot {
+    uint64_t finds;
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t comparisons;
+    uint64_t nodesVisited;
+    uint64_t leftRotations;
+    uint64_t rightRotations;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t retraces;
+    uint64_t retraceSteps;
+    uint64_t maxRetrace;
+
+    uint64_t operations() const {
+        return finds + inserts + removes;
+    }
+};
+
+/**
+ * The default stats policy: every hook is an empty inline function, so the
+ * counting compiles away entirely.
+ */
+struct NullTreeStats {
+    uint64_t beginOp() {
+        return 0;
+    }
+    void endOp(TreeOp /* op */, uint64_t /* start */) {}
+    void comparison() {}
+    void visit() {}
+    void leftRotation() {}
+    void rightRotation() {}
+    void allocation() {}
+    void free(uint64_t /* count */ = 1) {}
+    void retrace(uint64_t /* steps */) {}
+
+    TreeStatsSnapshot snapshot() const {
+        return TreeStatsSnapshot();
+    }
+    LatencyHistogram latency(TreeOp /* op */) const {
+        return LatencyHistogram();
+    }
+    void reset() {}
+};
+
+/**
+ * The stats policy selected by defining AVLBST_STATS: plain counters, one
+ * increment per event. Like the trees themselves it is not thread safe.
+ */
+struct CountingTreeStats {
+    CountingTreeStats() : counts_() {}
+
+    uint64_t beginOp() {
+        return 0;
+    }
+    void endOp(TreeOp op, uint64_t /* start */) {
+        if (op == TREE_OP_FIND)
+            counts_.finds++;
+        else if (op == TREE_OP_INSERT)
+            counts_.inserts++;
+        else
+            counts_.removes++;
+    }
+    void comparison() {
+        counts_.comparisons++;
+    }
+    void visit() {
+        counts_.nodesVisited++;
+    }
+    void leftRotation() {
+        counts_.leftRotations++;
+    }
+    void rightRotation() {
+        counts_.rightRotations++;
+    }
+    void allocation() {
+        counts_.allocations++;
+    }
+    void free(uint64_t count = 1) {
+        counts_.frees += count;
+    }
+    void retrace(uint64_t steps) {
+        counts_.retraces++;
+        counts_.retraceSteps += steps;
+        if (steps > counts_.maxRetrace)
+            counts_.maxRetrace = steps;
+    }
+
+    TreeStatsSnapshot snapshot() const {
+        return counts_;
+    }
+    LatencyHistogram latency(TreeOp /* op */) const {
+        return LatencyHistogram();
+    }
+    void reset() {
+        counts_ = TreeStatsSnapshot();
+    }
+
+private:
+    TreeStatsSnapshot counts_;
+};
+
+/**
+ * The stats policy selected by defining AVLBST_LATENCY: the counters above
+ * plus a latency histogram per operation. Reading the clock twice costs a
+ * few tens of nanoseconds per operation, which the histograms include.
+ */
+struct TimedTreeStats : public CountingTreeStats {
+    uint64_t beginOp() {
+        return now();
+    }
+    void endOp(TreeOp op, uint64_t start) {
+        CountingTreeStats::endOp(op, start);
+        latency_[op].record(now() - start);
+    }
+
+    LatencyHistogram latency(TreeOp op) const {
+        return latency_[op];
+    }
+    void reset() {
+        CountingTreeStats::reset();
+        for (int i = 0; i < TREE_OP_COUNT; ++i) {
+            latency_[i].reset();
+        }
+    }
+
+private:
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+    }
+
+    LatencyHistogram latency_[TREE_OP_COUNT];
+};
+
+/**
+ * Brackets one tree operation: begins it on construction and ends it, under
+ * the given kind, when it goes out of scope on any return path.
+ */
+template<typename Stats>
+class TreeOpScope {
+public:
+    TreeOpScope(Stats& stats, TreeOp op) : stats_(stats), op_(op), start_(stats.beginOp()) {}
+    ~TreeOpScope() {
+        stats_.endOp(op_, start_);
+    }
+
+private:
+    Stats& stats_;
+    TreeOp op_;
+    uint64_t start_;
+};
+
+#if defined(AVLBST_LATENCY)
+typedef TimedTreeStats TreeStats;
+#elif defined(AVLBST_STATS)
+typedef CountingTreeStats TreeStats;
+#else
+typedef NullTreeStats TreeStats;
+#endif
+
+/**
+ * Writes the counters one per line as "avlbst_<name> <value>", which is easy
+ * to grep and is also the Prometheus text format.
+ */
+inline std::ostream& operator<<(std::ostream& out, const TreeStatsSnapshot& s) {
+    out << "avlbst_finds " << s.finds << "\n"
+        << "avlbst_inserts " << s.inserts << "\n"
+        << "avlbst_removes " << s.removes << "\n"
+        << "avlbst_comparisons " << s.comparisons << "\n"
+        << "avlbst_nodes_visited " << s.nodesVisited << "\n"
+        << "avlbst_left_rotations " << s.leftRotations << "\n"
+        << "avlbst_right_rotations " << s.rightRotations << "\n"
+        << "avlbst_allocations " << s.allocations << "\n"
+        << "avlbst_frees " << s.frees << "\n"
+        << "avlbst_retraces " << s.retraces << "\n"
+        << "avlbst_retrace_steps " << s.retraceSteps << "\n"
+        << "avlbst_max_retrace " << s.maxRetrace << "\n";
+    return out;
+}
+
+#endif
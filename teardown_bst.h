@@ -0,0 +1,214 @@
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifndef TEARDOWN_BST_H
+#define TEARDOWN_BST_H
+
+// BST background teardown
+// Version 1
+//
+// Freeing a tree of many millions of nodes is one cache miss and one free()
+// per node, which can hold up the thread that drops it for seconds.
+// clearInBackground() empties the tree at once instead: it detaches the
+// nodes, resets the lookup cache, the membership filter and whatever a
+// subclass keeps per node (through nodesReleased()), and hands the nodes to
+// a shared reaper thread, which frees them with the same O(1)-space
+// rotation walk as clear(). setBackgroundTeardown(true) makes clear(), and
+// so load() and the destructor, do the same.
+//
+// The reaper frees nodes without the per-node hooks, stats or cache updates,
+// so key and value destructors run on the reaper thread and must not touch
+// anything the rest of the program uses unsynchronized. Freed nodes are
+// counted all at once when they are handed over. TreeReaper::shared().wait()
+// blocks until everything handed over so far is freed; the reaper also
+// finishes its queue at exit. A tree destroyed after that, such as a global
+// constructed before the reaper was first used, frees its nodes on its own
+// thread instead.
+
+/**
+ * The thread that frees detached trees, one at a time in handover order.
+ */
+class TreeReaper {
+public:
+    typedef void (*FreeFunction)(void* root);
+
+    TreeReaper() : busy_(false), stopping_(false) {}
+    ~TreeReaper();
+
+    void submit(void* root, FreeFunction free);
+    void wait();
+
+    static TreeReaper& shared();
+    static bool sharedStopped();
+
+private:
+    void loop();
+    static bool& stopped();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<std::pair<void*, FreeFunction>> queue_;
+    bool busy_;
+    bool stopping_;
+    std::thread thread_;  // started by the first submit()
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the TreeReaper class.
+  -----------------------------------------------
+*/
+
+inline TreeReaper::~TreeReaper() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+/**
+ * Queues a detached tree to be freed by free(root).
+ */
+inline void TreeReaper::submit(void* root, FreeFunction free) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::make_pair(root, free));
+        if (!thread_.joinable())
+            thread_ = std::thread(&TreeReaper::loop, this);
+    }
+    wake_.notify_one();
+}
+
+/**
+ * Blocks until every tree submitted so far has been freed.
+ */
+inline void TreeReaper::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return queue_.empty() && !busy_; });
+}
+
+inline TreeReaper& TreeReaper::shared() {
+    struct Owner {
+        TreeReaper reaper;
+        ~Owner() {
+            stopped() = true;
+        }
+    };
+    static Owner owner;
+    return owner.reaper;
+}
+
+/**
+ * Returns true once the shared reaper has been destroyed at exit, after
+ * which it must not be used.
+ */
+inline bool TreeReaper::sharedStopped() {
+    return stopped();
+}
+
+// a plain bool, so it stays readable through the destruction of statics
+inline bool& TreeReaper::stopped() {
+    static bool stopped = false;
+    return stopped;
+}
+
+/**
+ * Frees queued trees until asked to stop, and then the rest of the queue.
+ */
+inline void TreeReaper::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (1) {
+        wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty())
+            return;
+        std::pair<void*, FreeFunction> job = queue_.front();
+        queue_.pop_front();
+        busy_ = true;
+        lock.unlock();
+        job.second(job.first);
+        lock.lock();
+        busy_ = false;
+        if (queue_.empty())
+            idle_.notify_all();
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the TreeReaper class.
+  ---------------------------------------------
+*/
+
+/**
+ * Empties the tree in O(1) and leaves the nodes to the reaper thread.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::clearInBackground() {
+    Node<Key, Value>* root = root_;
+    stats_.free(size_);
+    root_ = nullptr;
+    size_ = 0;
+    cache_.clear();
+    filter_.clear();
+    nodesReleased();
+    if (root == nullptr)
+        return;
+    // the slabs go with the nodes that sit in them
+    typedef std::pair<Node<Key, Value>*, NodeSlabs> Detached;
+    Detached* detached = new Detached(root, std::move(slabs_));
+    if (TreeReaper::sharedStopped())
+        freeSubtree(detached);
+    else
+        TreeReaper::shared().submit(detached, &BinarySearchTree<Key, Value>::freeSubtree);
+}
+
+/**
+ * Makes clear(), and so load() and the destructor, hand the nodes to the
+ * reaper thread instead of freeing them on the caller's.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setBackgroundTeardown(bool enabled) {
+    backgroundTeardown_ = enabled;
+}
+
+/**
+ * Frees a detached tree, given with its slabs, on the reaper thread (or on
+ * the caller's once the reaper has stopped), with the rotation walk of
+ * destroySubtree() but nothing else per node.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::freeSubtree(void* detached) {
+    typedef std::pair<Node<Key, Value>*, NodeSlabs> Detached;
+    Detached* tree = static_cast<Detached*>(detached);
+    Node<Key, Value>* node = tree->first;
+    while (node != nullptr) {
+        Node<Key, Value>* left = node->getLeft();
+        if (left != nullptr) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        } else {
+            Node<Key, Value>* right = node->getRight();
+            tree->second.destroy(node);
+            node = right;
+        }
+    }
+    delete tree;
+}
+
+/**
+ * Called by clearInBackground() in place of nodeDestroyed() for each node,
+ * for subclasses to drop all they keep per node at once.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::nodesReleased() {}
+
+#endif